@@ -0,0 +1,53 @@
+#pragma once
+#include "types/scene_object_types.hpp"
+#include <span>
+
+namespace igx {
+
+	class WorkerPool;
+
+	//Encode scene objects in bulk from structure of arrays input, which is what importers usually have
+	//The result is bit for bit what the constructors give, since it's either the constructors themselves or
+	//SSE doing the same f32 operations four objects at a time (see bulk_encode.cpp)
+	//The normals of triangles and directional lights with the default codecs are vectorized, lanes that end up
+	//as NaN (such as degenerate triangles) are always encoded by the constructors
+	//Halves of point lights and materials are converted with F16C if the cpu has it, but only zero and normal halves,
+	//where it rounds to nearest even like f16; the rest are encoded by the constructors. Blocks are split over workers
+	//Multiply-adds must not be fused for this, so igx and everything linking it is built with -ffp-contract=off
+
+	//Components of vectors as separate arrays
+	struct Vec3Arrays {
+
+		const f32 *x{}, *y{}, *z{};
+
+		inline bool empty() const { return !x; }
+		inline Vec3f32 operator[](usz i) const { return Vec3f32(x[i], y[i], z[i]); }
+	};
+
+	//Vertex 3i + k is corner k of triangle i
+	//Without normals the face normal is used, like Triangle(p0, p1, p2)
+	void encodeTriangles(
+		const Vec3Arrays &positions, const Vec3Arrays &normals, std::span<Triangle> out,
+		WorkerPool *workers = nullptr
+	);
+
+	//Like Light(dir, color, angularExtent)
+	List<Light> encodeDirectionalLights(
+		const Vec3Arrays &dirs, const Vec3Arrays &colors, usz count,
+		f32 angularExtent = 0.533_deg, WorkerPool *workers = nullptr
+	);
+
+	//Like Light(pos, color, rad, origin, specularity)
+	List<Light> encodePointLights(
+		const Vec3Arrays &positions, const Vec3Arrays &colors, const f32 *rad, const f32 *origin, usz count,
+		f32 specularity = 1, WorkerPool *workers = nullptr
+	);
+
+	//Like Material(albedo, ambient, emission, metallic, roughness, transparency)
+	List<Material> encodeMaterials(
+		const Vec3Arrays &albedo, const Vec3Arrays &ambient, const Vec3Arrays &emission,
+		const f32 *metallic, const f32 *roughness, const f32 *transparency, usz count,
+		WorkerPool *workers = nullptr
+	);
+
+}
\ No newline at end of file
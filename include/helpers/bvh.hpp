@@ -0,0 +1,179 @@
+#pragma once
+#include "types/vec.hpp"
+#include "dirty_bitset.hpp"
+#include <algorithm>
+#include <span>
+#include <limits>
+
+namespace igx {
+
+	class WorkerPool;
+
+	//Bounding volume hierarchy built top down with binned SAH
+	//Nodes are 32 bytes and siblings are stored next to each other, so it can be uploaded as is
+
+	class BVH {
+
+	public:
+
+		struct Node {
+
+			f32 min[3];
+			u32 offset;		//Left child (right is offset + 1) or the first primitive of a leaf
+
+			f32 max[3];
+			u32 count;		//Primitives in the leaf, 0 for inner nodes
+
+			inline bool isLeaf() const { return count; }
+		};
+
+		//Bounds of what the BVH is built over; the id is what the leaves refer to
+		struct Primitive {
+			f32 min[3], max[3];
+			u32 id;
+		};
+
+		static constexpr usz binCount = 16;
+		static constexpr usz maxDepth = 64;
+		static constexpr u32 maxLeafSize = 16;		//Bigger leaves are always split, even if SAH disagrees
+		static constexpr f32 traversalCost = 1;		//Relative to the cost of intersecting a primitive
+
+	private:
+
+		List<Node> nodes;
+		List<u32> primitives;
+
+		//What's needed to refit; the bounds of every primitive in leaf order and how to walk up the tree
+
+		List<Primitive> leafPrimitives;
+		List<u32> parents, leafOf, positionOf;		//By node, position in the leaves and id
+
+		List<u32> refitNodes;
+		DirtyBitset modified;
+		f64 cost{};
+
+		struct Builder;
+
+		void updateCost(const Node &node, f64 sign);
+
+	public:
+
+		//Build over primitives, which are kept in leaf order for refits
+		//Subtrees are built in parallel if workers are passed
+		void build(List<Primitive> primitives, WorkerPool *workers = nullptr);
+
+		//Move primitives without changing the structure; only the ancestors of their leaves are refit
+		//Returns false (and changes nothing) if one of the ids isn't in the BVH
+		bool refit(std::span<const Primitive> changed);
+
+		//Nodes that were refit since the last time it was cleared
+		inline const DirtyBitset &getModified() const { return modified; }
+		inline void clearModified() { modified.clearAll(); }
+
+		inline const List<Primitive> &getLeafPrimitives() const { return leafPrimitives; }
+
+		void clear();
+
+		inline const List<Node> &getNodes() const { return nodes; }
+		inline const List<u32> &getPrimitives() const { return primitives; }
+		inline bool empty() const { return nodes.empty(); }
+
+		//Expected cost of a ray relative to the root bounds; lower is better
+		f32 getCost() const;
+
+		//Calls hit(id, t) for primitives in the leaves the ray passes through, nearest nodes first
+		//hit returns if the primitive was hit and shortens t if it was closer
+		template<typename Hit>
+		inline void traverse(const Vec3f32 &origin, const Vec3f32 &dir, f32 &t, Hit &&hit) const {
+			traverse(nodes, origin, dir, t, [&](u32 position, f32 &tmax) { return hit(primitives[position], tmax); });
+		}
+
+		//Traverse nodes that were copied elsewhere; hit(position, t) gets where the primitive is in the leaves
+		template<typename Hit>
+		static inline void traverse(std::span<const Node> nodes, const Vec3f32 &origin, const Vec3f32 &dir, f32 &t, Hit &&hit);
+
+	};
+
+	//Implementation
+
+	template<typename Hit>
+	inline void BVH::traverse(std::span<const Node> nodes, const Vec3f32 &origin, const Vec3f32 &dir, f32 &t, Hit &&hit) {
+
+		if (nodes.empty())
+			return;
+
+		const f32 o[3] = { origin.x, origin.y, origin.z };
+		const f32 inv[3] = { 1 / dir.x, 1 / dir.y, 1 / dir.z };
+
+		static constexpr f32 miss = std::numeric_limits<f32>::infinity();
+
+		auto slab = [&o, &inv](const Node &node, f32 tmax) -> f32 {
+
+			f32 tnear = 0, tfar = tmax;
+
+			for (usz i = 0; i < 3; ++i) {
+
+				f32 t0 = (node.min[i] - o[i]) * inv[i], t1 = (node.max[i] - o[i]) * inv[i];
+
+				tnear = std::max(tnear, std::min(t0, t1));
+				tfar = std::min(tfar, std::max(t0, t1));
+			}
+
+			return tnear <= tfar ? tnear : miss;
+		};
+
+		if (slab(nodes[0], t) == miss)
+			return;
+
+		//Farther siblings are pushed with their distance, so they can be skipped once something closer is hit
+
+		struct StackEntry {
+			u32 node;
+			f32 dist;
+		};
+
+		StackEntry stack[maxDepth];
+		usz stackSize{};
+
+		u32 current{};
+
+		while (true) {
+
+			const Node &node = nodes[current];
+
+			if (!node.isLeaf()) {
+
+				u32 left = node.offset, right = left + 1;
+				f32 dl = slab(nodes[left], t), dr = slab(nodes[right], t);
+
+				if (dr < dl) {
+					std::swap(left, right);
+					std::swap(dl, dr);
+				}
+
+				if (dl != miss) {
+
+					if (dr != miss)
+						stack[stackSize++] = { right, dr };
+
+					current = left;
+					continue;
+				}
+			}
+
+			else for (u32 i = node.offset, end = node.offset + node.count; i < end; ++i)
+				hit(i, t);
+
+			//Go back to the nearest node that might still be closer than the hit
+
+			while (stackSize && stack[stackSize - 1].dist > t)
+				--stackSize;
+
+			if (!stackSize)
+				break;
+
+			current = stack[--stackSize].node;
+		}
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+#include "render_task.hpp"
+#include "types/scene_object_types.hpp"
+
+namespace igx {
+
+	class RayQuery;
+	class WorkerPool;
+
+	//Path traces the scene graph on the cpu and writes the result straight into a cpu writable texture
+	//It's a reference for the gpu renderers and a fallback for machines without one
+	//Samples are accumulated until reset is called; which is needed when the scene changes
+	//The camera's p0, p1 and p2 are the top left, top right and bottom left of the image plane
+	//p3, p4 and p5 are the same for the right eye; stereoscopic projections split the image in two
+	//Supports rgba32f, rgba16f and (s)rgba8; 8 bit formats are tonemapped
+
+	class CPUPathTracer : public TextureRenderTask {
+
+		WorkerPool *workers;
+
+		SceneGraph *scene{};
+		Camera camera{};
+
+		List<f32> accumulation;		//Sum of the samples per pixel; rgb
+		u32 samples{}, maxBounces = 4;
+
+		usz raysTraced{};
+		f64 mraysPerSecond{};
+
+		struct Tile;
+
+		void renderTile(Tile &tile, const RayQuery &query, u32 sample);
+		void writeTile(const Tile &tile, u8 *target) const;
+
+	public:
+
+		static constexpr u32 tileSize = 16;
+
+		//Tiles are split over the workers, such as the ones of FactoryContainer; without them it runs on the caller
+		CPUPathTracer(
+			Graphics &g, WorkerPool *workers, const String &name, GPUFormat format = GPUFormat::rgba16f
+		);
+
+		void resize(const Vec2u32 &size) override;
+
+		//Trace one sample per pixel and add it to the image
+		void update(f64 dt) override;
+
+		//The texture is uploaded through its flush, so nothing is recorded
+		void prepareCommandList(CommandList*) override {}
+
+		void switchToScene(SceneGraph *sceneGraph) override;
+
+		//Throw away the accumulated samples
+		void reset();
+
+		inline void setCamera(const Camera &cam) { camera = cam; reset(); }
+		inline const Camera &getCamera() const { return camera; }
+
+		inline void setMaxBounces(u32 bounces) { maxBounces = bounces; reset(); }
+		inline u32 getMaxBounces() const { return maxBounces; }
+
+		inline u32 getSamples() const { return samples; }
+
+		//Rays traced by the last update (camera, bounce and shadow rays) and how many million per second
+		inline usz getRaysTraced() const { return raysTraced; }
+		inline f64 getMraysPerSecond() const { return mraysPerSecond; }
+
+	};
+
+}
\ No newline at end of file
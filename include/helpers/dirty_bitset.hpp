@@ -0,0 +1,134 @@
+#pragma once
+#include "types/types.hpp"
+#include <bit>
+#include <algorithm>
+
+namespace igx {
+
+	//Packed bitset that tracks which elements are modified
+	//Runs of set bits are extracted a word at a time,
+	//so scanning a mostly clean buffer costs O(words) rather than O(elements)
+
+	class DirtyBitset {
+
+		List<u64> words;
+		usz bits{};
+
+		static constexpr usz wordBits = 64;
+
+		//Find the first bit >= i that equals value, or end if there is none
+
+		template<bool value>
+		inline usz findNext(usz i, usz end) const {
+
+			while (i < end) {
+
+				u64 word = words[i / wordBits];
+
+				if constexpr (!value)
+					word = ~word;
+
+				word &= u64_MAX << (i % wordBits);
+
+				if (word) {
+					i = i / wordBits * wordBits + usz(std::countr_zero(word));
+					return i < end ? i : end;
+				}
+
+				i = (i / wordBits + 1) * wordBits;
+			}
+
+			return end;
+		}
+
+		template<bool value>
+		inline void fill(usz begin, usz end) {
+
+			while (begin < end) {
+
+				usz word = begin / wordBits, offset = begin % wordBits;
+				usz count = std::min(end - begin, wordBits - offset);
+
+				u64 mask = (count == wordBits ? u64_MAX : (u64(1) << count) - 1) << offset;
+
+				if constexpr (value)
+					words[word] |= mask;
+
+				else words[word] &= ~mask;
+
+				begin += count;
+			}
+		}
+
+	public:
+
+		DirtyBitset() = default;
+		DirtyBitset(usz bits): words((bits + wordBits - 1) / wordBits), bits(bits) {}
+
+		inline usz size() const { return bits; }
+
+		//Bits that are added are clean
+		inline void resize(usz newBits) {
+
+			if (newBits < bits)
+				clearRange(newBits, bits);
+
+			words.resize((newBits + wordBits - 1) / wordBits);
+			bits = newBits;
+		}
+
+		inline bool operator[](usz i) const { return words[i / wordBits] >> (i % wordBits) & 1; }
+
+		inline void set(usz i) { words[i / wordBits] |= u64(1) << (i % wordBits); }
+		inline void clear(usz i) { words[i / wordBits] &= ~(u64(1) << (i % wordBits)); }
+
+		inline void setRange(usz begin, usz end) { fill<true>(begin, end); }
+		inline void clearRange(usz begin, usz end) { fill<false>(begin, end); }
+
+		inline void clearAll() { std::fill(words.begin(), words.end(), u64(0)); }
+
+		//Calls f(begin, end) for every run of set bits in [begin, end)
+
+		template<typename Func>
+		inline void forEachRange(usz begin, usz end, Func &&f) const {
+
+			end = std::min(end, bits);
+
+			while ((begin = findNext<true>(begin, end)) < end) {
+				usz last = findNext<false>(begin, end);
+				f(begin, last);
+				begin = last;
+			}
+		}
+
+		//Calls f(begin, end) like forEachRange, but merges runs separated by at most maxGap clean bits
+		//Returns the number of runs before merging
+
+		template<typename Func>
+		inline usz forEachMergedRange(usz begin, usz end, usz maxGap, Func &&f) const {
+
+			usz runs{}, first{}, last{};
+
+			forEachRange(begin, end, [&](usz runBegin, usz runEnd) {
+
+				if (runs++ && runBegin - last <= maxGap) {
+					last = runEnd;
+					return;
+				}
+
+				if (runs > 1)
+					f(first, last);
+
+				first = runBegin;
+				last = runEnd;
+			});
+
+			if (runs)
+				f(first, last);
+
+			return runs;
+		}
+
+	};
+
+}
\ No newline at end of file
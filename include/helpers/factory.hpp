@@ -1,5 +1,6 @@
 #pragma once
 #include "common.hpp"
+#include "worker_pool.hpp"
 
 namespace igx {
 
@@ -52,6 +53,8 @@ namespace igx {
 
 		UploadBufferRef defaultUploadBuffer;
 
+		WorkerPool workers;
+
 	public:
 
 		FactoryContainer(Graphics &g) :
@@ -66,6 +69,7 @@ namespace igx {
 
 		inline Graphics &getGraphics() const { return pipelines.getGraphics(); }
 		inline UploadBufferRef getDefaultUploadBuffer() const { return defaultUploadBuffer; }
+		inline WorkerPool &getWorkers() { return workers; }
 
 		inline auto get(const String &name, const Pipeline::Info &p) { 
 			return pipelines.get(name, p); 
@@ -0,0 +1,99 @@
+#pragma once
+#include "bvh.hpp"
+#include "types/scene_object_types.hpp"
+#include <span>
+
+namespace igx {
+
+	//Hierarchy over the lights to pick one for a point in O(log n), proportional to how much it's expected to contribute
+	//The structure is a BVH over the bounds of point and spot lights, whose nodes also store the power
+	//and a cone around the directions the lights below it shine in
+	//Directional lights are infinite, so they're kept next to the tree and picked against its root
+	//Spot lights don't store their angle, so they're bounded by the hemisphere they face
+
+	class LightTree {
+
+	public:
+
+		struct Node {
+
+			f32 min[3];
+			u32 offset;			//Left child (right is offset + 1) or the first emitter of a leaf
+
+			f32 max[3];
+			u32 count;			//Emitters in the leaf, 0 for inner nodes
+
+			f32 axis[3];
+			f32 cosTheta;		//Cone around axis; -1 if the lights shine in every direction
+
+			f32 power;
+			u32 pad[3]{};
+
+			inline bool isLeaf() const { return count; }
+		};
+
+		//A light as it's stored in the leaves
+		struct Emitter {
+
+			f32 pos[3];
+			f32 radius;
+
+			f32 axis[3];
+			f32 cosTheta;
+
+			f32 power;
+			u32 light;			//Index in the lights
+			u32 pad[2]{};
+		};
+
+	private:
+
+		BVH bvh;
+
+		List<Node> nodes;
+		List<Emitter> emitters;		//In the order of the leaves
+		List<u32> emitterOf;		//By light; u32_MAX if it's directional
+
+		List<Emitter> directional;
+		f32 directionalPower{};
+
+		DirtyBitset modifiedEmitters;
+		List<Pair<usz, usz>> refitRanges;
+
+		void fitNode(u32 i);
+
+		static Emitter toEmitter(const Light &light, u32 index);
+		static f32 getPower(const Light &light);
+
+	public:
+
+		//Build over all lights; lights are referred to by their index
+		void build(std::span<const Light> lights, WorkerPool *workers = nullptr);
+
+		//Update the lights that changed without changing the structure; only their ancestors are refit
+		//Returns false if one of them isn't in the tree or became directional, in which case it has to be rebuilt
+		bool refit(std::span<const Light> lights, std::span<const u32> changed);
+
+		//Pick a light for a point with normal n (can be zero), given a random number in [0, 1>
+		//Returns false if no light can reach the point; pdf is the probability of picking that light
+		bool sample(const Vec3f32 &p, const Vec3f32 &n, f32 u, u32 &light, f32 &pdf) const;
+
+		//Nodes and emitters that were refit since the last time it was cleared
+		inline const DirtyBitset &getModified() const { return bvh.getModified(); }
+		inline const DirtyBitset &getModifiedEmitters() const { return modifiedEmitters; }
+
+		inline void clearModified() {
+			bvh.clearModified();
+			modifiedEmitters.clearAll();
+		}
+
+		void clear();
+
+		inline const List<Node> &getNodes() const { return nodes; }
+		inline const List<Emitter> &getEmitters() const { return emitters; }
+		inline const List<Emitter> &getDirectional() const { return directional; }
+		inline bool empty() const { return nodes.empty() && directional.empty(); }
+
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+#include "types/types.hpp"
+#include <span>
+
+namespace igx {
+
+	//Read only view of a whole file on disk through virtual memory
+	//Pages are only read once they're touched, so opening is cheap and threads can read different parts at once
+	//Virtual files (VIRTUAL_FILE) are packed into the executable, so they can't be mapped
+
+	class MappedFile {
+
+		const u8 *ptr{};
+		usz length{};
+		bool opened{};
+
+		void close();
+
+	public:
+
+		MappedFile() = default;
+
+		//Check isOpen; the file doesn't exist or couldn't be mapped otherwise
+		MappedFile(const String &path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile &operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile &&other);
+		MappedFile &operator=(MappedFile &&other);
+
+		inline bool isOpen() const { return opened; }
+		inline const u8 *data() const { return ptr; }
+		inline usz size() const { return length; }
+		inline std::span<const u8> getData() const { return { ptr, length }; }
+
+	};
+
+}
\ No newline at end of file
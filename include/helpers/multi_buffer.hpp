@@ -0,0 +1,39 @@
+#pragma once
+#include "common.hpp"
+
+namespace igx {
+
+	//A GPU buffer per frame in flight, so the next frame can be written while the current one is in use
+	//Ranges flushed for one frame are carried to the others, which copy them from the cpu source once they're used again
+
+	class MultiBuffer {
+
+		List<GPUBufferRef> buffers;
+		List<List<Pair<usz, usz>>> carried;
+
+	public:
+
+		MultiBuffer() = default;
+		MultiBuffer(Graphics &g, const String &name, const GPUBuffer::Info &info, usz frames);
+
+		inline usz frames() const { return buffers.size(); }
+
+		inline const GPUBufferRef &operator[](usz frame) const { return buffers[frame]; }
+		inline u8 *getBuffer(usz frame) const { return buffers[frame]->getBuffer(); }
+
+		//Flush a range that was written to the buffer of this frame and carry it to the others
+		void flush(usz frame, usz offset, usz size);
+
+		//Copy the ranges that were carried to this frame from the source and flush them
+		//Returns how many ranges were left after merging
+		usz catchUp(usz frame, const u8 *source);
+
+		//Stop carrying what's past size, because the source shrunk
+		void truncate(usz size);
+
+		//Copy the first size bytes of source to every frame, for example after the buffers were reallocated
+		void copyFrom(const u8 *source, usz size);
+
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+#include "scene_graph.hpp"
+
+namespace igx {
+
+	//What a ray hit; id is 0 if it didn't hit anything
+
+	struct RayHit {
+		u64 id;		//Object id as returned by SceneGraph::add
+		f32 t;
+		u32 material;		//Index of the material, not its handle
+		SceneObjectType type;
+	};
+
+	//Cpu ray casts against a scene graph, as it was after its last update
+	//Rays are traced in packets of 4 with SSE if it's available, so coherent rays share traversal
+	//The scene graph can't be modified while a query runs
+
+	class RayQuery {
+
+		const SceneGraph &scene;
+		WorkerPool *workers;
+
+		//Where every geometry type starts and ends in the ids the BVH uses
+
+		struct GeometryRange {
+			u32 begin, end;
+			SceneObjectType type;
+		};
+
+		GeometryRange ranges[usz(SceneObjectType::COUNT)];
+		usz rangeCount{};
+
+		struct Packet;
+
+		template<bool anyHit>
+		void trace(const Ray *rays, usz count, const f32 *tmax, f32 *t, u32 *geometry) const;
+
+		template<bool anyHit>
+		inline void intersect(Packet &packet, u32 geometry, u32 lanes) const;
+
+		RayHit decode(u32 geometry, f32 t) const;
+
+	public:
+
+		static constexpr usz packetSize = 4;
+
+		//Packets are split over the workers if they're passed
+		RayQuery(const SceneGraph &scene, WorkerPool *workers = nullptr);
+
+		//Find the closest object every ray hits that's closer than tmax
+		void closestHit(std::span<const Ray> rays, std::span<RayHit> hits, f32 tmax = rayMiss) const;
+
+		//Find if every ray hits anything closer than tmax; for visibility or shadow rays
+		void anyHit(std::span<const Ray> rays, std::span<u8> hits, f32 tmax = rayMiss) const;
+
+		//Any hit with a maximum distance per ray; e.g. shadow rays towards lights that are at different distances
+		void anyHit(std::span<const Ray> rays, std::span<const f32> tmax, std::span<u8> hits) const;
+
+		RayHit closestHit(const Ray &ray, f32 tmax = rayMiss) const;
+		bool anyHit(const Ray &ray, f32 tmax = rayMiss) const;
+
+		//Normal of the geometry where the ray hit it, facing against the ray
+		Vec3f32 getNormal(const Ray &ray, const RayHit &hit) const;
+
+	};
+
+}
\ No newline at end of file
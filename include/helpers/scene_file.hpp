@@ -0,0 +1,105 @@
+#pragma once
+#include "helpers/scene_graph.hpp"
+
+namespace igx {
+
+	class WorkerPool;
+
+	//Scene graph as an .igxs file, see docs/formats.md
+	//Objects are stored with the same stride as the buffers of the scene graph,
+	//so loading maps the file and copies every type into the scene graph with one addBatch
+	//Meshes are stored as they are in the scene graph; triangles, or quantized vertices and indices for indexed meshes
+	//Their BVHs aren't stored, so they're rebuilt when loading
+
+	struct SceneFileHeader {
+
+		static constexpr c8 magic[4] = { 'i', 'g', 'x', 's' };
+		static constexpr u32 currentVersion = 2;
+
+		c8 name[4];
+		u32 version;
+
+		u8 normalCodec, lightNormalCodec;		//IGX_NORMAL_CODEC and IGX_LIGHT_NORMAL_CODEC it was saved with
+		u16 sectionCount;
+		u32 pad;
+
+		u64 size;		//Of the file
+		u64 checksum;		//Of the section table; every section has a checksum of its own
+	};
+
+	//A section per type that has objects; objects start at offset, which is aligned to sceneFileAlignment
+	//They're followed by the id every object had when it was saved (u64)
+	//and for geometry by the material as an index into the material section (u32, 0 if it had none)
+	//Indices outside of the material section are loaded as material handle 0
+	//The mesh section (type COUNT) has the triangles of meshes that aren't indexed, followed by a SceneFileMesh per mesh,
+	//then the quantized vertices and the indices (u32) of the indexed meshes
+
+	struct SceneFileSection {
+
+		SceneObjectType type;		//COUNT for meshes
+		u8 pad[3];
+
+		u32 stride;		//sizeof the object, which depends on the normal codecs
+		u32 count;
+		u32 meshes;		//Only for meshes
+		u32 vertices, indices;		//Only for meshes; indices are in u32s
+
+		u64 offset, size;		//In the file
+		u64 checksum;		//Of the bytes of the section
+	};
+
+	//A mesh either has triangleCount triangles in the mesh section or is indexed, in which case
+	//it has vertexCount vertices and indexCount u32s of indices (packed two per u32 for U16), in the order of its leaves
+
+	struct SceneFileMesh {
+
+		u32 triangleCount;
+		MeshIndexFormat indexFormat;
+
+		u32 vertexCount, indexCount;		//Only if it's indexed
+		f32 origin[3], scale[3];		//Bounds the vertices are quantized within, see MeshInfo
+	};
+
+	static constexpr usz sceneFileAlignment = 64;
+
+	struct SceneLoad {
+
+		//Seconds per stage, to compare against SceneImport
+		f64 mapTime{};		//Mapping the file and checking the header and sections
+		f64 verifyTime{};		//Checksums and material and mesh indices; 0 if it wasn't verified
+		f64 insertTime{};		//Adding the objects and meshes to the scene graph
+		f64 uploadTime{};		//SceneGraph::update; 0 if it wasn't requested
+
+		//Ids in the scene graph and the ids they were saved with, in the same order
+		List<u64> ids[u8(SceneObjectType::COUNT)], savedIds[u8(SceneObjectType::COUNT)];
+
+		List<u32> meshes;		//Mesh index in the scene graph per saved mesh
+
+		inline f64 getTime() const { return mapTime + verifyTime + insertTime + uploadTime; }
+
+		inline usz getObjectCount() const {
+
+			usz count{};
+
+			for (const List<u64> &type : ids)
+				count += type.size();
+
+			return count;
+		}
+	};
+
+	//Save all objects and meshes of a scene graph; deleted objects are left out
+	//Returns false and logs why if the file can't be written
+	bool saveScene(const SceneGraph &scene, const String &path);
+
+	//Add everything in an .igxs file to a scene graph
+	//Files saved with other normal codecs can't be loaded, since their objects have another stride
+	//With verify, the checksums and indices are checked before anything is added; only skip it for trusted files
+	//With upload, the scene graph is updated afterwards so the upload is timed as well
+	//Returns false and logs why if the file can't be loaded; no objects are added then, though meshes may be
+	bool loadScene(
+		SceneGraph &scene, const String &path, SceneLoad &result,
+		WorkerPool *workers = nullptr, bool verify = true, bool upload = false
+	);
+
+}
\ No newline at end of file
@@ -1,8 +1,16 @@
 #pragma once
 #include "types/scene_object_types.hpp"
 #include "factory.hpp"
+#include "dirty_bitset.hpp"
+#include "multi_buffer.hpp"
+#include "bvh.hpp"
+#include "light_tree.hpp"
+#include "types/ray.hpp"
 #include "gui/gui.hpp"
 #include "gui/struct_inspector.hpp"
+#include <span>
+#include <thread>
+#include <atomic>
 
 namespace igx {
 
@@ -15,6 +23,7 @@ namespace igx {
 		SPHERE,
 		CUBE,
 		PLANE,
+		INSTANCE,
 		COUNT,
 		FIRST = LIGHT
 	};
@@ -47,6 +56,9 @@ namespace igx {
 	template<>
 	struct TSceneObjectType<Plane> : TSceneObjectType_Base<SceneObjectType::PLANE, true> { };
 
+	template<>
+	struct TSceneObjectType<Instance> : TSceneObjectType_Base<SceneObjectType::INSTANCE, true> { };
+
 	template<typename T>
 	static constexpr SceneObjectType SceneObjectType_t = TSceneObjectType<T>::type;
 
@@ -68,31 +80,56 @@ namespace igx {
 		};
 
 		struct {
-			u32 lightCount, materialCount, triangleCount, sphereCount, cubeCount, planeCount;
+			u32 lightCount, materialCount, triangleCount, sphereCount, cubeCount, planeCount, instanceCount;
 			u32 directionalLightCount, spotLightCount, pointLightCount;
 		};
 	};
 
+	class RayQuery;
+
 	class SceneGraph {
 
+		friend class RayQuery;
+
 	public:
 
 		struct Inspection;
 
 		struct Object {
-			GPUBufferRef buffer;
-			Buffer cpuData;
-			List<bool> markedForUpdate;
+			MultiBuffer buffer;
+			Buffer cpuData;		//Empty if the objects are edited in place
+			u8 *data{};		//Where objects are edited; cpuData or the mapped gpu buffer
+			DirtyBitset markedForUpdate;
+			DirtyBitset materialsChanged;		//Geometry that was given another material
 			List<u64> toIndex;
+			List<u32> holes;		//Deleted slots below the count; reused by add before appending
+			u32 materialOffset = u32_MAX;		//Where this type starts in the material indices
+			u32 updatedCount{};		//Objects as of the last update, which materialOffset and the BVH match
+			bool remapMaterials{};		//The material offset moved this update, so all indices have to be rewritten
+			bool needsCompaction{};		//Holes exist
 		};
 
+		//An id is a generational handle; (generation << 32) | slot
+		//The generation of a slot is bumped on delete, so stale ids are rejected
+
 		struct Entry {
 			u32 index, material;
-			SceneObjectType type;
+			u32 generation;
+			SceneObjectType type;		//COUNT if the slot is free
+		};
+
+		//How the dirty ranges of a type were flushed last update
+
+		struct FlushStats {
+			u32 dirtyRanges, flushedRanges;		//Before and after merging
+			usz flushedBytes;
 		};
 
 		enum class Flags : u32 {
-			NONE = 0
+			NONE = 0,
+			SWAP_ON_DELETE = 1 << 0,	//Deleting geometry moves the last of its type into the slot; order isn't kept
+			IN_PLACE = 1 << 1,			//Edit objects in the mapped gpu buffer without a cpu copy; requires 1 frame in flight
+			DEDUPLICATE_MATERIALS = 1 << 2	//Adding a material that exists returns its id and adds a reference; del removes one
 		};
 
 	private:
@@ -102,24 +139,134 @@ namespace igx {
 
 		Object objects[u8(SceneObjectType::COUNT)];
 
-		HashMap<u64, Entry> entries{};
-		u64 counter{};
+		List<Entry> entries;
+		List<u32> freeEntries;
 
-		SceneGraphInfo *info, limits;
-		DescriptorsRef descriptors;
+		SceneGraphInfo info{}, limits{};		//limits are the current capacities; they grow when a type is full
+		List<DescriptorsRef> descriptors;
 		PipelineLayoutRef layout;
-		GPUBufferRef sceneData, materialIndices;
+		MultiBuffer sceneData, materialIndices;
 
 		SamplerRef linear;
 		TextureRef skybox;
 
-		u32 geometryId{};
-		u32 *materialByObject{};
+		String sceneName;
+
+		u32 geometryId{}, materialCapacity{};
+		List<u32> materialCpu;
+		u32 *materialByObject{};		//materialCpu or the mapped gpu buffer
+
+		//Geometry refers to materials by handle, which the remap turns into the index of the material
+		//Moving a material only rewrites its own handle, rather than all geometry that uses it
+		//Handles that were never handed out map to the same index
+
+		List<u32> materialRemap, freeMaterialHandles;
+		DirtyBitset materialRemapDirty;
+		MultiBuffer materialRemapBuffer;
+		u32 materialHandles{};
+
+		//With DEDUPLICATE_MATERIALS identical materials are stored once, found by the hash of their contents
+		//A hash that collides with a different material isn't shared, so the second material is just added
+
+		HashMap<u64, u64> materialsByHash;
+		List<u64> materialHashes;		//By handle
+		List<u32> materialReferences;		//By handle; how many adds del still has to undo
+
+		//Host memory that isn't allocated because objects are edited in place
+		usz hostBytesSaved{};
+
+		//Hierarchy over triangles, spheres and cubes; planes are infinite so they're not in it
+		//Leaves refer to geometry by where it is in the material indices
+		//It's rebuilt when geometry is added, removed or moved in memory
+		//Geometry that was only updated is refit, which is cheaper but makes the tree worse over time
+
+		BVH bvh;
+		List<BVH::Primitive> bvhRefits;
+		MultiBuffer bvhNodes, bvhPrimitives;
+		usz bvhNodeCapacity{}, bvhPrimitiveCapacity{};
+		bool bvhOutdated = true;
+
+		//Lights are picked by importance through a light tree
+		//It's rebuilt when lights are added, removed or sorted, otherwise the updated lights are refit
+
+		LightTree lightTree;
+		List<u32> lightRefits;
+		MultiBuffer lightTreeNodes, lightTreeEmitters;
+		usz lightTreeNodeCapacity{}, lightTreeEmitterCapacity{};
+		bool lightTreeOutdated = true;
+
+		//Meshes are only added, so their buffers are appended to and the new part is flushed
+
+		List<MeshInfo> meshes;
+		List<Triangle> meshTriangles;		//In the order of the leaves of their mesh
+		List<BVH::Node> meshNodes;
+
+		List<QuantizedVertex> meshVertices;		//Of indexed meshes
+		List<u32> meshIndices;		//Of indexed meshes, in the order of the leaves
+
+		MultiBuffer meshBuffer, meshTriangleBuffer, meshNodeBuffer, meshVertexBuffer, meshIndexBuffer;
+		usz meshCapacity{}, meshTriangleCapacity{}, meshNodeCapacity{}, meshVertexCapacity{}, meshIndexCapacity{};
+		usz uploadedMeshes{}, uploadedMeshTriangles{}, uploadedMeshNodes{}, uploadedMeshVertices{}, uploadedMeshIndices{};
+
+		//Once refits made the SAH cost this much worse than after the build, it's rebuilt on another thread
+		//Geometry that is refit in the meantime is refit again on the new tree before it's used
+
+		f32 bvhBuiltCost{}, bvhRebuildThreshold = 1.5f;
+
+		struct BackgroundBuild {
+			std::thread thread;
+			std::atomic<bool> done;
+			bool running, stale;		//Stale if the structure changed while it was building
+			BVH result;
+			List<BVH::Primitive> input;
+			List<u32> refit;		//Geometry ids that were refit after the input was taken
+		};
+
+		BackgroundBuild bvhRebuild{};
+
+		//The frame in flight that the last update wrote to
+		usz frame{};
+
+		//Estimated cost of one flush region expressed in bytes
+		//Dirty ranges with a smaller gap in between are merged, since copying the gap is cheaper
+
+		usz flushRegionCost = 256;
+		FlushStats flushStats[u8(SceneObjectType::COUNT)]{};
+
+		//How many objects per type update is allowed to move into holes
+		//Deleted objects are zeroed, so holes that remain are ignored by the GPU
+
+		u32 compactionBudget = 4096;
 		Flags flags;
 
+		//Work for a range of objects of one type during update
+		//Flushes are only recorded, so the chunks can run on multiple threads
+
+		struct UpdateChunk {
+			SceneObjectType type;
+			u32 begin, end;
+			List<Pair<usz, usz>> objectFlushes, materialFlushes;
+			FlushStats stats;
+		};
+
+		List<UpdateChunk> updateChunks;
+
 		void *inspector;
 
 		bool isModified = true;
+		bool descriptorsOutdated{};		//A buffer was reallocated, so update has to rebind them
+
+		//Buffers and descriptors that were replaced while frames in flight might still read them
+		//They're released once update wrote every frame again, since the caller waited on those frames by then
+
+		struct Retired {
+			usz update;		//The update they were replaced in (or after)
+			List<MultiBuffer> buffers;
+			List<DescriptorsRef> descriptors;
+		};
+
+		List<Retired> retired;
+		usz updates{};
 
 	public:
 
@@ -134,29 +281,64 @@ namespace igx {
 			FactoryContainer &factory,
 			const String &sceneName,
 			const String &skyboxName,
-			u32 maxTriangles = 65536,
-			u32 maxLights = 65536,
-			u32 maxMaterials = 65536,
-			u32 maxCubes = 32768,
-			u32 maxSpheres = 16384,
-			u32 maxPlanes = 256,
-			Flags flags = Flags::NONE
+			u32 maxTriangles = 4096,		//Initial capacities; every type grows when it's full
+			u32 maxLights = 256,
+			u32 maxMaterials = 256,
+			u32 maxCubes = 256,
+			u32 maxSpheres = 256,
+			u32 maxPlanes = 64,
+			Flags flags = Flags::NONE,
+			u8 framesInFlight = 1
 		);
 
 		virtual ~SceneGraph();
 
-		void del(const List<u64> &ids);
+		//Delete objects by id; ids that don't exist (anymore) are skipped
+		//Shared materials are only deleted once every add of them is deleted
+		//Geometry that used a deleted material is given material handle 0
+		void del(std::span<const u64> ids);
+
+		//Ensure a type can hold capacity objects without growing
+		//Useful before loading a scene whose size is known up front
+		//Returns false if it doesn't fit in the scene graph
+		bool reserve(SceneObjectType type, u32 capacity);
+
+		//Add a mesh that can be placed multiple times through instances
+		//Its triangles are in the space of the mesh and a BVH is built over them, which is shared by the instances
+		//Returns the mesh index to use in Instance or u32_MAX if it's empty
+		u32 addMesh(std::span<const Triangle> triangles);
+
+		//Add a mesh as vertices and triples of indices into them, which is stored indexed and quantized
+		//Normals are per vertex; if they're empty, the area weighted normals of the triangles are used
+		//Returns u32_MAX if it's empty or an index or the number of normals is invalid
+		u32 addMesh(std::span<const Vec3f32> positions, std::span<const Vec3f32> normals, std::span<const u32> indices);
+
+		//Add an indexed mesh whose vertices are already quantized within bounds, such as one that was saved
+		//Only the origin and scale of bounds are used; the vertices are stored as they are
+		//Returns u32_MAX if it's empty or an index is invalid
+		u32 addMesh(const MeshInfo &bounds, std::span<const QuantizedVertex> vertices, std::span<const u32> indices);
+
+		//Triangle i of a mesh, in the order of the leaves of its BVH; indexed meshes are decoded
+		inline Triangle getMeshTriangle(const MeshInfo &mesh, u32 i) const {
+
+			if (mesh.indexFormat == MeshIndexFormat::NONE)
+				return meshTriangles[mesh.firstTriangle + i];
+
+			return mesh.getTriangle(meshVertices.data(), meshIndices.data(), i);
+		}
 
 		//Add non geometry objects
-		//Returns an object id; which will keep incrementing
+		//Returns an object id; which stays valid until it is deleted
 		//This is not the local array index, but rather an identifier that maps to a local index
 		//The local object can be moved in memory once previous are moved
 		//Returns 0 if it's invalid
+		//With DEDUPLICATE_MATERIALS, a material that already exists returns the id it was added with before
 		template<typename T>
 		inline u64 addNonGeometry(const T &object);
 
 		//Add geometry objects (with certain materials)
-		//Returns an object id; which will keep incrementing
+		//Materials are referred to by their handle, see getMaterialHandle
+		//Returns an object id; which stays valid until it is deleted
 		//This is not the local array index, but rather an identifier that maps to a local index
 		//The local object can be moved in memory once previous are moved
 		//Returns 0 if it's invalid
@@ -169,8 +351,28 @@ namespace igx {
 		template<typename T>
 		inline void add(const T &object);
 
-		inline auto find(u64 index) const { return entries.find(index); }
-		inline bool exists(u64 index) const { return find(index) != entries.end(); }
+		//Add objects of the same type in bulk
+		//Geometry requires either a material per object or one material for all of them
+		//They are appended as one contiguous run; so one memcpy and one dirty range
+		//Returns the ids in the same order, or an empty list if they don't fit
+		template<typename T>
+		inline List<u64> addBatch(std::span<const T> objects, std::span<const u32> materials = {});
+
+		//Give geometry another material handle; only the material indices are flushed, not the geometry
+		//Returns how many of the ids were valid geometry
+		usz setMaterial(std::span<const u64> geometry, u32 material);
+		inline bool setMaterial(u64 geometry, u32 material) { return setMaterial(std::span<const u64>(&geometry, 1), material); }
+
+		//A handle stays the same when the material moves, which its index doesn't
+		//Handles of deleted materials are reused, except handle 0; returns u32_MAX if it's not a material
+		u32 getMaterialHandle(u64 material) const;
+
+		//Where the material of a handle currently is; u32_MAX if the handle is out of range
+		inline u32 getMaterialIndex(u32 handle) const { return handle < materialRemap.size() ? materialRemap[handle] : u32_MAX; }
+
+		//Returns nullptr if the id doesn't exist (anymore)
+		inline const Entry *find(u64 id) const;
+		inline bool exists(u64 id) const { return find(id); }
 
 		virtual void input(const oic::InputDevice*, oic::InputHandle, bool) {}
 
@@ -179,37 +381,191 @@ namespace igx {
 		template<typename T>
 		bool update(u64 index, const T &object);
 
-		//Compact all objects and prepare them for the GPU transfer
+		//Update objects of the same type in bulk
+		//Ids that map to consecutive slots are written with one memcpy
+		//Returns how many of the ids were valid
+		template<typename T>
+		inline usz updateBatch(std::span<const u64> ids, std::span<const T> objects);
+
+		//Compact objects (within the compaction budget) and prepare them for the GPU transfer
 		virtual void update(f64 dt);
 
-		//Ensure the copy commands are on the GPU
-		void fillCommandList(CommandList *cl);
+		//Remove all dead space of a type at once, instead of spreading it over multiple updates
+		//Materials are only compacted this way, since geometry refers to them by index
+		void compact(SceneObjectType type);
+		void compact();
+
+		//Shoot random rays through the BVH and check them against brute force
+		//Uses the BVH of the last update; returns how many rays hit something else
+		//It's meant for debugging, since it's slow
+		usz verifyBVH(usz rays = 1024, u32 seed = 0);
+
+		//Ensure the copy commands of a frame in flight are on the GPU
+		//With multiple frames in flight, every frame needs its own command list
+		void fillCommandList(CommandList *cl, usz frameId = 0);
 
 		//Helpers
+		//Per frame resources default to the frame that was written by the last update
+		//Buffers and descriptors are replaced when a type grows, so they shouldn't be kept between frames
+		//The ones they replace stay alive until every frame in flight was updated again
 
-		inline auto &getInfo() const { return *info; }
+		inline auto &getInfo() const { return info; }
 		inline auto &getLimits() const { return limits; }
 		inline auto &getSkybox() const { return skybox; }
-		inline auto &getDescriptors() const { return descriptors; }
-		inline auto &getBuffer(SceneObjectType type) const { return objects[u8(type)].buffer; }
-		inline auto &getSceneInfo() const { return sceneData; }
+		inline usz getFrame() const { return frame; }
+		inline usz getFramesInFlight() const { return descriptors.size(); }
+		inline auto &getDescriptors() const { return descriptors[frame]; }
+		inline auto &getDescriptors(usz frameId) const { return descriptors[frameId]; }
+		inline auto &getBuffer(SceneObjectType type) const { return objects[u8(type)].buffer[frame]; }
+		inline auto &getSceneInfo() const { return sceneData[frame]; }
+		inline auto &getFlushStats(SceneObjectType type) const { return flushStats[u8(type)]; }
+		inline auto &getBVH() const { return bvh; }
+		inline auto &getMeshes() const { return meshes; }
+		inline auto &getMeshVertices() const { return meshVertices; }
+		inline auto &getMeshIndices() const { return meshIndices; }
+		inline auto &getLightTree() const { return lightTree; }
+		inline bool isRebuildingBVH() const { return bvhRebuild.running; }
+
+		inline f32 getBVHRebuildThreshold() const { return bvhRebuildThreshold; }
+		inline void setBVHRebuildThreshold(f32 costRatio) { bvhRebuildThreshold = costRatio; }
+		inline usz getHostBytesSaved() const { return hostBytesSaved; }
+		inline bool isInPlace() const { return HasFlags(flags, Flags::IN_PLACE); }
+
+		inline usz getFlushRegionCost() const { return flushRegionCost; }
+		inline void setFlushRegionCost(usz bytes) { flushRegionCost = bytes; }
+
+		inline u32 getCompactionBudget() const { return compactionBudget; }
+		inline void setCompactionBudget(u32 objectsPerUpdate) { compactionBudget = objectsPerUpdate; }
 
 		template<SceneObjectType type>
-		inline auto &getBuffer() const { return objects[u8(type)].buffer; }
+		inline auto &getBuffer() const { return objects[u8(type)].buffer[frame]; }
+
+		//Objects of a type where they're edited; deleted objects are zeroed
+		template<typename T>
+		inline std::span<const T> getObjects() const;
+
+		//Id of every object of a type, in the same order as getObjects; 0 for deleted objects
+		inline std::span<const u64> getIds(SceneObjectType type) const {
+			return std::span<const u64>(objects[u8(type)].toIndex.data(), info.objectCount[u8(type)]);
+		}
 
 		static const List<RegisterLayout> &getLayout();
 
 	private:
 
+		inline Entry *lookup(u64 id) { return const_cast<Entry*>(find(id)); }
+
+		//Grow geometrically until a type can hold the required number of objects
+		bool grow(SceneObjectType type, usz required);
+
+		//Reallocate the buffers of a type or the material indices, keeping their contents
+		void resizeObjects(SceneObjectType type, u32 capacity);
+		void resizeMaterialIndices();
+		void resizeMaterialRemap();
+
+		//Hand out a handle for a material that was added at index
+		u32 addMaterialHandle(u32 index);
+
+		//Find the id of a material with the same contents, 0 if there's none
+		u64 findMaterial(u64 hash, const Material &material) const;
+
+		//Start or stop sharing a material by its current contents
+		void internMaterial(u64 id);
+		void forgetMaterial(u64 id);
+
+		void createDescriptors();
+
+		//Keep what was replaced alive until the frames in flight that might use it are done
+		Retired &getRetired();
+		void retire(MultiBuffer &&buffer);
+
+		//Rebuild or refit the BVH and copy what changed to the gpu
+		void updateBVH();
+		void buildBVH();
+		void refitBVH();
+		void uploadBVH(MultiBuffer &buffer, usz &capacity, const String &name, const u8 *data, usz size);
+		void uploadBVH();
+
+		//Rebuild or refit the light tree and copy what changed to the gpu
+		void updateLightTree();
+
+		//Returns false if the object was deleted
+		bool getBounds(SceneObjectType type, u32 index, BVH::Primitive &prim) const;
+
+		//Copy what was appended to the gpu, growing the buffer if it doesn't fit
+		void uploadAppended(MultiBuffer &buffer, usz &capacity, const String &name, const u8 *data, usz &uploaded, usz size);
+		void uploadMeshes();
+
+		//Move the ray into the space of the mesh and find the closest triangle
+		//Brute force doesn't use the BVH of the mesh, which is only used to verify it
+		bool intersectInstance(const Ray &ray, const Instance &instance, f32 &t, bool bruteForce = false) const;
+
+		//Turn an index into the material indices back into the geometry type and local index
+		SceneObjectType fromGeometryId(u32 id, u32 &index) const;
+
+		//Build the BVH of an indexed mesh whose vertices were just appended, then store its indices
+		u32 addIndexedMesh(MeshInfo &mesh, std::span<const u32> indices);
+
 		u64 addInternal(SceneObjectType type, const void *obj, usz siz, u32 material);
+		u64 addEntry(SceneObjectType type, u32 index, u32 material);
 
-		//Ensure no gaps are between objects
-		void compact(SceneObjectType type);
+		bool addBatchInternal(
+			SceneObjectType type, const void *obj, usz siz, usz count, 
+			std::span<const u32> materials, u64 *ids
+		);
+
+		usz updateBatchInternal(SceneObjectType type, std::span<const u64> ids, const void *obj, usz siz);
+
+		//Move tail objects into holes, at most compactionBudget per call
+		void compactIncremental(SceneObjectType type);
+
+		//Delete by moving the last object of the type into the slot
+		void swapRemove(SceneObjectType type, u32 index);
+
+		//Lights are kept sorted by type, with info.lightsCount as the size of every range
+		//Every edit moves at most one light per range, rather than sorting all of them again
+
+		void moveLight(u32 from, u32 to);
+
+		//Move a light that was just appended into the range of its type
+		void insertLight(u32 index);
+
+		//Close the slot of a light by moving the last light of its range and of every range after it
+		void removeLight(u32 index, u16 type);
+
+		//Move a light whose type was changed to the range of its new type
+		void changeLightType(u32 index);
+
+		//The inspector edits objects in place; flush the ones that differ from before and re-sort edited lights
+		void applyInspection(SceneObjectType type, const u8 *before);
+
+		//Ensure geometry points to the right materials
+		void updateMaterialIndices(UpdateChunk &chunk);
+
+		//Copy the modified objects to the gpu copy
+		void updateObjects(UpdateChunk &chunk);
 
 	};
 
+	enumFlagOverloads(SceneGraph::Flags);
+
 	//Implementations
 
+	inline const SceneGraph::Entry *SceneGraph::find(u64 id) const {
+
+		u32 slot = u32(id);
+
+		if (slot >= entries.size())
+			return nullptr;
+
+		const Entry &entry = entries[slot];
+
+		if (entry.generation != u32(id >> 32) || entry.type == SceneObjectType::COUNT)
+			return nullptr;
+
+		return &entry;
+	}
+
 	template<typename T>
 	inline u64 SceneGraph::addNonGeometry(const T &object) {
 
@@ -241,28 +597,95 @@ namespace igx {
 
 		static_assert(type != SceneObjectType::COUNT, "Invalid argument passed to SceneGraph::add<T>, expecting a scene object such as Light, Triangle, Cube, etc.");
 
-		auto it = find(index);
+		const Entry *entry = find(index);
 
-		if (it == entries.end())
+		if (!entry)
 			return false;
 
-		if (it->second.type != type) {
+		if (entry->type != type) {
 			oic::System::log()->error("SceneGraph::update<T> called with incompatible types");
 			return false;
 		}
 
 		Object &obj = objects[u8(type)];
-		u8 *target = obj.cpuData.data() + it->second.index * sizeof(T);
+		u8 *target = obj.data + entry->index * sizeof(T);
 
 		if (std::memcmp(&object, target, sizeof(T)) == 0)
 			return true;
 
-		obj.markedForUpdate[it->second.index] = true;
+		//The material is shared by its contents, so it has to be found by its new contents
+
+		if constexpr (type == SceneObjectType::MATERIAL)
+			if (HasFlags(flags, Flags::DEDUPLICATE_MATERIALS))
+				forgetMaterial(index);
+
+		obj.markedForUpdate.set(entry->index);
 		std::memcpy(target, &object, sizeof(T));
 
+		if constexpr (type == SceneObjectType::MATERIAL)
+			if (HasFlags(flags, Flags::DEDUPLICATE_MATERIALS))
+				internMaterial(index);
+
+		//Lights are sorted by type, so changing it moves it to another range
+
+		if constexpr (type == SceneObjectType::LIGHT)
+			changeLightType(entry->index);
+
 		return true;
 	}
 
+	template<typename T>
+	inline std::span<const T> SceneGraph::getObjects() const {
+
+		static constexpr SceneObjectType type = SceneObjectType_t<T>;
+
+		static_assert(type != SceneObjectType::COUNT, "Invalid argument passed to SceneGraph::getObjects<T>, expecting a scene object such as Light, Triangle, Cube, etc.");
+
+		return std::span<const T>((const T*) objects[u8(type)].data, info.objectCount[u8(type)]);
+	}
+
+	template<typename T>
+	inline List<u64> SceneGraph::addBatch(std::span<const T> objects, std::span<const u32> materials) {
+
+		static constexpr SceneObjectType type = SceneObjectType_t<T>;
+
+		static_assert(type != SceneObjectType::COUNT, "Invalid argument passed to SceneGraph::addBatch<T>, expecting a scene object such as Light, Triangle, Cube, etc.");
+
+		if constexpr (SceneObjectTypeIsGeometry<T>) {
+			if (materials.size() != 1 && materials.size() != objects.size()) {
+				oic::System::log()->error("SceneGraph::addBatch<T> requires one material or a material per geometry");
+				return {};
+			}
+		}
+
+		else if (materials.size()) {
+			oic::System::log()->error("SceneGraph::addBatch<T> only accepts materials for geometry");
+			return {};
+		}
+
+		List<u64> ids(objects.size());
+
+		if (!addBatchInternal(type, objects.data(), sizeof(T), objects.size(), materials, ids.data()))
+			return {};
+
+		return ids;
+	}
+
+	template<typename T>
+	inline usz SceneGraph::updateBatch(std::span<const u64> ids, std::span<const T> objects) {
+
+		static constexpr SceneObjectType type = SceneObjectType_t<T>;
+
+		static_assert(type != SceneObjectType::COUNT, "Invalid argument passed to SceneGraph::updateBatch<T>, expecting a scene object such as Light, Triangle, Cube, etc.");
+
+		if (ids.size() != objects.size()) {
+			oic::System::log()->error("SceneGraph::updateBatch<T> requires an object per id");
+			return 0;
+		}
+
+		return updateBatchInternal(type, ids, objects.data(), sizeof(T));
+	}
+
 	template<typename T, typename T2, typename ...args>
 	inline void SceneGraph::add(const T &obj0, const T2 &obj1, const args &...arg) {
 
@@ -0,0 +1,54 @@
+#pragma once
+#include "types/scene_object_types.hpp"
+
+namespace igx {
+
+	class SceneGraph;
+	class WorkerPool;
+
+	//Import .obj (with the .mtl files it uses) and .glb files into a scene graph
+	//The file is memory mapped and parsed in parallel, then made into triangles and materials by the bulk encoders,
+	//which are added with one addBatch per type
+	//Meshes are flattened into triangles in world space; textures, uvs and primitives that aren't triangle lists are ignored
+
+	struct SceneImport {
+
+		//Seconds per stage
+		f64 parseTime{};		//File to positions, normals and materials per triangle
+		f64 convertTime{};		//To Triangle and Material
+		f64 insertTime{};		//Adding them to the scene graph
+		f64 uploadTime{};		//SceneGraph::update, which flushes them and builds the BVH; 0 if it wasn't requested
+
+		List<u64> materials, triangles;		//Ids in the scene graph
+
+		inline f64 getTime() const { return parseTime + convertTime + insertTime + uploadTime; }
+
+		inline f64 getTrianglesPerSecond() const {
+			f64 time = getTime();
+			return time > 0 ? triangles.size() / time : 0;
+		}
+	};
+
+	//Import a file by its extension (.obj or .glb), see importObj and importGlb
+	//With upload, the scene graph is updated afterwards so the upload is timed as well
+	//Returns false and logs why if the file can't be imported; nothing is added to the scene graph then
+	bool importScene(
+		SceneGraph &scene, const String &path, SceneImport &result,
+		WorkerPool *workers = nullptr, bool upload = false
+	);
+
+	//Faces are split into triangles as a fan; faces without normals use the normal of the triangle
+	//Material names that aren't in any mtllib get the default material
+	bool importObj(
+		SceneGraph &scene, const String &path, SceneImport &result,
+		WorkerPool *workers = nullptr, bool upload = false
+	);
+
+	//Binary glTF 2.0 with the buffer in the file; the meshes of the default scene are placed by their nodes
+	//Materials use the factors of the metallic roughness model, blended materials are transparent by their alpha
+	bool importGlb(
+		SceneGraph &scene, const String &path, SceneImport &result,
+		WorkerPool *workers = nullptr, bool upload = false
+	);
+
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+#include "types/types.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace igx {
+
+	//Persistent threads that split a range of jobs between them and the calling thread
+
+	class WorkerPool {
+
+		List<std::thread> workers;
+
+		std::mutex mutex, callMutex;
+		std::condition_variable wake, finished;
+
+		const std::function<void(usz)> *job{};
+		usz jobCount{}, busy{};
+		std::atomic<usz> next{};
+
+		u64 generation{};
+		bool stop{};
+
+		void work();
+		void runJobs();
+
+	public:
+
+		WorkerPool(usz threads = std::thread::hardware_concurrency());
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool(WorkerPool&&) = delete;
+		WorkerPool &operator=(const WorkerPool&) = delete;
+		WorkerPool &operator=(WorkerPool&&) = delete;
+
+		//Number of threads that run jobs, including the caller of parallelFor
+		inline usz size() const { return workers.size() + 1; }
+
+		//Calls f(i) for every i in [0, count) and returns once all of them are done
+		//Calls from inside a job run on the calling thread, so they can't deadlock
+		void parallelFor(usz count, const std::function<void(usz)> &f);
+
+	};
+
+}
\ No newline at end of file
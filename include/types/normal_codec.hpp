@@ -0,0 +1,190 @@
+#pragma once
+#include "types/vec.hpp"
+#include <cstring>
+#include <cmath>
+
+//How normals of scene primitives are stored, chosen at compile time
+//IGX_NORMAL_CODEC is used for the normals of triangles and mesh vertices, IGX_LIGHT_NORMAL_CODEC for the direction of lights
+//Shaders have to be compiled with the same defines (see res/shaders/normal_codec.glsl), CMake passes them to both
+
+#define IGX_NORMAL_SPHEREMAP 0		//f16 x, y; 4 bytes, can't store -z exactly
+#define IGX_NORMAL_OCTAHEDRAL16 1	//i8 x, y; 2 bytes
+#define IGX_NORMAL_OCTAHEDRAL32 2	//i16 x, y; 4 bytes
+#define IGX_NORMAL_FLOAT32 3		//f32 x, y, z; 12 bytes, exact
+#define IGX_NORMAL_UNORM48 4		//u16 x, y, z as two u32s; 8 bytes
+
+#ifndef IGX_NORMAL_CODEC
+	#define IGX_NORMAL_CODEC IGX_NORMAL_SPHEREMAP
+#endif
+
+#ifndef IGX_LIGHT_NORMAL_CODEC
+	#define IGX_LIGHT_NORMAL_CODEC IGX_NORMAL_UNORM48
+#endif
+
+namespace igx {
+
+	//Every operation of the encoders is written out, so the bulk encoders (see bulk_encode.hpp)
+	//can do the same ones on four normals at a time and get the same bits
+
+	static inline Vec3f32 normalizeNormal(const Vec3f32 &n) {
+		f32 len = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+		return Vec3f32(n.x / len, n.y / len, n.z / len);
+	}
+
+	static inline Vec3f32 faceNormal(const Vec3f32 &p0, const Vec3f32 &p1, const Vec3f32 &p2) {
+
+		Vec3f32 a = normalizeNormal(p1 - p0), b = normalizeNormal(p2 - p0);
+
+		return Vec3f32(
+			a.y * b.z - a.z * b.y,
+			a.z * b.x - a.x * b.z,
+			a.x * b.y - a.y * b.x
+		);
+	}
+
+	static inline void spheremapTransform(f16 &nx, f16 &ny, const Vec3f32 &n) {
+
+		//Straight up or down has no direction in xy; both end up as +z
+
+		if (n.x == 0 && n.y == 0) {
+			nx = ny = 0.f;
+			return;
+		}
+
+		f32 len = std::sqrt(n.x * n.x + n.y * n.y);
+		f32 s = std::sqrt(-n.z * 0.5f + 0.5f);
+
+		nx = n.x / len * s;
+		ny = n.y / len * s;
+	}
+
+	static inline Vec2u32 encodeNormal(const Vec3f32 &n) {
+
+		Vec3f32 nn = normalizeNormal(n);
+
+		f32 x = (nn.x * 0.5f + 0.5f) * u16_MAX;
+		f32 y = (nn.y * 0.5f + 0.5f) * u16_MAX;
+		f32 z = (nn.z * 0.5f + 0.5f) * u16_MAX;
+
+		return Vec2u32(u32(x) << 16 | u32(y), u32(z));
+	}
+
+	static constexpr inline Vec3f32 decodeNormal(const Vec2u32 &e) {
+		Vec3f32 nn = Vec3f32(f32(e.x >> 16), u16(e.x), e.y) / u16_MAX;
+		return nn * 2 - 1;
+	}
+
+	//Codecs are plain data with encode(normal) and decode()
+	//They only hold integers or floats, so they can be in a union and are copied as their bytes
+
+	struct SpheremapNormal {
+
+		u16 x, y;		//Bits of f16
+
+		static inline SpheremapNormal encode(const Vec3f32 &n) {
+
+			f16 hx, hy;
+			spheremapTransform(hx, hy, n);
+
+			SpheremapNormal e;
+			std::memcpy(&e.x, &hx, sizeof(u16));
+			std::memcpy(&e.y, &hy, sizeof(u16));
+			return e;
+		}
+
+		inline Vec3f32 decode() const {
+
+			f16 hx, hy;
+			std::memcpy(&hx, &x, sizeof(u16));
+			std::memcpy(&hy, &y, sizeof(u16));
+
+			f32 ex = hx, ey = hy, f = ex * ex + ey * ey;
+
+			if (f <= 0)
+				return Vec3f32(0, 0, 1);
+
+			f32 s = std::sqrt(std::max(0.f, 1 - (1 - 2 * f) * (1 - 2 * f))) / std::sqrt(f);
+			return Vec3f32(ex * s, ey * s, 1 - 2 * f);
+		}
+	};
+
+	//Folds the octahedron onto the square [-1, 1]^2
+
+	static inline f32 signNotZero(f32 v) { return v < 0 ? -1.f : 1.f; }
+
+	static inline void octahedralFold(f32 &x, f32 &y) {
+		f32 ox = x;
+		x = (1 - std::abs(y)) * signNotZero(ox);
+		y = (1 - std::abs(ox)) * signNotZero(y);
+	}
+
+	template<typename T>
+	struct OctahedralNormal {
+
+		static constexpr f32 maxValue = f32((1 << (sizeof(T) * 8 - 1)) - 1);
+
+		T x, y;			//Snorm
+
+		static inline OctahedralNormal encode(const Vec3f32 &n) {
+
+			f32 l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+			f32 ox = l1 > 0 ? n.x / l1 : 0, oy = l1 > 0 ? n.y / l1 : 0;
+
+			if (n.z < 0)
+				octahedralFold(ox, oy);
+
+			return {
+				T(std::round(std::clamp(ox, -1.f, 1.f) * maxValue)),
+				T(std::round(std::clamp(oy, -1.f, 1.f) * maxValue))
+			};
+		}
+
+		inline Vec3f32 decode() const {
+
+			f32 ox = std::max(x / maxValue, -1.f), oy = std::max(y / maxValue, -1.f);
+			f32 oz = 1 - std::abs(ox) - std::abs(oy);
+
+			if (oz < 0)
+				octahedralFold(ox, oy);
+
+			f32 len = std::sqrt(ox * ox + oy * oy + oz * oz);
+			return Vec3f32(ox / len, oy / len, oz / len);
+		}
+	};
+
+	using Octahedral16Normal = OctahedralNormal<i8>;
+	using Octahedral32Normal = OctahedralNormal<i16>;
+
+	struct Float32Normal {
+
+		f32 x, y, z;
+
+		static inline Float32Normal encode(const Vec3f32 &n) { return { n.x, n.y, n.z }; }
+		inline Vec3f32 decode() const { return Vec3f32(x, y, z); }
+	};
+
+	struct Unorm48Normal {
+
+		u32 x, y;		//encodeNormal
+
+		static inline Unorm48Normal encode(const Vec3f32 &n) {
+			Vec2u32 e = encodeNormal(n);
+			return { e.x, e.y };
+		}
+
+		inline Vec3f32 decode() const { return decodeNormal(Vec2u32(x, y)); }
+	};
+
+	template<int codec>
+	struct NormalCodecOf;
+
+	template<> struct NormalCodecOf<IGX_NORMAL_SPHEREMAP> { using Type = SpheremapNormal; };
+	template<> struct NormalCodecOf<IGX_NORMAL_OCTAHEDRAL16> { using Type = Octahedral16Normal; };
+	template<> struct NormalCodecOf<IGX_NORMAL_OCTAHEDRAL32> { using Type = Octahedral32Normal; };
+	template<> struct NormalCodecOf<IGX_NORMAL_FLOAT32> { using Type = Float32Normal; };
+	template<> struct NormalCodecOf<IGX_NORMAL_UNORM48> { using Type = Unorm48Normal; };
+
+	using TriangleNormal = typename NormalCodecOf<IGX_NORMAL_CODEC>::Type;
+	using LightNormal = typename NormalCodecOf<IGX_LIGHT_NORMAL_CODEC>::Type;
+
+}
\ No newline at end of file
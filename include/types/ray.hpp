@@ -0,0 +1,139 @@
+#pragma once
+#include "types/scene_object_types.hpp"
+#include <limits>
+
+namespace igx {
+
+	//Cpu ray queries against scene objects
+	//A hit only counts if it's closer than the current t, which is shortened if it is
+
+	static constexpr f32 rayEpsilon = 1e-5f;
+	static constexpr f32 rayMiss = std::numeric_limits<f32>::infinity();
+
+	struct Ray {
+		Vec3f32 origin, dir;
+	};
+
+	static inline f32 dot3(const Vec3f32 &a, const Vec3f32 &b) {
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	static inline Vec3f32 cross3(const Vec3f32 &a, const Vec3f32 &b) {
+		return Vec3f32(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	//Möller-Trumbore
+
+	static inline bool intersect(const Ray &ray, const Triangle &tri, f32 &t) {
+
+		Vec3f32 e0 = tri.edge0(), e1 = tri.edge1();
+		Vec3f32 p = cross3(ray.dir, e1);
+
+		f32 det = dot3(e0, p);
+
+		if (std::abs(det) < 1e-12f)
+			return false;
+
+		f32 invDet = 1 / det;
+		Vec3f32 s = ray.origin - tri.p0;
+
+		f32 u = dot3(s, p) * invDet;
+
+		if (u < 0 || u > 1)
+			return false;
+
+		Vec3f32 q = cross3(s, e0);
+		f32 v = dot3(ray.dir, q) * invDet;
+
+		if (v < 0 || u + v > 1)
+			return false;
+
+		f32 d = dot3(e1, q) * invDet;
+
+		if (d <= rayEpsilon || d >= t)
+			return false;
+
+		t = d;
+		return true;
+	}
+
+	static inline bool intersect(const Ray &ray, const Sphere &sphere, f32 &t) {
+
+		f32 r = sphere.Radius;
+		Vec3f32 dif = ray.origin - sphere.Position;
+
+		f32 a = dot3(ray.dir, ray.dir);
+		f32 b = dot3(dif, ray.dir);
+		f32 c = dot3(dif, dif) - r * r;
+		f32 disc = b * b - a * c;
+
+		if (disc < 0 || a == 0)
+			return false;
+
+		f32 sq = std::sqrt(disc);
+		f32 d = (-b - sq) / a;
+
+		//Inside of the sphere
+
+		if (d <= rayEpsilon)
+			d = (-b + sq) / a;
+
+		if (d <= rayEpsilon || d >= t)
+			return false;
+
+		t = d;
+		return true;
+	}
+
+	//Points on the plane satisfy dot(dir, p) == dist
+
+	static inline bool intersect(const Ray &ray, const Plane &plane, f32 &t) {
+
+		f32 denom = dot3(plane.dir, ray.dir);
+
+		if (denom == 0)
+			return false;
+
+		f32 d = (plane.dist - dot3(plane.dir, ray.origin)) / denom;
+
+		if (d <= rayEpsilon || d >= t)
+			return false;
+
+		t = d;
+		return true;
+	}
+
+	static inline bool intersect(const Ray &ray, const Cube &cube, f32 &t) {
+
+		const f32 o[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+		const f32 d[3] = { ray.dir.x, ray.dir.y, ray.dir.z };
+		const f32 mi[3] = { cube.min.x, cube.min.y, cube.min.z };
+		const f32 ma[3] = { cube.max.x, cube.max.y, cube.max.z };
+
+		f32 tnear = -rayMiss, tfar = rayMiss;
+
+		for (usz i = 0; i < 3; ++i) {
+
+			f32 inv = 1 / d[i];
+			f32 t0 = (mi[i] - o[i]) * inv, t1 = (ma[i] - o[i]) * inv;
+
+			if (t0 > t1)
+				std::swap(t0, t1);
+
+			tnear = std::max(tnear, t0);
+			tfar = std::min(tfar, t1);
+		}
+
+		if (tnear > tfar)
+			return false;
+
+		f32 dist = tnear > rayEpsilon ? tnear : tfar;
+
+		if (dist <= rayEpsilon || dist >= t)
+			return false;
+
+		t = dist;
+		return true;
+	}
+
+}
\ No newline at end of file
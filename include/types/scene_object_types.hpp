@@ -1,5 +1,6 @@
 #pragma once
 #include "types/vec.hpp"
+#include "types/normal_codec.hpp"
 #include "types/enum.hpp"
 #include "utils/inflect.hpp"
 #include "gui/ui_value.hpp"
@@ -65,44 +66,36 @@ namespace igx {
 
 	};
 
-	static inline void spheremapTransform(f16 &nx, f16 &ny, const Vec3f32 &n) {
-		Vec2f32 enc = n.xy().normalize() * std::sqrt(-n.z * 0.5f + 0.5f);
-		nx = enc.x;
-		ny = enc.y;
-	}
+	//Normals are stored with NormalCodec (see normal_codec.hpp), every normal right after its position
+	//Vertices stay 4 byte aligned, so a 2 byte codec is padded to 4
 
-	struct Triangle {
+	template<typename NormalCodec>
+	struct TTriangle {
 
 		Vec3f32 p0;
-		f16 n0x, n0y;
+		NormalCodec n0;
 
 		Vec3f32 p1;
-		f16 n1x, n1y;
+		NormalCodec n1;
 
 		Vec3f32 p2;
-		f16 n2x, n2y;
+		NormalCodec n2;
 
-		Triangle() {}
+		TTriangle() {}
 
-		Triangle(
+		TTriangle(
 			const Vec3f32 &p0, const Vec3f32 &p1, const Vec3f32 &p2,
 			const Vec3f32 &n0, const Vec3f32 &n1, const Vec3f32 &n2
 		) :
-			p0(p0), p1(p1), p2(p2)
-		{
-			spheremapTransform(n0x, n0y, n0);
-			spheremapTransform(n1x, n1y, n1);
-			spheremapTransform(n2x, n2y, n2);
-		}
+			p0(p0), n0(NormalCodec::encode(n0)),
+			p1(p1), n1(NormalCodec::encode(n1)),
+			p2(p2), n2(NormalCodec::encode(n2))
+		{}
 
-		Triangle(const Vec3f32 &p0, const Vec3f32 &p1, const Vec3f32 &p2):
+		TTriangle(const Vec3f32 &p0, const Vec3f32 &p1, const Vec3f32 &p2):
 			p0(p0), p1(p1), p2(p2)
 		{
-			Vec3f32 n = Vec3f32((p1 - p0).normalize()).cross((p2 - p0).normalize());
-
-			spheremapTransform(n0x, n0y, n);
-			spheremapTransform(n1x, n1y, n);
-			spheremapTransform(n2x, n2y, n);
+			n0 = n1 = n2 = NormalCodec::encode(faceNormal(p0, p1, p2));
 		}
 
 		inline Vec3f32 edge0() const { return p1 - p0; }
@@ -111,6 +104,8 @@ namespace igx {
 
 	};
 
+	using Triangle = TTriangle<TriangleNormal>;
+
 	struct Cube {
 		Vec3f32 min, max;
 	};
@@ -128,20 +123,156 @@ namespace igx {
 		f32 dist;
 	};
 
-	static constexpr inline Vec2u32 encodeNormal(const Vec3f32 &n) {
+	//How the triangles of a mesh are stored; NONE means as Triangle, otherwise as indices into quantized vertices
+	//u16 indices are used if the mesh has at most 65536 vertices, they're packed two per u32
 
-		Vec3f32 nn = (n.normalize() * 0.5 + 0.5) * u16_MAX;
+	enum class MeshIndexFormat : u32 {
+		NONE,
+		U16,
+		U32
+	};
 
-		return Vec2u32(
-			u32(nn.x) << 16 | u32(nn.y),
-			nn.z
-		);
-	}
+	//Vertex of an indexed mesh; 8 bytes with octahedral16 normals, 12 with spheremap or octahedral32
+	//The position is quantized to 16 bits per axis within the bounds of its mesh, see MeshInfo
 
-	static constexpr inline Vec3f32 decodeNormal(const Vec2u32 &e) {
-		Vec3f32 nn = Vec3f32(f32(e.x >> 16), u16(e.x), e.y) / u16_MAX;
-		return nn * 2 - 1;
-	}
+	struct alignas(4) QuantizedVertex {
+		u16 x, y, z;
+		TriangleNormal n;
+	};
+
+	//Triangles of a mesh and its BVH, which are stored once and shared by every instance
+	//Node offsets are relative to firstNode and leaves point to triangles relative to firstTriangle
+	//Indexed meshes store triangle i as indices 3i, 3i + 1 and 3i + 2, relative to firstIndex,
+	//which point to vertices relative to firstVertex
+
+	struct MeshInfo {
+
+		u32 firstTriangle, triangleCount;
+		u32 firstNode, nodeCount;
+
+		u32 firstVertex, vertexCount;
+		u32 firstIndex;		//In u32s
+		MeshIndexFormat indexFormat;
+
+		f32 origin[3];		//Minimum of the bounds
+		u32 pad0;
+
+		f32 scale[3];		//Extent of the bounds / 65535
+		u32 pad1;
+
+		inline QuantizedVertex quantize(const Vec3f32 &p, const Vec3f32 &n) const {
+
+			const f32 c[3] = { p.x, p.y, p.z };
+			u16 q[3];
+
+			for (usz i = 0; i < 3; ++i)
+				q[i] = scale[i] > 0 ? u16(std::clamp(std::round((c[i] - origin[i]) / scale[i]), 0.f, 65535.f)) : 0;
+
+			return { q[0], q[1], q[2], TriangleNormal::encode(n) };
+		}
+
+		inline Vec3f32 dequantize(const QuantizedVertex &v) const {
+			return Vec3f32(
+				origin[0] + v.x * scale[0],
+				origin[1] + v.y * scale[1],
+				origin[2] + v.z * scale[2]
+			);
+		}
+
+		//Index k of the mesh, where indices are all indices of the scene
+		inline u32 getIndex(const u32 *indices, u32 k) const {
+
+			if (indexFormat == MeshIndexFormat::U16)
+				return indices[firstIndex + k / 2] >> (k & 1) * 16 & u16_MAX;
+
+			return indices[firstIndex + k];
+		}
+
+		//Decode triangle i of an indexed mesh, where vertices and indices are those of the scene
+		inline Triangle getTriangle(const QuantizedVertex *vertices, const u32 *indices, u32 i) const {
+
+			const QuantizedVertex &v0 = vertices[firstVertex + getIndex(indices, i * 3)];
+			const QuantizedVertex &v1 = vertices[firstVertex + getIndex(indices, i * 3 + 1)];
+			const QuantizedVertex &v2 = vertices[firstVertex + getIndex(indices, i * 3 + 2)];
+
+			Triangle tri;
+
+			tri.p0 = dequantize(v0);
+			tri.n0 = v0.n;
+
+			tri.p1 = dequantize(v1);
+			tri.n1 = v1.n;
+
+			tri.p2 = dequantize(v2);
+			tri.n2 = v2.n;
+
+			return tri;
+		}
+	};
+
+	//A mesh placed in the scene with an affine transform (3x4, row major)
+	//The inverse is stored as well, so rays can be moved into the space of the mesh without inverting per ray
+
+	struct Instance {
+
+		f32 objectToWorld[3][4];
+		f32 worldToObject[3][4];
+
+		u32 mesh;
+		u32 pad[3]{};
+
+		Instance() {}
+
+		Instance(u32 mesh, const f32 (&transform)[3][4]): mesh(mesh) {
+
+			std::memcpy(objectToWorld, transform, sizeof(objectToWorld));
+
+			//Inverse of the 3x3 through the adjugate, then move the translation back
+
+			const f32 (&m)[3][4] = transform;
+			f32 (&inv)[3][4] = worldToObject;
+
+			inv[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+			inv[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+			inv[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+			inv[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+			inv[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+			inv[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+			inv[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+			inv[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+			inv[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+			f32 det = m[0][0] * inv[0][0] + m[0][1] * inv[1][0] + m[0][2] * inv[2][0];
+			f32 invDet = det != 0 ? 1 / det : 0;
+
+			for (usz i = 0; i < 3; ++i)
+				for (usz j = 0; j < 3; ++j)
+					inv[i][j] *= invDet;
+
+			for (usz i = 0; i < 3; ++i)
+				inv[i][3] = -(inv[i][0] * m[0][3] + inv[i][1] * m[1][3] + inv[i][2] * m[2][3]);
+		}
+
+		Instance(u32 mesh, const Vec3f32 &position, const Vec3f32 &scale = Vec3f32(1, 1, 1)):
+			Instance(mesh, {
+				{ scale.x, 0, 0, position.x },
+				{ 0, scale.y, 0, position.y },
+				{ 0, 0, scale.z, position.z }
+			}) {}
+
+		static inline Vec3f32 transform(const f32 (&m)[3][4], const Vec3f32 &v, f32 w) {
+			return Vec3f32(
+				m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3] * w,
+				m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3] * w,
+				m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3] * w
+			);
+		}
+
+		inline Vec3f32 toWorld(const Vec3f32 &p) const { return transform(objectToWorld, p, 1); }
+		inline Vec3f32 toObject(const Vec3f32 &p) const { return transform(worldToObject, p, 1); }
+		inline Vec3f32 toObjectDir(const Vec3f32 &d) const { return transform(worldToObject, d, 0); }
+
+	};
 
 	static constexpr inline Vec3f32 fromPolar(const Vec2f32 &polar) {
 		auto cosPolar = polar.cos(), sinPolar = polar.sin();
@@ -160,22 +291,33 @@ namespace igx {
 		Vec3f32 pos;
 		f16 rad, origin;
 
-		Vec2u32 dir;
+		union {
+			LightNormal dir;		//Directional and spot lights
+			f32 specularity;		//Point lights
+		};
+
 		f16 r, g, b;
 		LightType type;
 
+		//The union is cleared first, so bytes the codec or specularity don't use are always zero
+
 		Light(Vec3f32 dir, Vec3f32 color, f32 angularExtent = 0.533_deg) :
 			type(LightType::Directional),
 			r(color.x), g(color.y), b(color.z),
-			dir(encodeNormal(dir)), rad(angularExtent)
-		{}
+			rad(angularExtent), origin(0.f)
+		{
+			specularity = 0;
+			this->dir = LightNormal::encode(dir);
+		}
 
 		Light(Vec3f32 pos, Vec3f32 color, f32 rad, f32 origin, f32 specularity = 1) :
 			type(LightType::Point),
 			r(color.x), g(color.y), b(color.z),
-			pos(pos), rad(rad), origin(origin),
-			dir(*(u32*) &specularity, 0)
-		{}
+			pos(pos), rad(rad), origin(origin)
+		{
+			this->dir = LightNormal{};
+			this->specularity = specularity;
+		}
 
 		InflectBody(
 
@@ -191,7 +333,7 @@ namespace igx {
 					using AngularSlider = ui::Slider<f32, 0.1_deg, 2_deg>;
 					using DirSlider = ui::Slider<f32, 0, 360>;
 
-					Vec3f32 d = decodeNormal(dir);
+					Vec3f32 d = dir.decode();
 					Vec2f32 thetaPhi = toPolar(d).radToDeg();
 					AngularSlider ae = f32(rad);
 
@@ -219,7 +361,7 @@ namespace igx {
 
 						r = _r.value; g = _g.value; b = _b.value;
 						rad = ae.value;
-						dir = encodeNormal(fromPolar(thetaPhi.degToRad()));
+						dir = LightNormal::encode(fromPolar(thetaPhi.degToRad()));
 					}
 
 					return;
@@ -244,7 +386,7 @@ namespace igx {
 					this, recursion, namesOfArgs, type, pos, 
 					(const RadSlider&) _rad, (const RadSlider&) _origin, 
 					(const ColorSlider&) _r, (const ColorSlider&) _g, (const ColorSlider&) _b,
-					(const LightSpecular&) dir.x
+					(const LightSpecular&) specularity
 				);	
 
 			//Non const
@@ -253,7 +395,7 @@ namespace igx {
 
 				inflector.inflect(
 					this, recursion, namesOfArgs, type, pos, _rad, _origin, _r, _g, _b,
-					(LightSpecular&) dir.x
+					(LightSpecular&) specularity
 				);
 
 				r = _r.value; g = _g.value; b = _b.value;
@@ -282,7 +424,7 @@ namespace igx {
 		):
 			albedoR(albedo.x), albedoG(albedo.y), albedoB(albedo.z),
 			ambientR(ambient.x), ambientG(ambient.y), ambientB(ambient.z),
-			emissionR(emission.x), emissionG(emission.y), emissionB(emission.z),
+			emissionR(emission.x), emissionG(emission.y), emissionB(emission.z), pad2(0.f),
 			metallic(u16(metallic * u16_MAX)), roughness(u16(roughness * u16_MAX)), 
 			transparency(transparency)
 		{}
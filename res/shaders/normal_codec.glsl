@@ -0,0 +1,96 @@
+//Decoding normals of scene primitives, the same as include/types/normal_codec.hpp
+//Has to be compiled with the same IGX_NORMAL_CODEC and IGX_LIGHT_NORMAL_CODEC as the C++ side; CMake passes both to the compile scripts, which forward every -D to glslangValidator
+//Triangles store p0, n0, p1, n1, p2, n2; every vertex is 3 floats followed by a normal of IGX_TRIANGLE_NORMAL_BYTES
+//Vertices are 4 byte aligned, so a normal of 2 bytes is in the low 16 bits of its uint
+
+#define IGX_NORMAL_SPHEREMAP 0
+#define IGX_NORMAL_OCTAHEDRAL16 1
+#define IGX_NORMAL_OCTAHEDRAL32 2
+#define IGX_NORMAL_FLOAT32 3
+#define IGX_NORMAL_UNORM48 4
+
+#ifndef IGX_NORMAL_CODEC
+	#define IGX_NORMAL_CODEC IGX_NORMAL_SPHEREMAP
+#endif
+
+#ifndef IGX_LIGHT_NORMAL_CODEC
+	#define IGX_LIGHT_NORMAL_CODEC IGX_NORMAL_UNORM48
+#endif
+
+//f16 x, y
+
+vec3 decodeSpheremap(uint e) {
+
+	vec2 enc = unpackHalf2x16(e);
+	float f = dot(enc, enc);
+
+	if (f <= 0.0)
+		return vec3(0, 0, 1);
+
+	float z = 1 - 2 * f;
+	return vec3(enc * (sqrt(max(0.0, 1 - z * z)) / sqrt(f)), z);
+}
+
+//Snorm x, y of the folded octahedron
+
+vec3 decodeOctahedral(vec2 o) {
+
+	vec3 n = vec3(o, 1 - abs(o.x) - abs(o.y));
+
+	if (n.z < 0)
+		n.xy = (1 - abs(n.yx)) * mix(vec2(-1), vec2(1), greaterThanEqual(n.xy, vec2(0)));
+
+	return normalize(n);
+}
+
+vec3 decodeOctahedral16(uint e) { return decodeOctahedral(unpackSnorm4x8(e).xy); }
+vec3 decodeOctahedral32(uint e) { return decodeOctahedral(unpackSnorm2x16(e)); }
+
+vec3 decodeFloat32(vec3 e) { return e; }
+
+//u16 x, y, z of n * 0.5 + 0.5; x is in the high bits
+
+vec3 decodeUnorm48(uvec2 e) {
+	return vec3(e.x >> 16u, e.x & 0xFFFFu, e.y) / 65535.0 * 2 - 1;
+}
+
+//Codecs of triangles (and mesh vertices) and lights
+
+#if IGX_NORMAL_CODEC == IGX_NORMAL_SPHEREMAP
+	#define IGX_TRIANGLE_NORMAL_TYPE uint
+	#define IGX_TRIANGLE_NORMAL_BYTES 4
+	#define decodeTriangleNormal decodeSpheremap
+#elif IGX_NORMAL_CODEC == IGX_NORMAL_OCTAHEDRAL16
+	#define IGX_TRIANGLE_NORMAL_TYPE uint
+	#define IGX_TRIANGLE_NORMAL_BYTES 2
+	#define decodeTriangleNormal decodeOctahedral16
+#elif IGX_NORMAL_CODEC == IGX_NORMAL_OCTAHEDRAL32
+	#define IGX_TRIANGLE_NORMAL_TYPE uint
+	#define IGX_TRIANGLE_NORMAL_BYTES 4
+	#define decodeTriangleNormal decodeOctahedral32
+#elif IGX_NORMAL_CODEC == IGX_NORMAL_FLOAT32
+	#define IGX_TRIANGLE_NORMAL_TYPE vec3
+	#define IGX_TRIANGLE_NORMAL_BYTES 12
+	#define decodeTriangleNormal decodeFloat32
+#else
+	#define IGX_TRIANGLE_NORMAL_TYPE uvec2
+	#define IGX_TRIANGLE_NORMAL_BYTES 8
+	#define decodeTriangleNormal decodeUnorm48
+#endif
+
+#if IGX_LIGHT_NORMAL_CODEC == IGX_NORMAL_SPHEREMAP
+	#define IGX_LIGHT_NORMAL_TYPE uint
+	#define decodeLightNormal decodeSpheremap
+#elif IGX_LIGHT_NORMAL_CODEC == IGX_NORMAL_OCTAHEDRAL16
+	#define IGX_LIGHT_NORMAL_TYPE uint
+	#define decodeLightNormal decodeOctahedral16
+#elif IGX_LIGHT_NORMAL_CODEC == IGX_NORMAL_OCTAHEDRAL32
+	#define IGX_LIGHT_NORMAL_TYPE uint
+	#define decodeLightNormal decodeOctahedral32
+#elif IGX_LIGHT_NORMAL_CODEC == IGX_NORMAL_FLOAT32
+	#define IGX_LIGHT_NORMAL_TYPE vec3
+	#define decodeLightNormal decodeFloat32
+#else
+	#define IGX_LIGHT_NORMAL_TYPE uvec2
+	#define decodeLightNormal decodeUnorm48
+#endif
\ No newline at end of file
@@ -7,6 +7,20 @@ if "%~1"=="-d" (
 	shift
 )
 
+rem Defines for the shaders, such as the normal codecs
+
+set defines=
+
+:defines
+
+set arg=%~1
+
+if "%arg:~0,2%"=="-D" (
+	set defines=%defines% "%arg%"
+	shift
+	goto defines
+)
+
 :loop
 
 rem Go to folder
@@ -20,7 +34,7 @@ echo -- Compiling file "%str%" in dir "%dir%"
 
 rem do compile
 
-glslangValidator -G1.0 --target-env spirv1.0 -e main -o "%str%.spv" "%str%"
+glslangValidator -G1.0 --target-env spirv1.0 %defines% -e main -o "%str%.spv" "%str%"
 if %errorlevel% neq 0 exit /b %errorlevel%
 echo -- Success compiling
 
@@ -8,12 +8,22 @@ then
 	shift 1
 fi
 
+# Defines for the shaders, such as the normal codecs
+
+defines=
+
+while [ $# -gt 0 ] && [ "${1#-D}" != "$1" ]
+do
+	defines="$defines $1"
+	shift 1
+done
+
 for i in "$@" 
 do
 
 	echo -- Compiling file "$i"
 
-	glslangValidator -G1.0 --target-env spirv1.0 -e main -o "$i.spv" "$i"
+	glslangValidator -G1.0 --target-env spirv1.0 $defines -e main -o "$i.spv" "$i"
 
 	if [ $? -ne 0 ]; 
 	then 
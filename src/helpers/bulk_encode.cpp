@@ -0,0 +1,517 @@
+#include "helpers/bulk_encode.hpp"
+#include "helpers/worker_pool.hpp"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define IGX_ENCODE_SSE
+	#include <immintrin.h>
+#endif
+
+//Only the default codecs are vectorized; others always use the constructors
+
+#if defined(IGX_ENCODE_SSE) && IGX_NORMAL_CODEC == IGX_NORMAL_SPHEREMAP
+	#define IGX_ENCODE_TRIANGLES
+#endif
+
+#if defined(IGX_ENCODE_SSE) && IGX_LIGHT_NORMAL_CODEC == IGX_NORMAL_UNORM48
+	#define IGX_ENCODE_DIRECTIONAL_LIGHTS
+#endif
+
+//F16C isn't part of the baseline instruction set, so it's only used if the cpu has it
+
+#if defined(IGX_ENCODE_SSE) && (defined(_MSC_VER) || defined(__GNUC__))
+
+	#define IGX_ENCODE_HALVES
+
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define IGX_TARGET_F16C
+	#else
+		#define IGX_TARGET_F16C __attribute__((target("f16c")))
+	#endif
+
+#endif
+
+namespace igx {
+
+	static_assert(sizeof(f16) == sizeof(u16), "Bulk encoding writes f16 as its bits");
+
+	//Objects per job, so a job is big enough to be worth it
+	static constexpr usz encodeBlock = 16384;
+
+	static inline void forBlocks(usz count, WorkerPool *workers, const std::function<void(usz, usz)> &f) {
+
+		usz blocks = (count + encodeBlock - 1) / encodeBlock;
+
+		auto job = [&](usz i) {
+			f(i * encodeBlock, std::min(count, (i + 1) * encodeBlock));
+		};
+
+		if (workers && blocks > 1)
+			workers->parallelFor(blocks, job);
+
+		else for (usz i = 0; i < blocks; ++i)
+			job(i);
+	}
+
+	//Scalar path; the constructors themselves
+
+	static inline void scalarTriangles(const Vec3Arrays &p, const Vec3Arrays &n, Triangle *out, usz begin, usz end) {
+
+		for (usz i = begin; i < end; ++i)
+			out[i] = n.empty() ?
+				Triangle(p[i * 3], p[i * 3 + 1], p[i * 3 + 2]) :
+				Triangle(p[i * 3], p[i * 3 + 1], p[i * 3 + 2], n[i * 3], n[i * 3 + 1], n[i * 3 + 2]);
+	}
+
+	static inline void scalarDirectionalLights(
+		const Vec3Arrays &dirs, const Vec3Arrays &colors, f32 angularExtent, Light *out, usz begin, usz end
+	) {
+		for (usz i = begin; i < end; ++i)
+			out[i] = Light(dirs[i], colors[i], angularExtent);
+	}
+
+	static inline void scalarPointLights(
+		const Vec3Arrays &positions, const Vec3Arrays &colors, const f32 *rad, const f32 *origin, f32 specularity,
+		Light *out, usz begin, usz end
+	) {
+		for (usz i = begin; i < end; ++i)
+			out[i] = Light(positions[i], colors[i], rad[i], origin[i], specularity);
+	}
+
+	static inline void scalarMaterials(
+		const Vec3Arrays &albedo, const Vec3Arrays &ambient, const Vec3Arrays &emission,
+		const f32 *metallic, const f32 *roughness, const f32 *transparency,
+		Material *out, usz begin, usz end
+	) {
+		for (usz i = begin; i < end; ++i)
+			out[i] = Material(albedo[i], ambient[i], emission[i], metallic[i], roughness[i], transparency[i]);
+	}
+
+	#ifdef IGX_ENCODE_SSE
+
+		//Vector path, which does the same f32 operations in the same order as the constructors (see normal_codec.hpp)
+		//Every operation is rounded the same way in a lane as it is in scalar code, so only NaN can differ (in its bits)
+		//Lanes that end up as NaN are encoded by the constructors instead; that's the only input they handle
+
+		struct V3 {
+			__m128 x, y, z;
+		};
+
+		static inline __m128 gather(const f32 *a, usz i, usz stride) {
+			return _mm_setr_ps(a[i], a[i + stride], a[i + stride * 2], a[i + stride * 3]);
+		}
+
+		static inline V3 gather(const Vec3Arrays &a, usz i, usz stride) {
+			return { gather(a.x, i, stride), gather(a.y, i, stride), gather(a.z, i, stride) };
+		}
+
+		static inline V3 sub(const V3 &a, const V3 &b) {
+			return { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+		}
+
+		//normalizeNormal
+
+		static inline V3 normalize(const V3 &a) {
+
+			__m128 len = _mm_sqrt_ps(_mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(a.x, a.x), _mm_mul_ps(a.y, a.y)), _mm_mul_ps(a.z, a.z)
+			));
+
+			return { _mm_div_ps(a.x, len), _mm_div_ps(a.y, len), _mm_div_ps(a.z, len) };
+		}
+
+		static inline V3 cross(const V3 &a, const V3 &b) {
+			return {
+				_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+				_mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+				_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x))
+			};
+		}
+
+		//Lanes that aren't NaN
+		static inline int ordered(__m128 v) {
+			return _mm_movemask_ps(_mm_cmpord_ps(v, v));
+		}
+
+		//Halves are converted by f16 itself, since that's the rounding the constructors use
+		static inline void setHalf(u16 &target, f32 v) {
+			f16 h = v;
+			std::memcpy(&target, &h, sizeof(u16));
+		}
+
+		#ifdef IGX_ENCODE_TRIANGLES
+
+		//spheremapTransform for 4 normals; returns the lanes that aren't NaN
+
+		static inline int spheremap(const V3 &n, __m128 &ex, __m128 &ey) {
+
+			__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(n.x, n.x), _mm_mul_ps(n.y, n.y)));
+
+			__m128 negZ = _mm_xor_ps(n.z, _mm_set1_ps(-0.f));
+			__m128 s = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(negZ, _mm_set1_ps(0.5f)), _mm_set1_ps(0.5f)));
+
+			ex = _mm_mul_ps(_mm_div_ps(n.x, len), s);
+			ey = _mm_mul_ps(_mm_div_ps(n.y, len), s);
+
+			//Straight up or down is +z (0, 0)
+
+			__m128 zero = _mm_setzero_ps();
+			__m128 up = _mm_and_ps(_mm_cmpeq_ps(n.x, zero), _mm_cmpeq_ps(n.y, zero));
+
+			ex = _mm_andnot_ps(up, ex);
+			ey = _mm_andnot_ps(up, ey);
+
+			return ordered(ex) & ordered(ey);
+		}
+
+		static void vectorTriangles(const Vec3Arrays &p, const Vec3Arrays &n, Triangle *out, usz begin, usz end) {
+
+			usz i = begin;
+
+			for (; i + 4 <= end; i += 4) {
+
+				V3 normals[3];
+
+				//faceNormal
+
+				if (n.empty()) {
+
+					V3 p0 = gather(p, i * 3, 3), p1 = gather(p, i * 3 + 1, 3), p2 = gather(p, i * 3 + 2, 3);
+					normals[0] = normals[1] = normals[2] = cross(normalize(sub(p1, p0)), normalize(sub(p2, p0)));
+				}
+
+				else for (usz k = 0; k < 3; ++k)
+					normals[k] = gather(n, i * 3 + k, 3);
+
+				alignas(16) f32 ex[3][4], ey[3][4];
+				int exact = 0xF;
+
+				for (usz k = 0; k < 3; ++k) {
+
+					__m128 x, y;
+					exact &= spheremap(normals[k], x, y);
+
+					_mm_store_ps(ex[k], x);
+					_mm_store_ps(ey[k], y);
+				}
+
+				for (usz j = 0; j < 4; ++j) {
+
+					if (!(exact >> j & 1)) {
+						scalarTriangles(p, n, out, i + j, i + j + 1);
+						continue;
+					}
+
+					Triangle &tri = out[i + j];
+					usz v = (i + j) * 3;
+
+					tri.p0 = p[v];
+					tri.p1 = p[v + 1];
+					tri.p2 = p[v + 2];
+
+					setHalf(tri.n0.x, ex[0][j]);
+					setHalf(tri.n0.y, ey[0][j]);
+					setHalf(tri.n1.x, ex[1][j]);
+					setHalf(tri.n1.y, ey[1][j]);
+					setHalf(tri.n2.x, ex[2][j]);
+					setHalf(tri.n2.y, ey[2][j]);
+				}
+			}
+
+			scalarTriangles(p, n, out, i, end);
+		}
+
+		#endif
+
+		#ifdef IGX_ENCODE_DIRECTIONAL_LIGHTS
+
+		static void vectorDirectionalLights(
+			const Vec3Arrays &dirs, const Vec3Arrays &colors, f32 angularExtent, Light *out, usz begin, usz end
+		) {
+
+			usz i = begin;
+
+			f16 rad = angularExtent;
+
+			for (; i + 4 <= end; i += 4) {
+
+				//encodeNormal; (n * 0.5 + 0.5) * u16_MAX, truncated
+
+				V3 d = normalize(gather(dirs, i, 1));
+
+				__m128 half = _mm_set1_ps(0.5f), scale = _mm_set1_ps(f32(u16_MAX));
+
+				__m128 ex = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(d.x, half), half), scale);
+				__m128 ey = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(d.y, half), half), scale);
+				__m128 ez = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(d.z, half), half), scale);
+
+				//Only lanes in [0, u16_MAX] are truncated here, which excludes NaN (zero or infinite directions)
+				//Within that range, truncating to u32 is the same as the constructor's conversion
+
+				__m128 lo = _mm_setzero_ps();
+
+				int exact = _mm_movemask_ps(_mm_and_ps(
+					_mm_and_ps(_mm_and_ps(_mm_cmpge_ps(ex, lo), _mm_cmple_ps(ex, scale)), _mm_and_ps(_mm_cmpge_ps(ey, lo), _mm_cmple_ps(ey, scale))),
+					_mm_and_ps(_mm_cmpge_ps(ez, lo), _mm_cmple_ps(ez, scale))
+				));
+
+				alignas(16) u32 qx[4], qy[4], qz[4];
+				_mm_store_si128((__m128i*) qx, _mm_cvttps_epi32(ex));
+				_mm_store_si128((__m128i*) qy, _mm_cvttps_epi32(ey));
+				_mm_store_si128((__m128i*) qz, _mm_cvttps_epi32(ez));
+
+				for (usz j = 0; j < 4; ++j) {
+
+					if (!(exact >> j & 1)) {
+						scalarDirectionalLights(dirs, colors, angularExtent, out, i + j, i + j + 1);
+						continue;
+					}
+
+					Light &light = out[i + j];
+
+					light.type = LightType::Directional;
+					light.rad = rad;
+					light.dir = { qx[j] << 16 | qy[j], qz[j] };
+
+					light.r = colors.x[i + j];
+					light.g = colors.y[i + j];
+					light.b = colors.z[i + j];
+				}
+			}
+
+			scalarDirectionalLights(dirs, colors, angularExtent, out, i, end);
+		}
+
+		#endif
+
+		#ifdef IGX_ENCODE_HALVES
+
+		static inline bool hasF16C() {
+
+			#ifdef _MSC_VER
+
+				//F16C, AVX and OSXSAVE, with the OS saving the ymm registers
+
+				int info[4];
+				__cpuid(info, 1);
+
+				return (info[2] & 0x38000000) == 0x38000000 && (_xgetbv(0) & 6) == 6;
+
+			#else
+				return __builtin_cpu_supports("f16c");
+			#endif
+		}
+
+		//Lanes that F16C rounds the same way as f16; zero and normal halves, which are rounded to nearest even
+		//Subnormal, too big, infinite and NaN lanes are left to the constructors
+
+		static inline int normalHalves(__m128 v) {
+
+			__m128 a = _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+
+			return _mm_movemask_ps(_mm_or_ps(
+				_mm_cmpeq_ps(a, _mm_setzero_ps()),
+				_mm_and_ps(_mm_cmpge_ps(a, _mm_set1_ps(0x1p-14f)), _mm_cmple_ps(a, _mm_set1_ps(65504.f)))
+			));
+		}
+
+		//Converts 4 halves into target, returns the lanes that are exact
+
+		IGX_TARGET_F16C static inline int toHalves(__m128 v, u16 (&target)[4]) {
+			_mm_storel_epi64((__m128i*) target, _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+			return normalHalves(v);
+		}
+
+		static inline void storeHalf(f16 &target, u16 v) {
+			std::memcpy(&target, &v, sizeof(u16));
+		}
+
+		IGX_TARGET_F16C static void vectorPointLights(
+			const Vec3Arrays &positions, const Vec3Arrays &colors, const f32 *rad, const f32 *origin, f32 specularity,
+			Light *out, usz begin, usz end
+		) {
+
+			usz i = begin;
+
+			for (; i + 4 <= end; i += 4) {
+
+				alignas(16) u16 halves[5][4];
+
+				int exact =
+					toHalves(gather(rad, i, 1), halves[0]) & toHalves(gather(origin, i, 1), halves[1]) &
+					toHalves(gather(colors.x, i, 1), halves[2]) & toHalves(gather(colors.y, i, 1), halves[3]) &
+					toHalves(gather(colors.z, i, 1), halves[4]);
+
+				for (usz j = 0; j < 4; ++j) {
+
+					if (!(exact >> j & 1)) {
+						scalarPointLights(positions, colors, rad, origin, specularity, out, i + j, i + j + 1);
+						continue;
+					}
+
+					Light &light = out[i + j];
+
+					light.type = LightType::Point;
+					light.pos = positions[i + j];
+					light.dir = LightNormal{};
+					light.specularity = specularity;
+
+					storeHalf(light.rad, halves[0][j]);
+					storeHalf(light.origin, halves[1][j]);
+					storeHalf(light.r, halves[2][j]);
+					storeHalf(light.g, halves[3][j]);
+					storeHalf(light.b, halves[4][j]);
+				}
+			}
+
+			scalarPointLights(positions, colors, rad, origin, specularity, out, i, end);
+		}
+
+		IGX_TARGET_F16C static void vectorMaterials(
+			const Vec3Arrays &albedo, const Vec3Arrays &ambient, const Vec3Arrays &emission,
+			const f32 *metallic, const f32 *roughness, const f32 *transparency,
+			Material *out, usz begin, usz end
+		) {
+
+			usz i = begin;
+
+			__m128 lo = _mm_setzero_ps(), scale = _mm_set1_ps(f32(u16_MAX));
+
+			for (; i + 4 <= end; i += 4) {
+
+				const Vec3Arrays *colors[] = { &albedo, &ambient, &emission };
+
+				alignas(16) u16 halves[9][4];
+				int exact = 0xF;
+
+				for (usz k = 0; k < 3; ++k) {
+					exact &= toHalves(gather(colors[k]->x, i, 1), halves[k * 3]);
+					exact &= toHalves(gather(colors[k]->y, i, 1), halves[k * 3 + 1]);
+					exact &= toHalves(gather(colors[k]->z, i, 1), halves[k * 3 + 2]);
+				}
+
+				//u16(v * u16_MAX); only lanes in [0, u16_MAX] are truncated here, like directional lights
+
+				__m128 m = _mm_mul_ps(gather(metallic, i, 1), scale);
+				__m128 r = _mm_mul_ps(gather(roughness, i, 1), scale);
+
+				exact &= _mm_movemask_ps(_mm_and_ps(
+					_mm_and_ps(_mm_cmpge_ps(m, lo), _mm_cmple_ps(m, scale)),
+					_mm_and_ps(_mm_cmpge_ps(r, lo), _mm_cmple_ps(r, scale))
+				));
+
+				alignas(16) u32 qm[4], qr[4];
+				_mm_store_si128((__m128i*) qm, _mm_cvttps_epi32(m));
+				_mm_store_si128((__m128i*) qr, _mm_cvttps_epi32(r));
+
+				for (usz j = 0; j < 4; ++j) {
+
+					if (!(exact >> j & 1)) {
+						scalarMaterials(albedo, ambient, emission, metallic, roughness, transparency, out, i + j, i + j + 1);
+						continue;
+					}
+
+					Material &mat = out[i + j];
+
+					storeHalf(mat.albedoR, halves[0][j]);
+					storeHalf(mat.albedoG, halves[1][j]);
+					storeHalf(mat.albedoB, halves[2][j]);
+					storeHalf(mat.ambientR, halves[3][j]);
+					storeHalf(mat.ambientG, halves[4][j]);
+					storeHalf(mat.ambientB, halves[5][j]);
+					storeHalf(mat.emissionR, halves[6][j]);
+					storeHalf(mat.emissionG, halves[7][j]);
+					storeHalf(mat.emissionB, halves[8][j]);
+
+					mat.metallic = u16(qm[j]);
+					mat.roughness = u16(qr[j]);
+					mat.transparency = transparency[i + j];
+				}
+			}
+
+			scalarMaterials(albedo, ambient, emission, metallic, roughness, transparency, out, i, end);
+		}
+
+		#endif
+
+	#endif
+
+	void encodeTriangles(const Vec3Arrays &positions, const Vec3Arrays &normals, std::span<Triangle> out, WorkerPool *workers) {
+
+		forBlocks(out.size(), workers, [&](usz begin, usz end) {
+			#ifdef IGX_ENCODE_TRIANGLES
+				vectorTriangles(positions, normals, out.data(), begin, end);
+			#else
+				scalarTriangles(positions, normals, out.data(), begin, end);
+			#endif
+		});
+	}
+
+	List<Light> encodeDirectionalLights(
+		const Vec3Arrays &dirs, const Vec3Arrays &colors, usz count, f32 angularExtent, WorkerPool *workers
+	) {
+
+		List<Light> out(count, Light(Vec3f32(0, 0, 1), Vec3f32()));
+
+		forBlocks(count, workers, [&](usz begin, usz end) {
+			#ifdef IGX_ENCODE_DIRECTIONAL_LIGHTS
+				vectorDirectionalLights(dirs, colors, angularExtent, out.data(), begin, end);
+			#else
+				scalarDirectionalLights(dirs, colors, angularExtent, out.data(), begin, end);
+			#endif
+		});
+
+		return out;
+	}
+
+	List<Light> encodePointLights(
+		const Vec3Arrays &positions, const Vec3Arrays &colors, const f32 *rad, const f32 *origin, usz count,
+		f32 specularity, WorkerPool *workers
+	) {
+
+		List<Light> out(count, Light(Vec3f32(), Vec3f32(), 0, 0));
+
+		#ifdef IGX_ENCODE_HALVES
+			bool f16c = hasF16C();
+		#endif
+
+		forBlocks(count, workers, [&](usz begin, usz end) {
+
+			#ifdef IGX_ENCODE_HALVES
+				if (f16c)
+					return vectorPointLights(positions, colors, rad, origin, specularity, out.data(), begin, end);
+			#endif
+
+			scalarPointLights(positions, colors, rad, origin, specularity, out.data(), begin, end);
+		});
+
+		return out;
+	}
+
+	List<Material> encodeMaterials(
+		const Vec3Arrays &albedo, const Vec3Arrays &ambient, const Vec3Arrays &emission,
+		const f32 *metallic, const f32 *roughness, const f32 *transparency, usz count,
+		WorkerPool *workers
+	) {
+
+		List<Material> out(count, Material(Vec3f32(), Vec3f32(), Vec3f32(), 0, 0, 0));
+
+		#ifdef IGX_ENCODE_HALVES
+			bool f16c = hasF16C();
+		#endif
+
+		forBlocks(count, workers, [&](usz begin, usz end) {
+
+			#ifdef IGX_ENCODE_HALVES
+				if (f16c)
+					return vectorMaterials(albedo, ambient, emission, metallic, roughness, transparency, out.data(), begin, end);
+			#endif
+
+			scalarMaterials(albedo, ambient, emission, metallic, roughness, transparency, out.data(), begin, end);
+		});
+
+		return out;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,448 @@
+#include "helpers/bvh.hpp"
+#include "helpers/worker_pool.hpp"
+#include "system/system.hpp"
+#include <array>
+#include <functional>
+
+namespace igx {
+
+	//Bounds that can be grown by primitives
+
+	struct Bounds {
+
+		f32 min[3] = {
+			std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max()
+		};
+
+		f32 max[3] = {
+			-std::numeric_limits<f32>::max(), -std::numeric_limits<f32>::max(), -std::numeric_limits<f32>::max()
+		};
+
+		inline void grow(const f32 *mi, const f32 *ma) {
+			for (usz i = 0; i < 3; ++i) {
+				min[i] = std::min(min[i], mi[i]);
+				max[i] = std::max(max[i], ma[i]);
+			}
+		}
+
+		inline void grow(const Bounds &b) { grow(b.min, b.max); }
+
+		inline f32 area() const {
+
+			f32 x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+
+			if (x < 0 || y < 0 || z < 0)
+				return 0;
+
+			return 2 * (x * y + y * z + z * x);
+		}
+	};
+
+	static inline f32 centroid(const BVH::Primitive &p, usz axis) {
+		return (p.min[axis] + p.max[axis]) * 0.5f;
+	}
+
+	//Primitive bounds and centroid bounds of a range
+
+	struct RangeBounds {
+
+		Bounds bounds, centroids;
+
+		inline void grow(const BVH::Primitive &p) {
+
+			bounds.grow(p.min, p.max);
+
+			f32 c[3] = { centroid(p, 0), centroid(p, 1), centroid(p, 2) };
+			centroids.grow(c, c);
+		}
+
+		inline void grow(const RangeBounds &r) {
+			bounds.grow(r.bounds);
+			centroids.grow(r.centroids);
+		}
+	};
+
+	struct Bin {
+		Bounds bounds;
+		u32 count{};
+	};
+
+	using Bins = std::array<std::array<Bin, BVH::binCount>, 3>;
+
+	struct BVH::Builder {
+
+		struct Task {
+			u32 node, begin, end, depth;
+		};
+
+		//Ranges this big are binned by multiple threads, smaller ones are handed out as subtrees
+
+		static constexpr u32 parallelBlock = 16384;
+
+		List<Primitive> &prims;
+		WorkerPool *workers;
+
+		Builder(List<Primitive> &prims, WorkerPool *workers): prims(prims), workers(workers) {}
+
+		//Run f(begin, end, block) over blocks of a range, on multiple threads if it's big
+
+		inline usz blocksOf(u32 count) const {
+			return workers && count > parallelBlock ? (count + parallelBlock - 1) / parallelBlock : 1;
+		}
+
+		template<typename F>
+		inline void forBlocks(u32 begin, u32 end, F &&f) {
+
+			usz blocks = blocksOf(end - begin);
+
+			if (blocks == 1)
+				f(begin, end, 0);
+
+			else workers->parallelFor(blocks, [&](usz i) {
+				u32 b = begin + u32(i) * parallelBlock;
+				f(b, std::min(end, b + parallelBlock), i);
+			});
+		}
+
+		RangeBounds getBounds(u32 begin, u32 end) {
+
+			List<RangeBounds> blocks(blocksOf(end - begin));
+
+			forBlocks(begin, end, [&](u32 b, u32 e, usz i) {
+				for (u32 j = b; j < e; ++j)
+					blocks[i].grow(prims[j]);
+			});
+
+			for (usz i = 1; i < blocks.size(); ++i)
+				blocks[0].grow(blocks[i]);
+
+			return blocks[0];
+		}
+
+		void bin(u32 begin, u32 end, const Bounds &centroids, Bins &bins) {
+
+			f32 scale[3];
+
+			for (usz a = 0; a < 3; ++a) {
+				f32 extent = centroids.max[a] - centroids.min[a];
+				scale[a] = extent > 0 ? binCount / extent : 0;
+			}
+
+			List<Bins> blocks(blocksOf(end - begin));
+
+			forBlocks(begin, end, [&](u32 b, u32 e, usz i) {
+				for (u32 j = b; j < e; ++j)
+					for (usz a = 0; a < 3; ++a) {
+						Bin &target = blocks[i][a][std::min(binCount - 1, usz((centroid(prims[j], a) - centroids.min[a]) * scale[a]))];
+						target.bounds.grow(prims[j].min, prims[j].max);
+						++target.count;
+					}
+			});
+
+			bins = blocks[0];
+
+			for (usz i = 1; i < blocks.size(); ++i)
+				for (usz a = 0; a < 3; ++a)
+					for (usz k = 0; k < binCount; ++k) {
+						bins[a][k].bounds.grow(blocks[i][a][k].bounds);
+						bins[a][k].count += blocks[i][a][k].count;
+					}
+		}
+
+		//Tasks is non null at the top of the tree, where subtrees are deferred to be built in parallel
+
+		void split(List<Node> &nodes, u32 nodeId, u32 begin, u32 end, u32 depth, List<Task> *tasks, u32 taskSize) {
+
+			u32 count = end - begin;
+
+			if (tasks && count <= taskSize) {
+				tasks->push_back({ nodeId, begin, end, depth });
+				return;
+			}
+
+			RangeBounds range = getBounds(begin, end);
+
+			Node &node = nodes[nodeId];
+
+			for (usz a = 0; a < 3; ++a) {
+				node.min[a] = range.bounds.min[a];
+				node.max[a] = range.bounds.max[a];
+			}
+
+			node.offset = begin;
+			node.count = count;
+
+			if (count == 1 || depth + 1 >= maxDepth)
+				return;
+
+			//Find the cheapest split between bins on every axis
+
+			Bins bins;
+			bin(begin, end, range.centroids, bins);
+
+			f32 area = range.bounds.area();
+			f32 bestCost = std::numeric_limits<f32>::max();
+			usz bestAxis{}, bestSplit{};
+
+			for (usz a = 0; a < 3; ++a) {
+
+				if (range.centroids.max[a] <= range.centroids.min[a])
+					continue;
+
+				f32 rightCost[binCount]{};
+				Bounds right;
+				u32 rightCount{};
+
+				for (usz k = binCount - 1; k > 0; --k) {
+					right.grow(bins[a][k].bounds);
+					rightCount += bins[a][k].count;
+					rightCost[k] = right.area() * rightCount;
+				}
+
+				Bounds left;
+				u32 leftCount{};
+
+				for (usz k = 0; k < binCount - 1; ++k) {
+
+					left.grow(bins[a][k].bounds);
+					leftCount += bins[a][k].count;
+
+					f32 cost = left.area() * leftCount + rightCost[k + 1];
+
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = a;
+						bestSplit = k;
+					}
+				}
+			}
+
+			f32 leafCost = f32(count);
+			bool hasSplit = bestCost != std::numeric_limits<f32>::max();
+
+			if (hasSplit)
+				bestCost = traversalCost + (area > 0 ? bestCost / area : f32(count));
+
+			if (count <= maxLeafSize && (!hasSplit || bestCost >= leafCost))
+				return;
+
+			//Partition by bin; if it's degenerate (all centroids in one spot), split in the middle instead
+
+			u32 mid = end;
+
+			if (hasSplit) {
+
+				f32 scale = binCount / (range.centroids.max[bestAxis] - range.centroids.min[bestAxis]);
+				f32 offset = range.centroids.min[bestAxis];
+
+				mid = u32(std::partition(
+					prims.begin() + begin, prims.begin() + end,
+					[=](const Primitive &p) {
+						return std::min(binCount - 1, usz((centroid(p, bestAxis) - offset) * scale)) <= bestSplit;
+					}
+				) - prims.begin());
+			}
+
+			if (mid == begin || mid == end)
+				mid = begin + count / 2;
+
+			u32 left = u32(nodes.size());
+			nodes.push_back({});
+			nodes.push_back({});
+
+			nodes[nodeId].offset = left;
+			nodes[nodeId].count = 0;
+
+			split(nodes, left, begin, mid, depth + 1, tasks, taskSize);
+			split(nodes, left + 1, mid, end, depth + 1, tasks, taskSize);
+		}
+
+	};
+
+	void BVH::build(List<Primitive> prims, WorkerPool *workers) {
+
+		clear();
+
+		if (prims.empty())
+			return;
+
+		oicAssert("BVH only supports up to 4B primitives", prims.size() <= u32_MAX);
+
+		Builder builder(prims, workers);
+		u32 count = u32(prims.size());
+
+		nodes.reserve(usz(count) * 2);
+		nodes.push_back({});
+
+		//Single threaded; or the top of the tree first, then every subtree on its own thread
+
+		if (!workers || workers->size() == 1 || count <= Builder::parallelBlock)
+			builder.split(nodes, 0, 0, count, 0, nullptr, 0);
+
+		else {
+
+			List<Builder::Task> tasks;
+			u32 taskSize = u32(std::max(usz(Builder::parallelBlock), count / (workers->size() * 4)));
+
+			builder.split(nodes, 0, 0, count, 0, &tasks, taskSize);
+
+			List<List<Node>> subtrees(tasks.size());
+
+			workers->parallelFor(tasks.size(), [&](usz i) {
+
+				Builder::Task &task = tasks[i];
+				List<Node> &subtree = subtrees[i];
+
+				subtree.reserve(usz(task.end - task.begin) * 2);
+				subtree.push_back({});
+
+				builder.split(subtree, 0, task.begin, task.end, task.depth, nullptr, 0);
+			});
+
+			//Append the subtrees; their roots replace the placeholders of the tasks
+
+			for (usz i = 0; i < tasks.size(); ++i) {
+
+				List<Node> &subtree = subtrees[i];
+				u32 base = u32(nodes.size()) - 1;
+
+				for (usz j = 0; j < subtree.size(); ++j) {
+
+					Node node = subtree[j];
+
+					if (!node.isLeaf())
+						node.offset += base;
+
+					if (j == 0)
+						nodes[tasks[i].node] = node;
+
+					else nodes.push_back(node);
+				}
+			}
+		}
+
+		primitives.resize(prims.size());
+
+		for (usz i = 0; i < prims.size(); ++i)
+			primitives[i] = prims[i].id;
+
+		leafPrimitives = std::move(prims);
+
+		//Children are always stored after their parent, which is what refit relies on
+
+		parents.resize(nodes.size());
+		leafOf.resize(primitives.size());
+		parents[0] = u32_MAX;
+
+		u32 maxId{};
+
+		for (u32 id : primitives)
+			maxId = std::max(maxId, id);
+
+		positionOf.assign(usz(maxId) + 1, u32_MAX);
+
+		for (u32 i = 0; i < u32(nodes.size()); ++i) {
+
+			const Node &node = nodes[i];
+
+			updateCost(node, 1);
+
+			if (!node.isLeaf()) {
+				parents[node.offset] = parents[node.offset + 1] = i;
+				continue;
+			}
+
+			for (u32 j = node.offset; j < node.offset + node.count; ++j) {
+				leafOf[j] = i;
+				positionOf[primitives[j]] = j;
+			}
+		}
+
+		modified = DirtyBitset(nodes.size());
+	}
+
+	bool BVH::refit(std::span<const Primitive> changed) {
+
+		for (const Primitive &prim : changed)
+			if (prim.id >= positionOf.size() || positionOf[prim.id] == u32_MAX)
+				return false;
+
+		//Collect the leaves and their ancestors, then refit them bottom up
+
+		refitNodes.clear();
+
+		for (const Primitive &prim : changed) {
+
+			u32 position = positionOf[prim.id];
+			leafPrimitives[position] = prim;
+
+			for (u32 node = leafOf[position]; node != u32_MAX; node = parents[node])
+				refitNodes.push_back(node);
+		}
+
+		std::sort(refitNodes.begin(), refitNodes.end(), std::greater<u32>());
+		refitNodes.erase(std::unique(refitNodes.begin(), refitNodes.end()), refitNodes.end());
+
+		for (u32 i : refitNodes) {
+
+			Node &node = nodes[i];
+			Bounds bounds;
+
+			if (node.isLeaf())
+				for (u32 j = node.offset; j < node.offset + node.count; ++j)
+					bounds.grow(leafPrimitives[j].min, leafPrimitives[j].max);
+
+			else {
+				bounds.grow(nodes[node.offset].min, nodes[node.offset].max);
+				bounds.grow(nodes[node.offset + 1].min, nodes[node.offset + 1].max);
+			}
+
+			updateCost(node, -1);
+
+			for (usz a = 0; a < 3; ++a) {
+				node.min[a] = bounds.min[a];
+				node.max[a] = bounds.max[a];
+			}
+
+			updateCost(node, 1);
+			modified.set(i);
+		}
+
+		return true;
+	}
+
+	static inline f32 nodeArea(const BVH::Node &node) {
+		Bounds b;
+		b.grow(node.min, node.max);
+		return b.area();
+	}
+
+	void BVH::updateCost(const Node &node, f64 sign) {
+		cost += sign * f64(nodeArea(node)) * (node.isLeaf() ? f64(node.count) : f64(traversalCost));
+	}
+
+	void BVH::clear() {
+		nodes.clear();
+		primitives.clear();
+		leafPrimitives.clear();
+		parents.clear();
+		leafOf.clear();
+		positionOf.clear();
+		modified = {};
+		cost = 0;
+	}
+
+	f32 BVH::getCost() const {
+
+		if (nodes.empty())
+			return 0;
+
+		f32 rootArea = nodeArea(nodes[0]);
+
+		if (rootArea <= 0)
+			return 0;
+
+		return f32(cost / rootArea);
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,521 @@
+#include "helpers/cpu_path_tracer.hpp"
+#include "helpers/ray_query.hpp"
+#include "helpers/worker_pool.hpp"
+#include <chrono>
+
+namespace igx {
+
+	static constexpr f32 pi = 3.14159265358979f;
+
+	//Rays leave surfaces this far along the normal, so they don't hit what they start on
+	static constexpr f32 surfaceOffset = 1e-4f;
+
+	//Paths of a tile are traced together, so the rays of every bounce are queried as one batch
+
+	struct CPUPathTracer::Tile {
+		u32 x, y, w, h;
+		usz rays;
+	};
+
+	//Xorshift seeded by a hash of the pixel and sample, so every sample is different but reproducible
+
+	struct PathRandom {
+
+		u32 state;
+
+		PathRandom() = default;
+
+		PathRandom(u32 x, u32 y, u32 sample) {
+
+			u32 v = x * 1973 + y * 9277 + sample * 26699;
+
+			v = (v ^ 61) ^ (v >> 16);
+			v *= 9;
+			v ^= v >> 4;
+			v *= 0x27D4EB2D;
+			v ^= v >> 15;
+
+			state = v | 1;
+		}
+
+		inline f32 next() {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return f32(state >> 8) * (1.f / 16777216);
+		}
+	};
+
+	//Sampling helpers
+
+	static inline Vec3f32 normalize3(const Vec3f32 &v) {
+		return v * (1 / std::sqrt(dot3(v, v)));
+	}
+
+	static inline Vec3f32 mul3(const Vec3f32 &a, const Vec3f32 &b) {
+		return Vec3f32(a.x * b.x, a.y * b.y, a.z * b.z);
+	}
+
+	static inline Vec2f32 sampleDisk(PathRandom &random) {
+		f32 r = std::sqrt(random.next()), phi = 2 * pi * random.next();
+		return Vec2f32(r * std::cos(phi), r * std::sin(phi));
+	}
+
+	//Cosine weighted direction around n
+
+	static inline Vec3f32 sampleHemisphere(const Vec3f32 &n, PathRandom &random) {
+
+		f32 sign = n.z >= 0 ? 1.f : -1.f;
+		f32 a = -1 / (sign + n.z), b = n.x * n.y * a;
+
+		Vec3f32 tangent(1 + sign * n.x * n.x * a, sign * b, -sign * n.x);
+		Vec3f32 bitangent(b, sign + n.y * n.y * a, -n.y);
+
+		Vec2f32 disk = sampleDisk(random);
+		f32 z = std::sqrt(std::max(0.f, 1 - disk.x * disk.x - disk.y * disk.y));
+
+		return tangent * disk.x + bitangent * disk.y + n * z;
+	}
+
+	//Direction towards the light, its distance and the light arriving at p
+	//Directional lights shine along their direction
+	//Spot lights don't store their angle, so they light the hemisphere they face, like the light tree assumes
+
+	static inline bool sampleLight(const Light &light, const Vec3f32 &p, Vec3f32 &wi, f32 &dist, Vec3f32 &radiance) {
+
+		Vec3f32 color(f32(light.r), f32(light.g), f32(light.b));
+
+		if (light.type.value == LightType::Directional) {
+
+			wi = light.dir.decode() * -1.f;
+
+			f32 len = std::sqrt(dot3(wi, wi));
+
+			if (len == 0)
+				return false;
+
+			wi = wi * (1 / len);
+			dist = rayMiss;
+			radiance = color;
+			return true;
+		}
+
+		//Inverse square, faded out towards the radius and limited by the size of the light
+
+		Vec3f32 toLight = light.pos - p;
+		f32 dist2 = dot3(toLight, toLight);
+
+		dist = std::sqrt(dist2);
+
+		f32 range = f32(light.rad), size = f32(light.origin);
+
+		if (dist == 0 || dist >= range)
+			return false;
+
+		f32 x = dist / range;
+		f32 window = 1 - x * x * x * x;
+
+		wi = toLight * (1 / dist);
+
+		if (light.type.value == LightType::Spot && dot3(light.dir.decode(), wi) >= 0)
+			return false;
+
+		radiance = color * (window * window / std::max(dist2, size * size));
+		return true;
+	}
+
+	static inline f32 toSRGB(f32 c) {
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f;
+	}
+
+	CPUPathTracer::CPUPathTracer(Graphics &g, WorkerPool *workers, const String &name, GPUFormat format):
+		TextureRenderTask(g, Texture::Info(Vec2u16(1, 1), format, GPUMemoryUsage::CPU_WRITE, 1, 1), name),
+		workers(workers)
+	{
+		oicAssert(
+			"CPUPathTracer only supports rgba32f, rgba16f, rgba8 and srgba8",
+			format == GPUFormat::rgba32f || format == GPUFormat::rgba16f ||
+			format == GPUFormat::rgba8 || format == GPUFormat::srgba8
+		);
+	}
+
+	void CPUPathTracer::resize(const Vec2u32 &size) {
+		TextureRenderTask::resize(size);
+		accumulation.resize(size.prod<usz>() * 3);
+		reset();
+	}
+
+	void CPUPathTracer::reset() {
+		std::fill(accumulation.begin(), accumulation.end(), 0.f);
+		samples = 0;
+	}
+
+	void CPUPathTracer::switchToScene(SceneGraph *sceneGraph) {
+		scene = sceneGraph;
+		reset();
+	}
+
+	void CPUPathTracer::renderTile(Tile &tile, const RayQuery &query, u32 sample) {
+
+		static constexpr usz maxPaths = tileSize * tileSize;
+
+		struct Path {
+			Vec3f32 throughput;
+			u32 pixel;
+			PathRandom random;
+		};
+
+		struct Shadow {
+			Vec3f32 contribution;
+			u32 pixel;
+		};
+
+		Ray rays[maxPaths], shadowRays[maxPaths];
+		RayHit hits[maxPaths];
+		Path paths[maxPaths];
+		Shadow shadows[maxPaths];
+		f32 shadowDist[maxPaths];
+		u8 occluded[maxPaths];
+
+		Vec3f32 color[maxPaths]{};
+
+		const Vec2u32 &res = size();
+
+		std::span<const Light> lights = scene->getObjects<Light>();
+		const LightTree &lightTree = scene->getLightTree();
+		std::span<const Material> materials = scene->getObjects<Material>();
+
+		//Camera rays
+
+		u32 count{};
+
+		Vec3f32 right = normalize3(camera.p1 - camera.p0), up = normalize3(camera.p0 - camera.p2);
+		f32 halfIpd = f32(camera.ipd) / 2000;
+		f32 aperature = f32(camera.aperature), focalDistance = camera.focalDistance;
+
+		for (u32 j = 0; j < tile.h; ++j)
+			for (u32 i = 0; i < tile.w; ++i) {
+
+				u32 x = tile.x + i, y = tile.y + j;
+
+				Path &path = paths[count];
+				path = { Vec3f32(1, 1, 1), j * tile.w + i, PathRandom(x, y, sample) };
+
+				f32 u = (x + path.random.next()) / res.x, v = (y + path.random.next()) / res.y;
+
+				//Split the image per eye
+
+				bool rightEye{};
+
+				switch (camera.projectionType.value) {
+
+					case ProjectionType::Stereoscopic_TB:
+					case ProjectionType::Stereoscopic_omnidirectional_TB:
+						rightEye = v >= 0.5f;
+						v = rightEye ? v * 2 - 1 : v * 2;
+						break;
+
+					case ProjectionType::Stereoscopic_LR:
+					case ProjectionType::Stereoscopic_omnidirectional_LR:
+						rightEye = u >= 0.5f;
+						u = rightEye ? u * 2 - 1 : u * 2;
+						break;
+
+					default:
+						break;
+				}
+
+				f32 eyeSide = camera.projectionType.value == ProjectionType::Default ? 0.f : (rightEye ? halfIpd : -halfIpd);
+				Ray &ray = rays[count];
+
+				//Equirectangular around the eye; the eyes are offset along the tangent of the view direction
+
+				if (
+					camera.projectionType.value == ProjectionType::Omnidirectional ||
+					camera.projectionType.value == ProjectionType::Stereoscopic_omnidirectional_TB ||
+					camera.projectionType.value == ProjectionType::Stereoscopic_omnidirectional_LR
+				) {
+
+					f32 phi = u * 2 * pi, theta = v * pi;
+
+					ray.dir = Vec3f32(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+					ray.origin = camera.eye + Vec3f32(-std::sin(phi), 0, std::cos(phi)) * eyeSide;
+				}
+
+				//Through the image plane, with a thin lens if there's an aperature
+
+				else {
+
+					const Vec3f32 &p0 = rightEye ? camera.p3 : camera.p0;
+					const Vec3f32 &p1 = rightEye ? camera.p4 : camera.p1;
+					const Vec3f32 &p2 = rightEye ? camera.p5 : camera.p2;
+
+					Vec3f32 eye = camera.eye + right * eyeSide;
+					Vec3f32 target = p0 + (p1 - p0) * u + (p2 - p0) * v;
+
+					ray.origin = eye;
+					ray.dir = normalize3(target - eye);
+
+					if (aperature > 0 && focalDistance > 0) {
+
+						Vec3f32 focus = eye + ray.dir * focalDistance;
+						Vec2f32 lens = sampleDisk(path.random) * aperature;
+
+						ray.origin = eye + right * lens.x + up * lens.y;
+						ray.dir = normalize3(focus - ray.origin);
+					}
+				}
+
+				++count;
+			}
+
+		//Trace the paths bounce by bounce; paths that end are removed, so the batches stay dense
+
+		for (u32 bounce = 0; count; ++bounce) {
+
+			query.closestHit(std::span<const Ray>(rays, count), std::span<RayHit>(hits, count));
+			tile.rays += count;
+
+			u32 next{}, shadowCount{};
+
+			for (u32 i = 0; i < count; ++i) {
+
+				Path path = paths[i];
+				Ray ray = rays[i];
+				const RayHit &hit = hits[i];
+
+				if (!hit.id) {
+					color[path.pixel] += mul3(path.throughput, camera.skyboxColor);
+					continue;
+				}
+
+				Vec3f32 albedo(0.5f, 0.5f, 0.5f), emission;
+				f32 metallic{}, roughness = 1, transparency{};
+
+				if (hit.material < materials.size()) {
+
+					const Material &mat = materials[hit.material];
+
+					albedo = Vec3f32(f32(mat.albedoR), f32(mat.albedoG), f32(mat.albedoB));
+					emission = Vec3f32(f32(mat.emissionR), f32(mat.emissionG), f32(mat.emissionB));
+					metallic = f32(mat.metallic) / u16_MAX;
+					roughness = f32(mat.roughness) / u16_MAX;
+					transparency = mat.transparency;
+				}
+
+				color[path.pixel] += mul3(path.throughput, emission);
+
+				Vec3f32 n = query.getNormal(ray, hit);
+				Vec3f32 p = ray.origin + ray.dir * hit.t;
+				Vec3f32 origin = p + n * surfaceOffset;
+
+				//Light the diffuse part by one light, picked by how much it's expected to contribute
+
+				f32 diffuse = (1 - transparency) * (1 - metallic);
+
+				u32 lightId;
+				f32 lightPdf;
+
+				if (diffuse > 0 && lightTree.sample(origin, n, path.random.next(), lightId, lightPdf)) {
+
+					Vec3f32 wi, radiance;
+					f32 dist;
+
+					if (sampleLight(lights[lightId], origin, wi, dist, radiance)) {
+
+						f32 cosTheta = dot3(n, wi);
+
+						if (cosTheta > 0) {
+
+							shadows[shadowCount] = {
+								mul3(mul3(path.throughput, albedo), radiance) * (diffuse * cosTheta / (pi * lightPdf)),
+								path.pixel
+							};
+
+							shadowRays[shadowCount] = { origin, wi };
+							shadowDist[shadowCount] = dist;
+							++shadowCount;
+						}
+					}
+				}
+
+				if (bounce == maxBounces)
+					continue;
+
+				//Pick a lobe; passing through, a rough mirror or diffuse
+
+				f32 lobe = path.random.next();
+
+				if (lobe < transparency)
+					ray.origin = p - n * surfaceOffset;
+
+				else {
+
+					if (lobe < transparency + (1 - transparency) * metallic) {
+
+						Vec3f32 reflected = ray.dir - n * (2 * dot3(ray.dir, n));
+						Vec3f32 fuzz = sampleHemisphere(n, path.random) * roughness;
+
+						ray.dir = normalize3(reflected + fuzz);
+
+						if (dot3(ray.dir, n) <= 0)
+							continue;
+					}
+
+					else ray.dir = sampleHemisphere(n, path.random);
+
+					ray.origin = origin;
+					path.throughput = mul3(path.throughput, albedo);
+				}
+
+				//Russian roulette once the path had a few bounces to contribute
+
+				if (bounce >= 2) {
+
+					f32 survive = std::clamp(std::max({ path.throughput.x, path.throughput.y, path.throughput.z }), 0.05f, 1.f);
+
+					if (path.random.next() >= survive)
+						continue;
+
+					path.throughput = path.throughput * (1 / survive);
+				}
+
+				paths[next] = path;
+				rays[next] = ray;
+				++next;
+			}
+
+			if (shadowCount) {
+
+				query.anyHit(
+					std::span<const Ray>(shadowRays, shadowCount),
+					std::span<const f32>(shadowDist, shadowCount),
+					std::span<u8>(occluded, shadowCount)
+				);
+
+				tile.rays += shadowCount;
+
+				for (u32 i = 0; i < shadowCount; ++i)
+					if (!occluded[i])
+						color[shadows[i].pixel] += shadows[i].contribution;
+			}
+
+			count = next;
+		}
+
+		//Add the sample
+
+		for (u32 j = 0; j < tile.h; ++j)
+			for (u32 i = 0; i < tile.w; ++i) {
+
+				f32 *target = accumulation.data() + ((tile.y + j) * usz(res.x) + tile.x + i) * 3;
+				const Vec3f32 &c = color[j * tile.w + i];
+
+				target[0] += c.x;
+				target[1] += c.y;
+				target[2] += c.z;
+			}
+	}
+
+	void CPUPathTracer::writeTile(const Tile &tile, u8 *target) const {
+
+		const Vec2u32 &res = size();
+		GPUFormat format = getInfo().format;
+
+		f32 scale = f32(camera.exposure) / samples;
+
+		usz stride = format == GPUFormat::rgba32f ? 16 : (format == GPUFormat::rgba16f ? 8 : 4);
+
+		for (u32 j = 0; j < tile.h; ++j)
+			for (u32 i = 0; i < tile.w; ++i) {
+
+				usz pixel = (tile.y + j) * usz(res.x) + tile.x + i;
+
+				const f32 *sum = accumulation.data() + pixel * 3;
+				f32 c[3] = { sum[0] * scale, sum[1] * scale, sum[2] * scale };
+
+				u8 *dst = target + pixel * stride;
+
+				switch (format) {
+
+					case GPUFormat::rgba32f: {
+						f32 rgba[4] = { c[0], c[1], c[2], 1 };
+						std::memcpy(dst, rgba, sizeof(rgba));
+						break;
+					}
+
+					case GPUFormat::rgba16f: {
+						f16 rgba[4] = { c[0], c[1], c[2], 1.f };
+						std::memcpy(dst, rgba, sizeof(rgba));
+						break;
+					}
+
+					//Reinhard, so bright parts don't clip
+
+					default:
+
+						for (usz k = 0; k < 3; ++k) {
+
+							f32 mapped = c[k] / (1 + c[k]);
+
+							if (format == GPUFormat::srgba8)
+								mapped = toSRGB(mapped);
+
+							dst[k] = u8(std::clamp(mapped, 0.f, 1.f) * 255 + 0.5f);
+						}
+
+						dst[3] = 255;
+				}
+			}
+	}
+
+	void CPUPathTracer::update(f64) {
+
+		const Vec2u32 &res = size();
+		Texture *texture = getTexture();
+
+		if (!scene || !texture || !res.x || !res.y)
+			return;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		RayQuery query(*scene, workers);
+
+		u32 tilesX = (res.x + tileSize - 1) / tileSize, tilesY = (res.y + tileSize - 1) / tileSize;
+		List<Tile> tiles(usz(tilesX) * tilesY);
+
+		u32 sample = samples++;
+		u8 *target = texture->getBuffer();
+
+		auto render = [&](usz t) {
+
+			Tile &tile = tiles[t];
+
+			tile.x = u32(t % tilesX) * tileSize;
+			tile.y = u32(t / tilesX) * tileSize;
+			tile.w = std::min(tileSize, res.x - tile.x);
+			tile.h = std::min(tileSize, res.y - tile.y);
+			tile.rays = 0;
+
+			renderTile(tile, query, sample);
+			writeTile(tile, target);
+		};
+
+		if (workers)
+			workers->parallelFor(tiles.size(), render);
+
+		else for (usz t = 0; t < tiles.size(); ++t)
+			render(t);
+
+		texture->flush(Vec3u16(), getInfo().dimensions);
+
+		raysTraced = 0;
+
+		for (const Tile &tile : tiles)
+			raysTraced += tile.rays;
+
+		f64 seconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+		mraysPerSecond = seconds > 0 ? raysTraced / seconds / 1e6 : 0;
+	}
+
+}
\ No newline at end of file
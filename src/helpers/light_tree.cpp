@@ -0,0 +1,424 @@
+#include "helpers/light_tree.hpp"
+#include "types/ray.hpp"
+
+namespace igx {
+
+	static constexpr f32 pi = 3.14159265358979f;
+	static constexpr f32 belowOne = 0x1.fffffep-1f;
+
+	//Directions within theta of the axis
+
+	struct Cone {
+		Vec3f32 axis;
+		f32 theta;
+	};
+
+	//Smallest cone that holds both cones
+
+	static inline Cone mergeCones(Cone a, Cone b) {
+
+		if (b.theta > a.theta)
+			std::swap(a, b);
+
+		f32 thetaD = std::acos(std::clamp(dot3(a.axis, b.axis), -1.f, 1.f));
+
+		if (std::min(thetaD + b.theta, pi) <= a.theta)
+			return a;
+
+		f32 thetaO = (a.theta + thetaD + b.theta) * 0.5f;
+		f32 sinD = std::sin(thetaD);
+
+		if (thetaO >= pi || sinD < 1e-6f)
+			return { a.axis, pi };
+
+		//Rotate the axis of a towards b, so both fit
+
+		f32 thetaR = thetaO - a.theta;
+
+		Vec3f32 axis = a.axis * (std::sin(thetaD - thetaR) / sinD) + b.axis * (std::sin(thetaR) / sinD);
+		f32 len = std::sqrt(dot3(axis, axis));
+
+		return { axis * (1 / len), thetaO };
+	}
+
+	//How much light a cluster of lights can at most give to p
+	//Power over the squared distance, reduced by how much the normal and the cone point away from it
+
+	static inline f32 importance(
+		const Vec3f32 &center, f32 radius, const Vec3f32 &axis, f32 cosTheta, f32 power,
+		const Vec3f32 &p, const Vec3f32 &n
+	) {
+
+		if (power <= 0)
+			return 0;
+
+		Vec3f32 d = center - p;
+		f32 dist2 = dot3(d, d);
+
+		//Inside of the bounds every direction is possible
+
+		if (dist2 <= radius * radius)
+			return power;
+
+		f32 dist = std::sqrt(dist2);
+		Vec3f32 wi = d * (1 / dist);
+
+		f32 sinU = radius / dist, cosU = std::sqrt(1 - sinU * sinU);
+
+		f32 cosI = 1, nn = dot3(n, n);
+
+		if (nn > 0) {
+
+			f32 c = dot3(n, wi) / std::sqrt(nn);
+
+			//cos(thetaI - thetaU), if the bounds aren't entirely in front of the surface
+
+			if (c < cosU) {
+
+				cosI = c * cosU + std::sqrt(std::max(0.f, 1 - c * c)) * sinU;
+
+				if (cosI <= 0)
+					return 0;
+			}
+		}
+
+		f32 cone = 1;
+
+		if (cosTheta > -1) {
+
+			f32 theta =
+				std::acos(std::clamp(-dot3(axis, wi), -1.f, 1.f)) -
+				std::acos(std::clamp(cosTheta, -1.f, 1.f)) -
+				std::acos(cosU);
+
+			if (theta >= pi * 0.5f)
+				return 0;
+
+			if (theta > 0)
+				cone = std::cos(theta);
+		}
+
+		return power * cosI * cone / dist2;
+	}
+
+	static inline f32 importance(const LightTree::Node &node, const Vec3f32 &p, const Vec3f32 &n) {
+
+		Vec3f32 mi(node.min[0], node.min[1], node.min[2]), ma(node.max[0], node.max[1], node.max[2]);
+		Vec3f32 center = (mi + ma) * 0.5f, half = ma - center;
+
+		return importance(
+			center, std::sqrt(dot3(half, half)), Vec3f32(node.axis[0], node.axis[1], node.axis[2]),
+			node.cosTheta, node.power, p, n
+		);
+	}
+
+	static inline f32 importance(const LightTree::Emitter &emitter, const Vec3f32 &p, const Vec3f32 &n) {
+		return importance(
+			Vec3f32(emitter.pos[0], emitter.pos[1], emitter.pos[2]), emitter.radius,
+			Vec3f32(emitter.axis[0], emitter.axis[1], emitter.axis[2]),
+			emitter.cosTheta, emitter.power, p, n
+		);
+	}
+
+	f32 LightTree::getPower(const Light &light) {
+		return std::max(0.2126f * f32(light.r) + 0.7152f * f32(light.g) + 0.0722f * f32(light.b), 0.f);
+	}
+
+	LightTree::Emitter LightTree::toEmitter(const Light &light, u32 index) {
+
+		Emitter emitter{};
+
+		emitter.pos[0] = light.pos.x;
+		emitter.pos[1] = light.pos.y;
+		emitter.pos[2] = light.pos.z;
+		emitter.radius = std::max(f32(light.origin), 1e-4f);
+
+		emitter.axis[2] = 1;
+		emitter.cosTheta = -1;
+
+		if (light.type.value == LightType::Spot) {
+
+			Vec3f32 axis = light.dir.decode();
+			f32 len = std::sqrt(dot3(axis, axis));
+
+			if (len > 0) {
+				emitter.axis[0] = axis.x / len;
+				emitter.axis[1] = axis.y / len;
+				emitter.axis[2] = axis.z / len;
+				emitter.cosTheta = 0;
+			}
+		}
+
+		emitter.power = getPower(light);
+		emitter.light = index;
+		return emitter;
+	}
+
+	void LightTree::fitNode(u32 i) {
+
+		const BVH::Node &src = bvh.getNodes()[i];
+		Node &node = nodes[i];
+
+		for (usz a = 0; a < 3; ++a) {
+			node.min[a] = src.min[a];
+			node.max[a] = src.max[a];
+		}
+
+		node.offset = src.offset;
+		node.count = src.count;
+
+		Cone cone{};
+		f32 power{};
+		bool first = true;
+
+		auto add = [&](const f32 (&axis)[3], f32 cosTheta, f32 p) {
+
+			Cone c{ Vec3f32(axis[0], axis[1], axis[2]), std::acos(std::clamp(cosTheta, -1.f, 1.f)) };
+
+			cone = first ? c : mergeCones(cone, c);
+			first = false;
+			power += p;
+		};
+
+		if (node.isLeaf())
+			for (u32 j = node.offset; j < node.offset + node.count; ++j)
+				add(emitters[j].axis, emitters[j].cosTheta, emitters[j].power);
+
+		else for (u32 j = node.offset; j < node.offset + 2; ++j)
+			add(nodes[j].axis, nodes[j].cosTheta, nodes[j].power);
+
+		node.axis[0] = cone.axis.x;
+		node.axis[1] = cone.axis.y;
+		node.axis[2] = cone.axis.z;
+		node.cosTheta = cone.theta >= pi ? -1 : std::cos(cone.theta);
+		node.power = power;
+	}
+
+	void LightTree::build(std::span<const Light> lights, WorkerPool *workers) {
+
+		clear();
+
+		oicAssert("LightTree only supports up to 4B lights", lights.size() <= u32_MAX);
+
+		List<BVH::Primitive> prims;
+		prims.reserve(lights.size());
+
+		for (u32 i = 0; i < u32(lights.size()); ++i) {
+
+			const Light &light = lights[i];
+			Emitter emitter = toEmitter(light, i);
+
+			if (light.type.value == LightType::Directional) {
+				directional.push_back(emitter);
+				directionalPower += emitter.power;
+				continue;
+			}
+
+			BVH::Primitive prim;
+			prim.id = i;
+
+			for (usz a = 0; a < 3; ++a) {
+				prim.min[a] = emitter.pos[a] - emitter.radius;
+				prim.max[a] = emitter.pos[a] + emitter.radius;
+			}
+
+			prims.push_back(prim);
+		}
+
+		emitterOf.assign(lights.size(), u32_MAX);
+
+		bvh.build(std::move(prims), workers);
+		bvh.clearModified();
+
+		//Emitters are in the order of the leaves, so leaves refer to a range of them
+
+		auto &leaves = bvh.getLeafPrimitives();
+		emitters.resize(leaves.size());
+
+		for (u32 i = 0; i < u32(leaves.size()); ++i) {
+			u32 light = leaves[i].id;
+			emitters[i] = toEmitter(lights[light], light);
+			emitterOf[light] = i;
+		}
+
+		modifiedEmitters = DirtyBitset(emitters.size());
+
+		//Children are always after their parent
+
+		nodes.resize(bvh.getNodes().size());
+
+		for (usz i = nodes.size(); i > 0; --i)
+			fitNode(u32(i - 1));
+	}
+
+	bool LightTree::refit(std::span<const Light> lights, std::span<const u32> changed) {
+
+		List<BVH::Primitive> prims;
+		bool directionalChanged{};
+
+		for (u32 i : changed) {
+
+			if (i >= emitterOf.size() || i >= lights.size())
+				return false;
+
+			bool isDirectional = lights[i].type.value == LightType::Directional;
+
+			if (isDirectional != (emitterOf[i] == u32_MAX))
+				return false;
+
+			if (isDirectional) {
+				directionalChanged = true;
+				continue;
+			}
+
+			Emitter emitter = toEmitter(lights[i], i);
+
+			BVH::Primitive prim;
+			prim.id = i;
+
+			for (usz a = 0; a < 3; ++a) {
+				prim.min[a] = emitter.pos[a] - emitter.radius;
+				prim.max[a] = emitter.pos[a] + emitter.radius;
+			}
+
+			prims.push_back(prim);
+		}
+
+		if (!bvh.refit(prims))
+			return false;
+
+		for (const BVH::Primitive &prim : prims) {
+			u32 position = emitterOf[prim.id];
+			emitters[position] = toEmitter(lights[prim.id], prim.id);
+			modifiedEmitters.set(position);
+		}
+
+		if (directionalChanged) {
+
+			directionalPower = 0;
+
+			for (Emitter &emitter : directional) {
+				emitter = toEmitter(lights[emitter.light], emitter.light);
+				directionalPower += emitter.power;
+			}
+		}
+
+		//Ancestors have a lower index, so fit the refit nodes back to front
+
+		refitRanges.clear();
+
+		bvh.getModified().forEachRange(0, nodes.size(), [this](usz begin, usz end) {
+			refitRanges.push_back({ begin, end });
+		});
+
+		for (usz r = refitRanges.size(); r > 0; --r)
+			for (usz i = refitRanges[r - 1].second; i > refitRanges[r - 1].first; --i)
+				fitNode(u32(i - 1));
+
+		return true;
+	}
+
+	bool LightTree::sample(const Vec3f32 &p, const Vec3f32 &n, f32 u, u32 &light, f32 &pdf) const {
+
+		f32 local = nodes.empty() ? 0 : importance(nodes[0], p, n);
+		f32 total = local + directionalPower;
+
+		if (total <= 0)
+			return false;
+
+		u = std::clamp(u, 0.f, belowOne);
+
+		//Directional lights by their power, against what the whole tree can give
+
+		f32 pDirectional = directionalPower / total;
+
+		if (u < pDirectional) {
+
+			u /= pDirectional;
+
+			for (const Emitter &emitter : directional) {
+
+				f32 prob = emitter.power / directionalPower;
+
+				if (u < prob || &emitter == &directional.back()) {
+					light = emitter.light;
+					pdf = pDirectional * prob;
+					return prob > 0;
+				}
+
+				u -= prob;
+			}
+		}
+
+		u = std::min((u - pDirectional) / (1 - pDirectional), belowOne);
+		pdf = 1 - pDirectional;
+
+		//Walk down by the importance of both children, reusing what's left of the random number
+
+		u32 i{};
+
+		while (!nodes[i].isLeaf()) {
+
+			u32 left = nodes[i].offset;
+			f32 il = importance(nodes[left], p, n), ir = importance(nodes[left + 1], p, n);
+
+			if (il + ir <= 0)
+				return false;
+
+			f32 pl = il / (il + ir);
+
+			if (u < pl) {
+				u /= pl;
+				pdf *= pl;
+				i = left;
+			}
+
+			else {
+				u = (u - pl) / (1 - pl);
+				pdf *= 1 - pl;
+				i = left + 1;
+			}
+
+			u = std::min(u, belowOne);
+		}
+
+		//Leaves are small, so the emitters are picked by importance one by one
+
+		const Node &leaf = nodes[i];
+		f32 sum{};
+
+		for (u32 j = 0; j < leaf.count; ++j)
+			sum += importance(emitters[leaf.offset + j], p, n);
+
+		if (sum <= 0)
+			return false;
+
+		u *= sum;
+
+		for (u32 j = 0; j < leaf.count; ++j) {
+
+			f32 weight = importance(emitters[leaf.offset + j], p, n);
+
+			if (u < weight || j + 1 == leaf.count) {
+				light = emitters[leaf.offset + j].light;
+				pdf *= weight / sum;
+				return weight > 0;
+			}
+
+			u -= weight;
+		}
+
+		return false;
+	}
+
+	void LightTree::clear() {
+		bvh.clear();
+		nodes.clear();
+		emitters.clear();
+		emitterOf.clear();
+		directional.clear();
+		directionalPower = 0;
+		modifiedEmitters = {};
+	}
+
+}
\ No newline at end of file
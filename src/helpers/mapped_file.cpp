@@ -0,0 +1,152 @@
+#include "helpers/mapped_file.hpp"
+
+#ifdef _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <Windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace igx {
+
+	//The view keeps the file open, so the handles aren't needed after mapping
+
+	#ifdef _WIN32
+
+		MappedFile::MappedFile(const String &path) {
+
+			HANDLE file = CreateFileA(
+				path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+			);
+
+			if (file == INVALID_HANDLE_VALUE)
+				return;
+
+			LARGE_INTEGER size{};
+
+			if (!GetFileSizeEx(file, &size)) {
+				CloseHandle(file);
+				return;
+			}
+
+			length = usz(size.QuadPart);
+
+			//Empty files can't be mapped, but they can be opened
+
+			if (!length) {
+				CloseHandle(file);
+				opened = true;
+				return;
+			}
+
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseHandle(file);
+
+			if (!mapping) {
+				length = 0;
+				return;
+			}
+
+			ptr = (const u8*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+
+			opened = ptr != nullptr;
+
+			if (!ptr)
+				length = 0;
+		}
+
+		void MappedFile::close() {
+
+			if (ptr)
+				UnmapViewOfFile(ptr);
+
+			ptr = nullptr;
+			length = 0;
+			opened = false;
+		}
+
+	#else
+
+		MappedFile::MappedFile(const String &path) {
+
+			int file = open(path.c_str(), O_RDONLY);
+
+			if (file < 0)
+				return;
+
+			struct stat info{};
+
+			if (fstat(file, &info) || !S_ISREG(info.st_mode)) {
+				::close(file);
+				return;
+			}
+
+			length = usz(info.st_size);
+
+			//Empty files can't be mapped, but they can be opened
+
+			if (!length) {
+				::close(file);
+				opened = true;
+				return;
+			}
+
+			void *view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+			::close(file);
+
+			if (view == MAP_FAILED) {
+				length = 0;
+				return;
+			}
+
+			ptr = (const u8*) view;
+			opened = true;
+		}
+
+		void MappedFile::close() {
+
+			if (ptr)
+				munmap((void*) ptr, length);
+
+			ptr = nullptr;
+			length = 0;
+			opened = false;
+		}
+
+	#endif
+
+	MappedFile::~MappedFile() { close(); }
+
+	MappedFile::MappedFile(MappedFile &&other): ptr(other.ptr), length(other.length), opened(other.opened) {
+		other.ptr = nullptr;
+		other.length = 0;
+		other.opened = false;
+	}
+
+	MappedFile &MappedFile::operator=(MappedFile &&other) {
+
+		if (this == &other)
+			return *this;
+
+		close();
+
+		ptr = other.ptr;
+		length = other.length;
+		opened = other.opened;
+
+		other.ptr = nullptr;
+		other.length = 0;
+		other.opened = false;
+		return *this;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "helpers/multi_buffer.hpp"
+#include <algorithm>
+
+namespace igx {
+
+	MultiBuffer::MultiBuffer(Graphics &g, const String &name, const GPUBuffer::Info &info, usz frames):
+		carried(frames)
+	{
+		buffers.reserve(frames);
+
+		for (usz i = 0; i < frames; ++i)
+			buffers.push_back(GPUBufferRef(
+				g, NAME(frames == 1 ? name : name + " #" + std::to_string(i)), info
+			));
+	}
+
+	void MultiBuffer::flush(usz frame, usz offset, usz size) {
+
+		buffers[frame]->flush(offset, size);
+
+		for (usz i = 0; i < carried.size(); ++i)
+			if (i != frame)
+				carried[i].push_back({ offset, size });
+	}
+
+	usz MultiBuffer::catchUp(usz frame, const u8 *source) {
+
+		auto &ranges = carried[frame];
+
+		if (ranges.empty())
+			return 0;
+
+		//The same objects are often modified multiple frames in a row, so merge what overlaps
+
+		std::sort(ranges.begin(), ranges.end());
+
+		usz merged{}, start = ranges[0].first, end = start + ranges[0].second;
+		u8 *target = buffers[frame]->getBuffer();
+
+		for (usz i = 1; i <= ranges.size(); ++i) {
+
+			if (i < ranges.size() && ranges[i].first <= end) {
+				end = std::max(end, ranges[i].first + ranges[i].second);
+				continue;
+			}
+
+			std::memcpy(target + start, source + start, end - start);
+			buffers[frame]->flush(start, end - start);
+			++merged;
+
+			if (i < ranges.size()) {
+				start = ranges[i].first;
+				end = start + ranges[i].second;
+			}
+		}
+
+		ranges.clear();
+		return merged;
+	}
+
+	void MultiBuffer::truncate(usz size) {
+
+		for (auto &ranges : carried) {
+
+			ranges.erase(
+				std::remove_if(ranges.begin(), ranges.end(), [size](const Pair<usz, usz> &range) {
+					return range.first >= size;
+				}),
+				ranges.end()
+			);
+
+			for (auto &range : ranges)
+				range.second = std::min(range.second, size - range.first);
+		}
+	}
+
+	void MultiBuffer::copyFrom(const u8 *source, usz size) {
+
+		for (usz i = 0; i < buffers.size(); ++i) {
+
+			carried[i].clear();
+
+			if (!size)
+				continue;
+
+			std::memcpy(buffers[i]->getBuffer(), source, size);
+			buffers[i]->flush(0, size);
+		}
+	}
+
+}
\ No newline at end of file
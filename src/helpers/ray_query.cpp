@@ -0,0 +1,546 @@
+#include "helpers/ray_query.hpp"
+#include "helpers/worker_pool.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define IGX_RAY_SSE
+	#include <immintrin.h>
+#endif
+
+namespace igx {
+
+	//Rays are handed to the workers in blocks, so a job is big enough to be worth it
+	static constexpr usz rayBlock = 64;
+
+	//Rays that are traced together; every lane is a ray and lanes that are done are masked off
+
+	struct RayQuery::Packet {
+
+		alignas(16) f32 o[3][4], inv[3][4], d[3][4];
+		alignas(16) f32 t[4];
+
+		u32 geometry[4];
+		Ray rays[4];
+
+		u32 lanes;		//Rays that are still traced
+	};
+
+	RayQuery::RayQuery(const SceneGraph &scene, WorkerPool *workers): scene(scene), workers(workers) {
+
+		//The counts of the last update, since the offsets and the BVH are from then as well
+		//Objects that were added since aren't in the BVH, so they're never hit
+
+		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+
+			const SceneGraph::Object &obj = scene.objects[u8(type)];
+			u32 count = obj.updatedCount;
+
+			if (obj.materialOffset != u32_MAX && count)
+				ranges[rangeCount++] = { obj.materialOffset, obj.materialOffset + count, type };
+		}
+	}
+
+	//Intersect a geometry id with one ray
+
+	static inline bool intersectGeometry(
+		const SceneGraph &scene, const Ray &ray, SceneObjectType type, const u8 *data, u32 i, f32 &t
+	) {
+		switch (type) {
+			case SceneObjectType::TRIANGLE:		return intersect(ray, ((const Triangle*) data)[i], t);
+			case SceneObjectType::SPHERE:		return intersect(ray, ((const Sphere*) data)[i], t);
+			case SceneObjectType::CUBE:			return intersect(ray, ((const Cube*) data)[i], t);
+			case SceneObjectType::PLANE:		return intersect(ray, ((const Plane*) data)[i], t);
+			default:							return false;
+		}
+	}
+
+	RayHit RayQuery::decode(u32 geometry, f32 t) const {
+
+		for (usz i = 0; i < rangeCount; ++i) {
+
+			const GeometryRange &range = ranges[i];
+
+			if (geometry < range.begin || geometry >= range.end)
+				continue;
+
+			u64 id = scene.objects[u8(range.type)].toIndex[geometry - range.begin];
+
+			if (!id)
+				break;
+
+			return RayHit{ id, t, scene.getMaterialIndex(scene.materialByObject[geometry]), range.type };
+		}
+
+		return RayHit{ 0, rayMiss, 0, SceneObjectType::COUNT };
+	}
+
+	//Test the lanes against one primitive of a leaf
+
+	template<bool anyHit>
+	inline void RayQuery::intersect(Packet &packet, u32 geometry, u32 lanes) const {
+
+		const GeometryRange *range{};
+
+		for (usz i = 0; i < rangeCount; ++i)
+			if (geometry >= ranges[i].begin && geometry < ranges[i].end) {
+				range = ranges + i;
+				break;
+			}
+
+		if (!range)
+			return;
+
+		u32 index = geometry - range->begin;
+		const SceneGraph::Object &obj = scene.objects[u8(range->type)];
+
+		u32 hits{};
+
+	#ifdef IGX_RAY_SSE
+
+		//Möller-Trumbore for all lanes at once; same operations as the scalar one, so the hits are identical
+
+		if (range->type == SceneObjectType::TRIANGLE) {
+
+			const Triangle &tri = ((const Triangle*) obj.data)[index];
+			Vec3f32 e0v = tri.edge0(), e1v = tri.edge1();
+
+			__m128 e0[3] = { _mm_set1_ps(e0v.x), _mm_set1_ps(e0v.y), _mm_set1_ps(e0v.z) };
+			__m128 e1[3] = { _mm_set1_ps(e1v.x), _mm_set1_ps(e1v.y), _mm_set1_ps(e1v.z) };
+
+			__m128 d[3] = { _mm_load_ps(packet.d[0]), _mm_load_ps(packet.d[1]), _mm_load_ps(packet.d[2]) };
+
+			auto cross = [](const __m128 *a, const __m128 *b, __m128 *c) {
+				c[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+				c[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+				c[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+			};
+
+			auto dot = [](const __m128 *a, const __m128 *b) {
+				return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+			};
+
+			__m128 p[3];
+			cross(d, e1, p);
+
+			__m128 det = dot(e0, p);
+			__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+			__m128 reject = _mm_cmplt_ps(absDet, _mm_set1_ps(1e-12f));
+
+			//Lanes that aren't tested keep their t
+
+			reject = _mm_or_ps(reject, _mm_castsi128_ps(_mm_cmpeq_epi32(
+				_mm_and_si128(_mm_set1_epi32(i32(lanes)), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128()
+			)));
+
+			__m128 invDet = _mm_div_ps(_mm_set1_ps(1), det);
+
+			__m128 s[3] = {
+				_mm_sub_ps(_mm_load_ps(packet.o[0]), _mm_set1_ps(tri.p0.x)),
+				_mm_sub_ps(_mm_load_ps(packet.o[1]), _mm_set1_ps(tri.p0.y)),
+				_mm_sub_ps(_mm_load_ps(packet.o[2]), _mm_set1_ps(tri.p0.z))
+			};
+
+			__m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+
+			__m128 u = _mm_mul_ps(dot(s, p), invDet);
+			reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)));
+
+			__m128 q[3];
+			cross(s, e0, q);
+
+			__m128 v = _mm_mul_ps(dot(d, q), invDet);
+			reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+
+			__m128 dist = _mm_mul_ps(dot(e1, q), invDet);
+			__m128 t = _mm_load_ps(packet.t);
+
+			reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmple_ps(dist, _mm_set1_ps(rayEpsilon)), _mm_cmpge_ps(dist, t)));
+
+			hits = ~u32(_mm_movemask_ps(reject)) & 0xF;
+
+			_mm_store_ps(packet.t, _mm_or_ps(_mm_and_ps(reject, t), _mm_andnot_ps(reject, dist)));
+		}
+
+		else
+
+	#endif
+
+		for (u32 lane = 0; lane < packetSize; ++lane)
+			if ((lanes >> lane & 1) && range->type == SceneObjectType::INSTANCE) {
+				if (scene.intersectInstance(packet.rays[lane], ((const Instance*) obj.data)[index], packet.t[lane]))
+					hits |= 1 << lane;
+			}
+
+			else if ((lanes >> lane & 1) && intersectGeometry(scene, packet.rays[lane], range->type, obj.data, index, packet.t[lane]))
+				hits |= 1 << lane;
+
+		for (u32 lane = 0; lane < packetSize; ++lane)
+			if (hits >> lane & 1)
+				packet.geometry[lane] = geometry;
+
+		if constexpr (anyHit)
+			packet.lanes &= ~hits;
+	}
+
+	//Trace up to packetSize rays; t and geometry are per ray
+
+	template<bool anyHit>
+	void RayQuery::trace(const Ray *rays, usz count, const f32 *tmax, f32 *t, u32 *geometry) const {
+
+		Packet packet;
+		packet.lanes = (1 << count) - 1;
+
+		for (u32 lane = 0; lane < packetSize; ++lane) {
+
+			//Unused lanes repeat the first ray, so they don't produce NaNs
+
+			const Ray &ray = rays[lane < count ? lane : 0];
+
+			packet.rays[lane] = ray;
+			packet.t[lane] = tmax[lane < count ? lane : 0];
+			packet.geometry[lane] = u32_MAX;
+
+			const f32 o[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+			const f32 d[3] = { ray.dir.x, ray.dir.y, ray.dir.z };
+
+			for (usz i = 0; i < 3; ++i) {
+				packet.o[i][lane] = o[i];
+				packet.d[i][lane] = d[i];
+				packet.inv[i][lane] = 1 / d[i];
+			}
+		}
+
+		auto &nodes = scene.bvh.getNodes();
+		auto &primitives = scene.bvh.getPrimitives();
+
+		if (!nodes.empty()) {
+
+		#ifdef IGX_RAY_SSE
+
+			__m128 o[3] = { _mm_load_ps(packet.o[0]), _mm_load_ps(packet.o[1]), _mm_load_ps(packet.o[2]) };
+			__m128 inv[3] = { _mm_load_ps(packet.inv[0]), _mm_load_ps(packet.inv[1]), _mm_load_ps(packet.inv[2]) };
+
+			//Returns the lanes that enter the node before their t and the nearest entry of those lanes
+
+			auto slab = [&](const BVH::Node &node, u32 lanes, f32 &nearest) -> u32 {
+
+				__m128 tnear = _mm_setzero_ps(), tfar = _mm_load_ps(packet.t);
+
+				for (usz i = 0; i < 3; ++i) {
+
+					__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[i]), o[i]), inv[i]);
+					__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[i]), o[i]), inv[i]);
+
+					tnear = _mm_max_ps(tnear, _mm_min_ps(t0, t1));
+					tfar = _mm_min_ps(tfar, _mm_max_ps(t0, t1));
+				}
+
+				u32 mask = u32(_mm_movemask_ps(_mm_cmple_ps(tnear, tfar))) & lanes;
+
+				alignas(16) f32 entry[4];
+				_mm_store_ps(entry, tnear);
+
+				nearest = rayMiss;
+
+				for (u32 lane = 0; lane < packetSize; ++lane)
+					if (mask >> lane & 1)
+						nearest = std::min(nearest, entry[lane]);
+
+				return mask;
+			};
+
+			//Lanes that enter a node travel down together; the farther child is visited later
+			//Nodes are tested again when they're popped, since the lanes might have hit something closer
+
+			struct StackEntry {
+				u32 node, lanes;
+			};
+
+			StackEntry stack[BVH::maxDepth];
+			usz stackSize = 1;
+
+			stack[0] = { 0, packet.lanes };
+
+			while (stackSize) {
+
+				StackEntry entry = stack[--stackSize];
+				f32 nearest;
+
+				u32 lanes = slab(nodes[entry.node], entry.lanes & packet.lanes, nearest);
+
+				while (lanes) {
+
+					const BVH::Node &node = nodes[entry.node];
+
+					if (node.isLeaf()) {
+
+						for (u32 i = node.offset, end = node.offset + node.count; i < end && lanes; ++i) {
+
+							intersect<anyHit>(packet, primitives[i], lanes);
+
+							if constexpr (anyHit)
+								lanes &= packet.lanes;
+						}
+
+						break;
+					}
+
+					f32 dl, dr;
+					u32 left = node.offset, right = left + 1;
+					u32 ll = slab(nodes[left], lanes, dl), lr = slab(nodes[right], lanes, dr);
+
+					if (dr < dl) {
+						std::swap(left, right);
+						std::swap(ll, lr);
+					}
+
+					if (!ll) {
+						entry.node = right;
+						lanes = lr;
+						continue;
+					}
+
+					if (lr)
+						stack[stackSize++] = { right, lr };
+
+					entry.node = left;
+					lanes = ll;
+				}
+
+				if constexpr (anyHit)
+					if (!packet.lanes)
+						break;
+			}
+
+		#else
+
+			for (u32 lane = 0; lane < count; ++lane) {
+
+				u32 mask = 1 << lane;
+
+				BVH::traverse(nodes, packet.rays[lane].origin, packet.rays[lane].dir, packet.t[lane], [&](u32 position, f32&) -> bool {
+
+					if (!(packet.lanes & mask))
+						return false;
+
+					u32 before = packet.geometry[lane];
+					intersect<anyHit>(packet, primitives[position], mask);
+					return packet.geometry[lane] != before;
+				});
+			}
+
+		#endif
+		}
+
+		//Planes are infinite, so they aren't in the BVH and every ray tests all of them
+
+		const SceneGraph::Object &planes = scene.objects[u8(SceneObjectType::PLANE)];
+
+		for (u32 i = 0, planeCount = scene.info.planeCount; i < planeCount && packet.lanes; ++i)
+			if (planes.toIndex[i])
+				intersect<anyHit>(packet, planes.materialOffset + i, packet.lanes);
+
+		for (u32 lane = 0; lane < count; ++lane) {
+			t[lane] = packet.t[lane];
+			geometry[lane] = packet.geometry[lane];
+		}
+	}
+
+	//Split the rays in blocks of packets, which the workers can pick up
+
+	template<typename Packets>
+	static inline void forPackets(WorkerPool *workers, usz count, Packets &&packets) {
+
+		usz blocks = (count + rayBlock - 1) / rayBlock;
+
+		auto block = [&](usz b) {
+			for (usz i = b * rayBlock, end = std::min(count, i + rayBlock); i < end; i += RayQuery::packetSize)
+				packets(i, std::min(end - i, RayQuery::packetSize));
+		};
+
+		if (!workers || blocks <= 1)
+			for (usz b = 0; b < blocks; ++b)
+				block(b);
+
+		else workers->parallelFor(blocks, block);
+	}
+
+	void RayQuery::closestHit(std::span<const Ray> rays, std::span<RayHit> hits, f32 tmax) const {
+
+		if (rays.size() != hits.size()) {
+			oic::System::log()->error("RayQuery::closestHit requires a hit per ray");
+			return;
+		}
+
+		const f32 limits[packetSize] = { tmax, tmax, tmax, tmax };
+
+		forPackets(workers, rays.size(), [&](usz i, usz count) {
+
+			f32 t[packetSize];
+			u32 geometry[packetSize];
+
+			trace<false>(rays.data() + i, count, limits, t, geometry);
+
+			for (usz j = 0; j < count; ++j)
+				hits[i + j] = geometry[j] == u32_MAX ? RayHit{ 0, rayMiss, 0, SceneObjectType::COUNT } : decode(geometry[j], t[j]);
+		});
+	}
+
+	void RayQuery::anyHit(std::span<const Ray> rays, std::span<u8> hits, f32 tmax) const {
+
+		if (rays.size() != hits.size()) {
+			oic::System::log()->error("RayQuery::anyHit requires a result per ray");
+			return;
+		}
+
+		const f32 limits[packetSize] = { tmax, tmax, tmax, tmax };
+
+		forPackets(workers, rays.size(), [&](usz i, usz count) {
+
+			f32 t[packetSize];
+			u32 geometry[packetSize];
+
+			trace<true>(rays.data() + i, count, limits, t, geometry);
+
+			for (usz j = 0; j < count; ++j)
+				hits[i + j] = geometry[j] != u32_MAX;
+		});
+	}
+
+	void RayQuery::anyHit(std::span<const Ray> rays, std::span<const f32> tmax, std::span<u8> hits) const {
+
+		if (rays.size() != hits.size() || rays.size() != tmax.size()) {
+			oic::System::log()->error("RayQuery::anyHit requires a maximum distance and result per ray");
+			return;
+		}
+
+		forPackets(workers, rays.size(), [&](usz i, usz count) {
+
+			f32 t[packetSize];
+			u32 geometry[packetSize];
+
+			trace<true>(rays.data() + i, count, tmax.data() + i, t, geometry);
+
+			for (usz j = 0; j < count; ++j)
+				hits[i + j] = geometry[j] != u32_MAX;
+		});
+	}
+
+	RayHit RayQuery::closestHit(const Ray &ray, f32 tmax) const {
+		RayHit hit;
+		closestHit(std::span<const Ray>(&ray, 1), std::span<RayHit>(&hit, 1), tmax);
+		return hit;
+	}
+
+	bool RayQuery::anyHit(const Ray &ray, f32 tmax) const {
+		u8 hit;
+		anyHit(std::span<const Ray>(&ray, 1), std::span<u8>(&hit, 1), tmax);
+		return hit;
+	}
+
+	Vec3f32 RayQuery::getNormal(const Ray &ray, const RayHit &hit) const {
+
+		const SceneGraph::Entry *entry = scene.find(hit.id);
+
+		if (!entry)
+			return Vec3f32();
+
+		const u8 *data = scene.objects[u8(entry->type)].data;
+		Vec3f32 p = ray.origin + ray.dir * hit.t, n;
+
+		switch (entry->type) {
+
+			case SceneObjectType::TRIANGLE: {
+				const Triangle &tri = ((const Triangle*) data)[entry->index];
+				n = cross3(tri.edge0(), tri.edge1());
+				break;
+			}
+
+			case SceneObjectType::SPHERE:
+				n = p - ((const Sphere*) data)[entry->index].Position;
+				break;
+
+			//The axis the hit is closest to the side of
+
+			case SceneObjectType::CUBE: {
+
+				const Cube &cube = ((const Cube*) data)[entry->index];
+
+				Vec3f32 center = (cube.min + cube.max) * 0.5f, half = (cube.max - cube.min) * 0.5f;
+				Vec3f32 local = p - center;
+
+				f32 x = std::abs(local.x / half.x), y = std::abs(local.y / half.y), z = std::abs(local.z / half.z);
+
+				if (x >= y && x >= z)
+					n = Vec3f32(local.x, 0, 0);
+
+				else if (y >= z)
+					n = Vec3f32(0, local.y, 0);
+
+				else n = Vec3f32(0, 0, local.z);
+
+				break;
+			}
+
+			case SceneObjectType::PLANE:
+				n = ((const Plane*) data)[entry->index].dir;
+				break;
+
+			//Find the triangle again in the space of the mesh
+			//Normals go back to world space through the transpose of the inverse
+
+			case SceneObjectType::INSTANCE: {
+
+				const Instance &instance = ((const Instance*) data)[entry->index];
+
+				if (instance.mesh >= scene.meshes.size())
+					return Vec3f32();
+
+				const MeshInfo &mesh = scene.meshes[instance.mesh];
+
+				Ray local{ instance.toObject(ray.origin), instance.toObjectDir(ray.dir) };
+
+				f32 t = rayMiss;
+				u32 closest = u32_MAX;
+
+				BVH::traverse(
+					std::span<const BVH::Node>(scene.meshNodes.data() + mesh.firstNode, mesh.nodeCount),
+					local.origin, local.dir, t,
+					[&](u32 position, f32 &tmax) -> bool {
+
+						if (!igx::intersect(local, scene.getMeshTriangle(mesh, position), tmax))
+							return false;
+
+						closest = position;
+						return true;
+					}
+				);
+
+				if (closest == u32_MAX)
+					return Vec3f32();
+
+				Triangle tri = scene.getMeshTriangle(mesh, closest);
+				Vec3f32 ln = cross3(tri.edge0(), tri.edge1());
+				const f32 (&m)[3][4] = instance.worldToObject;
+
+				n = Vec3f32(
+					m[0][0] * ln.x + m[1][0] * ln.y + m[2][0] * ln.z,
+					m[0][1] * ln.x + m[1][1] * ln.y + m[2][1] * ln.z,
+					m[0][2] * ln.x + m[1][2] * ln.y + m[2][2] * ln.z
+				);
+
+				break;
+			}
+
+			default:
+				return Vec3f32();
+		}
+
+		f32 len = std::sqrt(dot3(n, n));
+
+		if (len == 0)
+			return Vec3f32();
+
+		return n * ((dot3(n, ray.dir) > 0 ? -1 : 1) / len);
+	}
+
+}
\ No newline at end of file
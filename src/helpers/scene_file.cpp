@@ -0,0 +1,678 @@
+#include "helpers/scene_file.hpp"
+#include "helpers/worker_pool.hpp"
+#include "helpers/mapped_file.hpp"
+#include <chrono>
+#include <fstream>
+
+namespace igx {
+
+	using LoadClock = std::chrono::high_resolution_clock;
+
+	static inline f64 lap(LoadClock::time_point &start) {
+		LoadClock::time_point now = LoadClock::now();
+		f64 seconds = std::chrono::duration<f64>(now - start).count();
+		start = now;
+		return seconds;
+	}
+
+	static inline void forEach(usz count, WorkerPool *workers, const std::function<void(usz)> &f) {
+
+		if (workers)
+			workers->parallelFor(count, f);
+
+		else for (usz i = 0; i < count; ++i)
+			f(i);
+	}
+
+	static constexpr usz align(usz v, usz alignment) { return (v + alignment - 1) / alignment * alignment; }
+
+	//Meshes use the slot after the scene object types
+	static constexpr SceneObjectType meshSection = SceneObjectType::COUNT;
+
+	//Stride per scene object type
+
+	static constexpr usz objectStride[] = {
+		sizeof(Light), sizeof(Material), sizeof(Triangle), sizeof(Sphere), sizeof(Cube), sizeof(Plane), sizeof(Instance)
+	};
+
+	static_assert(sizeof(objectStride) / sizeof(objectStride[0]) == usz(SceneObjectType::COUNT), "Every scene object type needs a stride");
+
+	static constexpr bool isGeometry[] = { false, false, true, true, true, true, true };
+
+	//Where the arrays of a section are, relative to its offset
+
+	struct SectionLayout {
+		usz ids, materials, meshes, vertices, indices, size;
+	};
+
+	//u32s of indices of a mesh; u16 indices are packed two per u32
+
+	static inline usz indexWordsOf(MeshIndexFormat format, u32 triangleCount) {
+		usz indices = usz(triangleCount) * 3;
+		return format == MeshIndexFormat::U16 ? (indices + 1) / 2 : indices;
+	}
+
+	static inline SectionLayout getLayout(const SceneFileSection &section) {
+
+		SectionLayout layout{};
+		usz end = align(usz(section.count) * section.stride, 8);
+
+		if (section.type == meshSection) {
+			layout.meshes = end;
+			layout.vertices = layout.meshes + usz(section.meshes) * sizeof(SceneFileMesh);
+			layout.indices = layout.vertices + usz(section.vertices) * sizeof(QuantizedVertex);
+			layout.size = layout.indices + usz(section.indices) * sizeof(u32);
+			return layout;
+		}
+
+		layout.ids = end;
+		end += usz(section.count) * sizeof(u64);
+
+		if (isGeometry[u8(section.type)]) {
+			layout.materials = end;
+			end += usz(section.count) * sizeof(u32);
+		}
+
+		layout.size = end;
+		return layout;
+	}
+
+	//Checksum of a block; four lanes of FNV-1a over words, so it's not limited by the latency of the multiply
+	//Blocks are hashed separately, so a section can be verified by multiple threads
+
+	static constexpr usz checksumBlock = 1 << 20;
+	static constexpr u64 fnvBasis = 0xCBF29CE484222325, fnvPrime = 0x100000001B3;
+
+	static u64 checksumOf(const u8 *data, usz size) {
+
+		u64 lanes[4] = { fnvBasis, fnvBasis + 1, fnvBasis + 2, fnvBasis + 3 };
+		usz i = 0;
+
+		for (; i + 32 <= size; i += 32)
+			for (usz l = 0; l < 4; ++l) {
+				u64 word;
+				std::memcpy(&word, data + i + l * 8, sizeof(word));
+				lanes[l] = (lanes[l] ^ word) * fnvPrime;
+			}
+
+		u64 hash = fnvBasis;
+
+		for (u64 lane : lanes)
+			hash = (hash ^ lane ^ lane >> 32) * fnvPrime;
+
+		for (; i < size; ++i)
+			hash = (hash ^ data[i]) * fnvPrime;
+
+		return hash;
+	}
+
+	static inline u64 combineChecksums(std::span<const u64> blocks) {
+
+		u64 hash = fnvBasis;
+
+		for (u64 block : blocks)
+			hash = (hash ^ block ^ block >> 32) * fnvPrime;
+
+		return hash;
+	}
+
+	static u64 checksumOfSection(const u8 *data, usz size) {
+
+		List<u64> blocks((size + checksumBlock - 1) / checksumBlock);
+
+		for (usz i = 0; i < blocks.size(); ++i)
+			blocks[i] = checksumOf(data + i * checksumBlock, std::min(checksumBlock, size - i * checksumBlock));
+
+		return combineChecksums(blocks);
+	}
+
+	//Saving
+
+	template<typename T>
+	static inline const u8 *getObjectData(const SceneGraph &scene) {
+		return (const u8*) scene.getObjects<T>().data();
+	}
+
+	using GetObjectData = const u8 *(*)(const SceneGraph&);
+
+	static constexpr GetObjectData objectData[] = {
+		getObjectData<Light>, getObjectData<Material>, getObjectData<Triangle>, getObjectData<Sphere>,
+		getObjectData<Cube>, getObjectData<Plane>, getObjectData<Instance>
+	};
+
+	bool saveScene(const SceneGraph &scene, const String &path) {
+
+		List<SceneFileSection> sections;
+		List<List<u8>> sectionData;
+
+		//Materials are stored by where they are in the material section, since handles aren't kept
+
+		HashMap<u32, u32> materialByHandle;
+
+		for (u8 t = 0; t < u8(SceneObjectType::COUNT); ++t) {
+
+			SceneObjectType type = SceneObjectType(t);
+			std::span<const u64> ids = scene.getIds(type);
+			const u8 *objects = objectData[t](scene);
+			usz stride = objectStride[t];
+
+			List<u64> alive;
+
+			for (u64 id : ids)
+				if (id)
+					alive.push_back(id);
+
+			if (alive.empty())
+				continue;
+
+			SceneFileSection section{ type, {}, u32(stride), u32(alive.size()) };
+			SectionLayout layout = getLayout(section);
+
+			List<u8> data(layout.size);
+
+			for (usz i = 0, j = 0; i < ids.size(); ++i)
+				if (ids[i])
+					std::memcpy(data.data() + stride * j++, objects + stride * i, stride);
+
+			std::memcpy(data.data() + layout.ids, alive.data(), alive.size() * sizeof(u64));
+
+			if (type == SceneObjectType::MATERIAL)
+				for (usz i = 0; i < alive.size(); ++i)
+					materialByHandle[scene.getMaterialHandle(alive[i])] = u32(i);
+
+			//Materials are saved before geometry, since they come first in SceneObjectType
+			//Geometry without a material falls back to the first, like material handle 0 does in the scene graph
+
+			if (isGeometry[t])
+				for (usz i = 0; i < alive.size(); ++i) {
+
+					auto it = materialByHandle.find(scene.find(alive[i])->material);
+					u32 material = it == materialByHandle.end() ? 0 : it->second;
+
+					std::memcpy(data.data() + layout.materials + i * sizeof(u32), &material, sizeof(u32));
+				}
+
+			sections.push_back(section);
+			sectionData.push_back(std::move(data));
+		}
+
+		//Meshes as they're stored in the scene graph, in the order of their BVH leaves
+		//Counts fit in a u32, since the scene graph refers to them with one
+
+		const List<MeshInfo> &meshes = scene.getMeshes();
+
+		if (meshes.size()) {
+
+			SceneFileSection section{ meshSection, {}, u32(sizeof(Triangle)), 0, u32(meshes.size()) };
+			List<SceneFileMesh> records(meshes.size());
+
+			for (usz m = 0; m < meshes.size(); ++m) {
+
+				const MeshInfo &mesh = meshes[m];
+				SceneFileMesh &record = records[m];
+
+				record.triangleCount = mesh.triangleCount;
+				record.indexFormat = mesh.indexFormat;
+
+				if (mesh.indexFormat == MeshIndexFormat::NONE) {
+					section.count += mesh.triangleCount;
+					continue;
+				}
+
+				record.vertexCount = mesh.vertexCount;
+				record.indexCount = u32(indexWordsOf(mesh.indexFormat, mesh.triangleCount));
+
+				std::memcpy(record.origin, mesh.origin, sizeof(record.origin));
+				std::memcpy(record.scale, mesh.scale, sizeof(record.scale));
+
+				section.vertices += record.vertexCount;
+				section.indices += record.indexCount;
+			}
+
+			SectionLayout layout = getLayout(section);
+			List<u8> data(layout.size);
+
+			Triangle *triangles = (Triangle*) data.data();
+			QuantizedVertex *vertices = (QuantizedVertex*) (data.data() + layout.vertices);
+			u32 *indices = (u32*) (data.data() + layout.indices);
+
+			std::memcpy(data.data() + layout.meshes, records.data(), records.size() * sizeof(SceneFileMesh));
+
+			for (const MeshInfo &mesh : meshes) {
+
+				if (mesh.indexFormat == MeshIndexFormat::NONE) {
+
+					for (u32 i = 0; i < mesh.triangleCount; ++i)
+						*triangles++ = scene.getMeshTriangle(mesh, i);
+
+					continue;
+				}
+
+				usz indexWords = indexWordsOf(mesh.indexFormat, mesh.triangleCount);
+
+				std::memcpy(vertices, scene.getMeshVertices().data() + mesh.firstVertex, mesh.vertexCount * sizeof(QuantizedVertex));
+				std::memcpy(indices, scene.getMeshIndices().data() + mesh.firstIndex, indexWords * sizeof(u32));
+
+				vertices += mesh.vertexCount;
+				indices += indexWords;
+			}
+
+			sections.push_back(section);
+			sectionData.push_back(std::move(data));
+		}
+
+		//Sections start aligned, after the header and the section table
+
+		usz offset = align(sizeof(SceneFileHeader) + sections.size() * sizeof(SceneFileSection), sceneFileAlignment);
+
+		for (usz i = 0; i < sections.size(); ++i) {
+			sections[i].offset = offset;
+			sections[i].size = sectionData[i].size();
+			sections[i].checksum = checksumOfSection(sectionData[i].data(), sectionData[i].size());
+			offset = align(offset + sectionData[i].size(), sceneFileAlignment);
+		}
+
+		SceneFileHeader header{
+			{}, SceneFileHeader::currentVersion, IGX_NORMAL_CODEC, IGX_LIGHT_NORMAL_CODEC, u16(sections.size()), 0,
+			offset, checksumOf((const u8*) sections.data(), sections.size() * sizeof(SceneFileSection))
+		};
+
+		std::memcpy(header.name, SceneFileHeader::magic, sizeof(header.name));
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+		if (!file) {
+			oic::System::log()->error(String("Couldn't save scene to ") + path + "; it couldn't be opened");
+			return false;
+		}
+
+		static const u8 padding[sceneFileAlignment]{};
+
+		file.write((const char*) &header, sizeof(header));
+		file.write((const char*) sections.data(), sections.size() * sizeof(SceneFileSection));
+
+		usz written = sizeof(header) + sections.size() * sizeof(SceneFileSection);
+
+		for (usz i = 0; i < sections.size(); ++i) {
+			file.write((const char*) padding, sections[i].offset - written);
+			file.write((const char*) sectionData[i].data(), sectionData[i].size());
+			written = sections[i].offset + sectionData[i].size();
+		}
+
+		file.write((const char*) padding, offset - written);
+		file.close();
+
+		if (!file) {
+			oic::System::log()->error(String("Couldn't save scene to ") + path + "; it couldn't be written");
+			return false;
+		}
+
+		return true;
+	}
+
+	//Loading
+
+	//Objects per job
+	static constexpr usz loadBlock = 65536;
+
+	//A section is copied into the storage of its type with one memcpy, which is the mapped buffer with IN_PLACE
+	//Without IN_PLACE it's the cpu copy, which update has to flush to the buffer either way
+
+	template<typename T>
+	static inline List<u64> insertObjects(SceneGraph &scene, const u8 *objects, usz count, std::span<const u32> materials) {
+		return scene.addBatch(std::span<const T>((const T*) objects, count), materials);
+	}
+
+	using InsertObjects = List<u64> (*)(SceneGraph&, const u8*, usz, std::span<const u32>);
+
+	static constexpr InsertObjects insertObjectsOf[] = {
+		insertObjects<Light>, insertObjects<Material>, insertObjects<Triangle>, insertObjects<Sphere>,
+		insertObjects<Cube>, insertObjects<Plane>, insertObjects<Instance>
+	};
+
+	//Header and section table; everything that's needed to safely read the sections
+
+	static bool readSections(const MappedFile &file, const SceneFileSection *&sections, usz &sectionCount, String &error) {
+
+		SceneFileHeader header;
+
+		if (file.size() < sizeof(header)) {
+			error = "it's not an igxs file";
+			return false;
+		}
+
+		std::memcpy(&header, file.data(), sizeof(header));
+
+		if (std::memcmp(header.name, SceneFileHeader::magic, sizeof(header.name)) || header.version != SceneFileHeader::currentVersion) {
+			error = "it's not an igxs file of version " + std::to_string(SceneFileHeader::currentVersion);
+			return false;
+		}
+
+		if (header.normalCodec != IGX_NORMAL_CODEC || header.lightNormalCodec != IGX_LIGHT_NORMAL_CODEC) {
+			error = "it was saved with other normal codecs";
+			return false;
+		}
+
+		sectionCount = header.sectionCount;
+		usz tableSize = sectionCount * sizeof(SceneFileSection);
+
+		if (header.size != file.size() || tableSize > file.size() - sizeof(header)) {
+			error = "it's truncated";
+			return false;
+		}
+
+		sections = (const SceneFileSection*) (file.data() + sizeof(header));
+
+		if (checksumOf((const u8*) sections, tableSize) != header.checksum) {
+			error = "the section table is corrupt";
+			return false;
+		}
+
+		bool found[usz(SceneObjectType::COUNT) + 1]{};
+
+		for (usz i = 0; i < sectionCount; ++i) {
+
+			const SceneFileSection &section = sections[i];
+			u8 t = u8(section.type);
+
+			if (t > u8(meshSection) || found[t]) {
+				error = "it has an unknown or duplicate section";
+				return false;
+			}
+
+			found[t] = true;
+
+			if (section.stride != (section.type == meshSection ? sizeof(Triangle) : objectStride[t])) {
+				error = "the stride of a section doesn't match the scene graph";
+				return false;
+			}
+
+			if (
+				section.offset % sceneFileAlignment || section.offset > file.size() || section.size > file.size() - section.offset ||
+				section.size != getLayout(section).size
+			) {
+				error = "a section is out of bounds";
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	//Checksums of all sections, per block so big sections are split over the threads
+
+	static bool verifySections(
+		const MappedFile &file, std::span<const SceneFileSection> sections, WorkerPool *workers, String &error
+	) {
+
+		List<Pair<usz, usz>> blocks;		//Section and offset
+
+		for (usz i = 0; i < sections.size(); ++i)
+			for (usz offset = 0; offset < sections[i].size; offset += checksumBlock)
+				blocks.push_back({ i, offset });
+
+		List<u64> checksums(blocks.size());
+
+		forEach(blocks.size(), workers, [&](usz i) {
+			const SceneFileSection &section = sections[blocks[i].first];
+			usz offset = blocks[i].second;
+			checksums[i] = checksumOf(file.data() + section.offset + offset, std::min(checksumBlock, usz(section.size) - offset));
+		});
+
+		for (usz i = 0, first = 0; i < sections.size(); ++i) {
+
+			usz count = (usz(sections[i].size) + checksumBlock - 1) / checksumBlock;
+
+			if (combineChecksums(std::span<const u64>(checksums.data() + first, count)) != sections[i].checksum) {
+				error = "a section is corrupt";
+				return false;
+			}
+
+			first += count;
+		}
+
+		return true;
+	}
+
+	bool loadScene(SceneGraph &scene, const String &path, SceneLoad &result, WorkerPool *workers, bool verify, bool upload) {
+
+		result = {};
+
+		LoadClock::time_point start = LoadClock::now();
+
+		MappedFile file(path);
+
+		if (!file.isOpen()) {
+			oic::System::log()->error(String("Couldn't load scene ") + path + "; it couldn't be opened");
+			return false;
+		}
+
+		const SceneFileSection *sectionTable{};
+		usz sectionCount{};
+		String error;
+
+		if (!readSections(file, sectionTable, sectionCount, error)) {
+			oic::System::log()->error(String("Couldn't load scene ") + path + "; " + error);
+			return false;
+		}
+
+		std::span<const SceneFileSection> sections(sectionTable, sectionCount);
+		const SceneFileSection *byType[usz(SceneObjectType::COUNT) + 1]{};
+
+		for (const SceneFileSection &section : sections)
+			byType[u8(section.type)] = &section;
+
+		//Meshes have to add up to the triangles, vertices and indices of their section and instances have to use existing meshes
+		//These are checked even without verify, since they'd be read out of bounds otherwise
+		//Indices into the vertices are checked by addMesh
+
+		const SceneFileSection *meshes = byType[u8(meshSection)];
+		const SceneFileSection *instances = byType[u8(SceneObjectType::INSTANCE)];
+
+		const u8 *meshData = meshes ? file.data() + meshes->offset : nullptr;
+		SectionLayout meshLayout = meshes ? getLayout(*meshes) : SectionLayout{};
+		std::span<const SceneFileMesh> meshRecords;
+
+		if (meshes) {
+
+			meshRecords = std::span<const SceneFileMesh>((const SceneFileMesh*) (meshData + meshLayout.meshes), meshes->meshes);
+
+			usz triangles{}, vertices{}, indices{};
+
+			for (const SceneFileMesh &mesh : meshRecords) {
+
+				if (!mesh.triangleCount)
+					error = "a mesh is empty";
+
+				if (mesh.indexFormat == MeshIndexFormat::NONE) {
+
+					if (mesh.vertexCount || mesh.indexCount)
+						error = "a mesh that isn't indexed has vertices or indices";
+
+					triangles += mesh.triangleCount;
+				}
+
+				else if (
+					mesh.indexFormat > MeshIndexFormat::U32 || mesh.triangleCount > u32_MAX / 3 ||
+					mesh.indexCount != indexWordsOf(mesh.indexFormat, mesh.triangleCount)
+				)
+					error = "a mesh has invalid indices";
+
+				else {
+					vertices += mesh.vertexCount;
+					indices += mesh.indexCount;
+				}
+			}
+
+			if (triangles != meshes->count || vertices != meshes->vertices || indices != meshes->indices)
+				error = "the meshes don't add up to their triangles, vertices and indices";
+		}
+
+		if (instances) {
+
+			const Instance *data = (const Instance*) (file.data() + instances->offset);
+
+			for (u32 i = 0; i < instances->count; ++i)
+				if (data[i].mesh >= meshRecords.size())
+					error = "an instance uses a mesh that doesn't exist";
+		}
+
+		if (!error.empty()) {
+			oic::System::log()->error(String("Couldn't load scene ") + path + "; " + error);
+			return false;
+		}
+
+		result.mapTime = lap(start);
+
+		if (verify) {
+
+			if (!verifySections(file, sections, workers, error)) {
+				oic::System::log()->error(String("Couldn't load scene ") + path + "; " + error);
+				return false;
+			}
+
+			result.verifyTime = lap(start);
+		}
+
+		//Materials first, since geometry refers to them by handle
+
+		auto fail = [&](const char *what) {
+
+			for (const List<u64> &ids : result.ids)
+				scene.del(ids);
+
+			for (u8 t = 0; t < u8(SceneObjectType::COUNT); ++t) {
+				result.ids[t].clear();
+				result.savedIds[t].clear();
+			}
+
+			oic::System::log()->error(String("Couldn't load scene ") + path + "; " + what + " don't fit in the scene graph");
+			return false;
+		};
+
+		List<u32> handles;
+
+		if (const SceneFileSection *materials = byType[u8(SceneObjectType::MATERIAL)]) {
+
+			List<u64> &ids = result.ids[u8(SceneObjectType::MATERIAL)];
+			ids = insertObjectsOf[u8(SceneObjectType::MATERIAL)](scene, file.data() + materials->offset, materials->count, {});
+
+			if (ids.size() != materials->count)
+				return fail("the materials");
+
+			handles.resize(ids.size());
+
+			for (usz i = 0; i < ids.size(); ++i)
+				handles[i] = scene.getMaterialHandle(ids[i]);
+		}
+
+		//Meshes are rebuilt, since their BVH isn't stored; indexed meshes keep their quantized vertices
+
+		result.meshes.resize(meshRecords.size());
+
+		const Triangle *meshTriangles = (const Triangle*) meshData;
+		const QuantizedVertex *meshVertices = (const QuantizedVertex*) (meshData + meshLayout.vertices);
+		const u32 *meshIndices = (const u32*) (meshData + meshLayout.indices);
+
+		List<u32> indices;
+
+		for (usz m = 0; m < meshRecords.size(); ++m) {
+
+			const SceneFileMesh &mesh = meshRecords[m];
+
+			if (mesh.indexFormat == MeshIndexFormat::NONE) {
+				result.meshes[m] = scene.addMesh(std::span<const Triangle>(meshTriangles, mesh.triangleCount));
+				meshTriangles += mesh.triangleCount;
+			}
+
+			//Indices are unpacked into triples, which addMesh packs again
+
+			else {
+
+				MeshInfo bounds{};
+				bounds.indexFormat = mesh.indexFormat;
+
+				std::memcpy(bounds.origin, mesh.origin, sizeof(bounds.origin));
+				std::memcpy(bounds.scale, mesh.scale, sizeof(bounds.scale));
+
+				indices.resize(usz(mesh.triangleCount) * 3);
+
+				for (u32 k = 0; k < u32(indices.size()); ++k)
+					indices[k] = bounds.getIndex(meshIndices, k);
+
+				result.meshes[m] = scene.addMesh(bounds, std::span<const QuantizedVertex>(meshVertices, mesh.vertexCount), indices);
+
+				meshVertices += mesh.vertexCount;
+				meshIndices += mesh.indexCount;
+			}
+
+			if (result.meshes[m] == u32_MAX) {
+				oic::System::log()->error(String("Couldn't load scene ") + path + "; a mesh is invalid");
+				return false;
+			}
+		}
+
+		for (u8 t = 0; t < u8(SceneObjectType::COUNT); ++t) {
+
+			const SceneFileSection *section = byType[t];
+
+			if (!section || t == u8(SceneObjectType::MATERIAL))
+				continue;
+
+			const u8 *data = file.data() + section->offset;
+			SectionLayout layout = getLayout(*section);
+			usz count = section->count;
+
+			//Material indices become the handles they were loaded with; ones that don't exist become material handle 0
+
+			List<u32> materials;
+
+			if (isGeometry[t]) {
+
+				const u32 *indices = (const u32*) (data + layout.materials);
+				materials.resize(count);
+
+				forEach((count + loadBlock - 1) / loadBlock, workers, [&](usz block) {
+					for (usz i = block * loadBlock, end = std::min(count, i + loadBlock); i < end; ++i)
+						materials[i] = indices[i] < handles.size() ? handles[indices[i]] : 0;
+				});
+			}
+
+			//Instances point to the mesh indices of this scene graph
+
+			List<Instance> remapped;
+
+			if (t == u8(SceneObjectType::INSTANCE)) {
+
+				remapped.assign((const Instance*) data, (const Instance*) data + count);
+
+				for (Instance &instance : remapped)
+					instance.mesh = result.meshes[instance.mesh];
+
+				data = (const u8*) remapped.data();
+			}
+
+			List<u64> &ids = result.ids[t];
+			ids = insertObjectsOf[t](scene, data, count, materials);
+
+			if (ids.size() != count)
+				return fail("the objects");
+		}
+
+		for (const SceneFileSection &section : sections)
+			if (section.type != meshSection) {
+				const u64 *savedIds = (const u64*) (file.data() + section.offset + getLayout(section).ids);
+				result.savedIds[u8(section.type)].assign(savedIds, savedIds + section.count);
+			}
+
+		result.insertTime = lap(start);
+
+		if (upload) {
+			scene.update(0);
+			result.uploadTime = lap(start);
+		}
+
+		return true;
+	}
+
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "helpers/scene_graph.hpp"
 #include "igxi/convert.hpp"
 #include "types/list_ref.hpp"
+#include <random>
 
 namespace igx {
 
@@ -10,7 +11,8 @@ namespace igx {
 		" triangles",
 		" spheres",
 		" cubes",
-		" planes"
+		" planes",
+		" instances"
 	};
 
 	static constexpr usz sceneObjectStrides[u8(SceneObjectType::COUNT)] = {
@@ -19,48 +21,87 @@ namespace igx {
 		sizeof(Triangle),
 		sizeof(Sphere),
 		sizeof(Cube),
-		sizeof(Plane)
+		sizeof(Plane),
+		sizeof(Instance)
 	};
 
-	struct SceneGraph::Inspection {
+	//Multiple of 64, so chunks line up with the words of the dirty bitset
 
-		GPUBufferRef lightBuffer, sphereBuffer;
-		GPUBufferRef sceneData;
+	static constexpr u32 updateChunkSize = 65536;
 
-		Buffer &cpuLight, &cpuSphere;
+	static constexpr bool sceneObjectIsGeometry[u8(SceneObjectType::COUNT)] = {
+		false,
+		false,
+		true,
+		true,
+		true,
+		true,
+		true
+	};
 
-		Inspection(
-			const GPUBufferRef &lightBuffer, const GPUBufferRef &sphereBuffer, const GPUBufferRef &sceneData,
-			Buffer &cpuLight, Buffer &cpuSphere
-		) :
-			lightBuffer(lightBuffer), sphereBuffer(sphereBuffer), sceneData(sceneData),
-			cpuLight(cpuLight), cpuSphere(cpuSphere) {}
+	//Planes are infinite, so they're not in the BVH
 
-		InflectBody(
+	static constexpr bool sceneObjectInBVH[u8(SceneObjectType::COUNT)] = {
+		false,
+		false,
+		true,
+		true,
+		true,
+		false,
+		true
+	};
+
+	//Instances are added after the scene graph is created, so they start small
+
+	static constexpr u32 initialInstances = 64;
+
+	struct SceneGraph::Inspection {
 
-			SceneGraphInfo &sgi = *sceneData->getBuffer<SceneGraphInfo>();
+		SceneGraph &scene;
+
+		Inspection(SceneGraph &scene): scene(scene) {}
+
+		InflectBody(
 
 			static const List<String> namesOfArgs = { "Lights", "Spheres" };
 
+			const Object &lights = scene.objects[u8(SceneObjectType::LIGHT)];
+			const Object &spheres = scene.objects[u8(SceneObjectType::SPHERE)];
+
+			u32 lightCount = scene.info.lightCount, sphereCount = scene.info.sphereCount;
+
 			if constexpr(std::is_const_v<decltype(*this)>)
 				inflector.inflect(
 					this, recursion, namesOfArgs, 
-					oic::ListRef<const Light>((const Light*) cpuLight.data(), sgi.lightCount),
-					oic::ListRef<const Sphere>((const Sphere*) cpuSphere.data(), sgi.sphereCount)
+					oic::ListRef<const Light>((const Light*) lights.data, lightCount),
+					oic::ListRef<const Sphere>((const Sphere*) spheres.data, sphereCount)
 				);
 
-			else
+			//Edits go straight into the objects, so compare them to find out what has to be flushed
+
+			else {
+
+				List<Light> lightsBefore((const Light*) lights.data, (const Light*) lights.data + lightCount);
+				List<Sphere> spheresBefore((const Sphere*) spheres.data, (const Sphere*) spheres.data + sphereCount);
+
 				inflector.inflect(
 					this, recursion, namesOfArgs, 
-					oic::ListRef<Light>((Light*) cpuLight.data(), sgi.lightCount),
-					oic::ListRef<Sphere>((Sphere*) cpuSphere.data(), sgi.sphereCount)
+					oic::ListRef<Light>((Light*) lights.data, lightCount),
+					oic::ListRef<Sphere>((Sphere*) spheres.data, sphereCount)
 				);
+
+				scene.applyInspection(SceneObjectType::LIGHT, (const u8*) lightsBefore.data());
+				scene.applyInspection(SceneObjectType::SPHERE, (const u8*) spheresBefore.data());
+			}
 		);
 
 	};
 
 	SceneGraph::~SceneGraph() {
 
+		if (bvhRebuild.thread.joinable())
+			bvhRebuild.thread.join();
+
 		delete (ui::StructInspector<Inspection>*) inspector;
 		inspector = {};
 
@@ -78,64 +119,50 @@ namespace igx {
 		u32 maxCubes,
 		u32 maxSpheres,
 		u32 maxPlanes,
-		Flags flags
+		Flags flags,
+		u8 framesInFlight
 	):
 		gui(gui),
 		factory(factory),
 		flags(flags),
-		limits {
-			{
-				maxTriangles,
-				maxLights,
-				maxMaterials,
-				maxCubes,
-				maxSpheres,
-				maxPlanes
-			}
-		}
+		sceneName(sceneName)
 	{
+		//In place editing writes to the buffer the gpu reads, which only one frame in flight allows
+
+		if (HasFlags(flags, Flags::IN_PLACE) && framesInFlight != 1) {
+			oic::System::log()->error("SceneGraph IN_PLACE requires 1 frame in flight; keeping a cpu copy instead");
+			this->flags = Flags(u32(flags) & ~u32(Flags::IN_PLACE));
+		}
+
 		if(skyboxName.size())
 			skybox = {
 				factory.getGraphics(), NAME(sceneName + " skybox"),
 				igxi::Helper::loadDiskExternal(skyboxName, factory.getGraphics())
 			};
 
-		u32 totalObjectCount{};
+		//Every frame in flight reads its own copy of the scene
 
-		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+		descriptors.resize(framesInFlight);
 
-			u32 objectCount = limits.objectCount[u8(type)];
+		const u32 capacities[u8(SceneObjectType::COUNT)] = {
+			maxLights, maxMaterials, maxTriangles, maxSpheres, maxCubes, maxPlanes, initialInstances
+		};
 
-			if (objectCount == 0)
-				continue;
+		u64 geometryCapacity{};
 
-			oicAssert("Only up to 4B primitives supported in scene graph", totalObjectCount < totalObjectCount + objectCount);
+		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
 
-			totalObjectCount += objectCount;
+			if (sceneObjectIsGeometry[u8(type)])
+				geometryCapacity += capacities[u8(type)];
 
-			objects[u8(type)] = Object {
-				GPUBufferRef(
-					factory.getGraphics(), NAME(sceneName + sceneObjectNames[u8(type)]),
-					GPUBuffer::Info(
-						objectCount * sceneObjectStrides[u8(type)], GPUBufferUsage::STORAGE,
-						GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
-					)
-				),
-				Buffer(objectCount * sceneObjectStrides[u8(type)]),
-				List<bool>(objectCount),
-				List<u64>(objectCount)
-			};
+			if (capacities[u8(type)])
+				resizeObjects(type, capacities[u8(type)]);
 		}
 
-		materialIndices = {
-			factory.getGraphics(), NAME("Scene material indices"),
-			GPUBuffer::Info(
-				totalObjectCount * sizeof(u32), GPUBufferUsage::STORAGE,
-				GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
-			)
-		};
+		oicAssert("Only up to 4B primitives supported in scene graph", geometryCapacity <= u32_MAX);
 
-		materialByObject = (u32*) materialIndices->getBuffer();
+		resizeMaterialIndices();
+		resizeMaterialRemap();
 
 		linear = factory.get(NAME("Linear clampborder sampler"), Sampler::Info(
 			SamplerMin::LINEAR, SamplerMag::LINEAR, SamplerMode::CLAMP_BORDER, 1.f
@@ -145,39 +172,26 @@ namespace igx {
 			getLayout()
 		));
 
-		sceneData = {
-			factory.getGraphics(), NAME("Scene data"),
+		sceneData = MultiBuffer(
+			factory.getGraphics(), "Scene data",
 			GPUBuffer::Info(
 				sizeof(SceneGraphInfo), GPUBufferUsage::STORAGE_UNIFORM, 
 				GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
-			)
-		};
+			),
+			framesInFlight
+		);
 
-		info = (SceneGraphInfo*) sceneData->getBuffer();
-
-		GPUBufferRef &lightBuffer = objects[u8(SceneObjectType::LIGHT)].buffer;
-		GPUBufferRef &sphereBuffer = objects[u8(SceneObjectType::SPHERE)].buffer;
-		Buffer &lightCpu = objects[u8(SceneObjectType::LIGHT)].cpuData;
-		Buffer &sphereCpu = objects[u8(SceneObjectType::SPHERE)].cpuData;
-
-		descriptors = {
-			factory.getGraphics(), NAME(sceneName + " descriptors"),
-			Descriptors::Info(
-				layout, 1, Descriptors::Subresources{
-					{ 1, GPUSubresource(sceneData, GPUBufferType::UNIFORM) },
-					{ 2, GPUSubresource(objects[u8(SceneObjectType::TRIANGLE)].buffer, GPUBufferType::STORAGE) },
-					{ 3, GPUSubresource(sphereBuffer, GPUBufferType::STORAGE) },
-					{ 4, GPUSubresource(objects[u8(SceneObjectType::CUBE)].buffer, GPUBufferType::STORAGE) },
-					{ 5, GPUSubresource(objects[u8(SceneObjectType::PLANE)].buffer, GPUBufferType::STORAGE) },
-					{ 6, GPUSubresource(lightBuffer, GPUBufferType::STORAGE) },
-					{ 7, GPUSubresource(objects[u8(SceneObjectType::MATERIAL)].buffer, GPUBufferType::STORAGE) },
-					{ 8, GPUSubresource(materialIndices, GPUBufferType::STORAGE) },
-					{ 9, GPUSubresource(linear, skybox, TextureType::TEXTURE_2D) }
-				}
-			)
-		};
+		uploadBVH(bvhNodes, bvhNodeCapacity, "Scene BVH nodes", nullptr, 0);
+		uploadBVH(bvhPrimitives, bvhPrimitiveCapacity, "Scene BVH primitives", nullptr, 0);
+		uploadBVH(lightTreeNodes, lightTreeNodeCapacity, "Scene light tree nodes", nullptr, 0);
+		uploadBVH(lightTreeEmitters, lightTreeEmitterCapacity, "Scene light tree emitters", nullptr, 0);
+		uploadMeshes();
+
+		createDescriptors();
 
-		inspector = new ui::StructInspector<Inspection>(Inspection(lightBuffer, sphereBuffer, sceneData, lightCpu, sphereCpu));
+		inspector = new ui::StructInspector<Inspection>(
+			Inspection(*this)
+		);
 
 		gui.addWindow(ui::Window(
 			"Scene graph", 0, Vec2f32(), Vec2f32(300, 400), 
@@ -186,339 +200,2194 @@ namespace igx {
 		));
 	}
 
-	const List<RegisterLayout> &SceneGraph::getLayout() {
-		
-		static const List<RegisterLayout> layout = {
+	bool SceneGraph::reserve(SceneObjectType type, u32 capacity) {
 
-			//Uniforms
+		if (type >= SceneObjectType::COUNT)
+			return false;
 
-			RegisterLayout(
-				NAME("CameraData"), 0, GPUBufferType::UNIFORM, 0, 0,
-				ShaderAccess::COMPUTE, sizeof(Camera)
-			),
+		if (capacity <= limits.objectCount[u8(type)])
+			return true;
 
-			RegisterLayout(
-				NAME("SceneData"), 1, GPUBufferType::UNIFORM, 1, 1,
-				ShaderAccess::COMPUTE, sizeof(SceneGraphInfo)
-			),
+		//Geometry shares the material indices, which are indexed by u32
 
-			//SSBOs
+		if (sceneObjectIsGeometry[u8(type)]) {
 
-			RegisterLayout(
-				NAME("Triangles"), 2, GPUBufferType::STRUCTURED, 0, 1,
-				ShaderAccess::COMPUTE, sizeof(Triangle)
-			),
+			u64 geometryCapacity = capacity;
 
-			RegisterLayout(
-				NAME("Spheres"), 3, GPUBufferType::STRUCTURED, 1, 1,
-				ShaderAccess::COMPUTE, sizeof(Sphere)
-			),
+			for (usz i = 0; i < usz(SceneObjectType::COUNT); ++i)
+				if (sceneObjectIsGeometry[i] && i != usz(type))
+					geometryCapacity += limits.objectCount[i];
 
-			RegisterLayout(
-				NAME("Cubes"), 4, GPUBufferType::STRUCTURED, 2, 1,
-				ShaderAccess::COMPUTE, sizeof(Cube)
-			),
+			if (geometryCapacity > u32_MAX) {
+				oic::System::log()->error("SceneGraph::reserve exceeds the 4B primitives supported in a scene graph");
+				return false;
+			}
+		}
 
-			RegisterLayout(
-				NAME("Planes"), 5, GPUBufferType::STRUCTURED, 3, 1,
-				ShaderAccess::COMPUTE, sizeof(Plane)
-			),
+		resizeObjects(type, capacity);
 
-			RegisterLayout(
-				NAME("Lights"), 6, GPUBufferType::STRUCTURED, 4, 1,
-				ShaderAccess::COMPUTE, sizeof(Light)
-			),
+		if (sceneObjectIsGeometry[u8(type)])
+			resizeMaterialIndices();
 
-			RegisterLayout(
-				NAME("Materials"), 7, GPUBufferType::STRUCTURED, 5, 1,
-				ShaderAccess::COMPUTE, sizeof(Material)
-			),
+		else if (type == SceneObjectType::MATERIAL)
+			resizeMaterialRemap();
 
-			RegisterLayout(
-				NAME("Material indices"), 8, GPUBufferType::STRUCTURED, 6, 1,
-				ShaderAccess::COMPUTE, sizeof(u32)
-			),
+		descriptorsOutdated = true;
+		return true;
+	}
 
-			//Skybox
+	bool SceneGraph::grow(SceneObjectType type, usz required) {
 
-			RegisterLayout(
-				NAME("Skybox"), 9, SamplerType::SAMPLER_2D, 0, 1,
-				ShaderAccess::COMPUTE
-			)
-		};
+		u32 capacity = limits.objectCount[u8(type)];
 
-		return layout;
-	}
+		if (required <= capacity)
+			return true;
 
-	void SceneGraph::fillCommandList(CommandList *cl) {
+		if (required > u32_MAX)
+			return false;
 
-		cl->add(
-			FlushImage(skybox, factory.getDefaultUploadBuffer()),
-			FlushBuffer(sceneData, factory.getDefaultUploadBuffer()),
-			FlushBuffer(materialIndices, factory.getDefaultUploadBuffer())
-		);
+		//Doubling keeps the cost of copying amortized per added object
 
-		for (auto &obj : objects)
-			cl->add(
-				FlushBuffer(obj.buffer, factory.getDefaultUploadBuffer())
-			);
+		static constexpr usz minCapacity = 64;
+
+		usz target = std::max(std::max(usz(capacity) * 2, minCapacity), required);
+		return reserve(type, u32(std::min(target, usz(u32_MAX))));
 	}
 
-	void SceneGraph::update(f64) {
+	void SceneGraph::resizeObjects(SceneObjectType type, u32 capacity) {
 
-		geometryId = 0;
+		Object &obj = objects[u8(type)];
+		usz stride = sceneObjectStrides[u8(type)];
+		u32 &limit = limits.objectCount[u8(type)];
+		usz used = usz(info.objectCount[u8(type)]) * stride;
 
-		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+		bool inPlace = HasFlags(flags, Flags::IN_PLACE);
 
-			//Ensure it's all one array
+		if (!inPlace) {
+			obj.cpuData.resize(usz(capacity) * stride);
+			obj.data = obj.cpuData.data();
+		}
 
-			compact(type);
+		MultiBuffer buffer(
+			factory.getGraphics(), sceneName + sceneObjectNames[u8(type)],
+			GPUBuffer::Info(
+				usz(capacity) * stride, GPUBufferUsage::STORAGE,
+				GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
+			),
+			descriptors.size()
+		);
 
-			//Flush regions that are modified to gpu
+		//Copy before the old buffer is released, since it might be where the objects live
 
-			Object &obj = objects[u8(type)];
-			usz stride = sceneObjectStrides[u8(type)];
+		buffer.copyFrom(obj.data, used);
 
-			u32 prevMarked = u32_MAX, i = 0;
+		retire(std::move(obj.buffer));
+		obj.buffer = std::move(buffer);
 
-			for (; i < info->objectCount[u8(type)]; ++i)
+		if (inPlace) {
+			obj.data = obj.buffer.getBuffer(0);
+			hostBytesSaved += usz(capacity - limit) * stride;
+		}
 
-				if (prevMarked == u32_MAX) {
+		obj.markedForUpdate.resize(capacity);
+		obj.materialsChanged.resize(capacity);
+		obj.toIndex.resize(capacity);
 
-					if (obj.markedForUpdate[i])
-						prevMarked = i;
-				}
+		limit = capacity;
+	}
 
-				else if (!obj.markedForUpdate[i]) {
+	void SceneGraph::resizeMaterialIndices() {
 
-					//Ensure data is in our other cpu copy
-					//Not our intermediate
+		u32 capacity{};
 
-					std::memcpy(
-						obj.buffer->getBuffer() + stride * prevMarked,
-						obj.cpuData.data() + stride * prevMarked,
-						(i - prevMarked) * stride
-					);
+		for (usz i = 0; i < usz(SceneObjectType::COUNT); ++i)
+			if (sceneObjectIsGeometry[i])
+				capacity += limits.objectCount[i];
 
-					obj.buffer->flush(stride * prevMarked, (i - prevMarked) * stride);
-				}
+		//Always allocate one, so the descriptor can be bound
 
-			//Left over
+		capacity = std::max(capacity, 1u);
 
-			if (prevMarked != u32_MAX) {
+		if (capacity == materialCapacity)
+			return;
 
-				std::memcpy(
-					obj.buffer->getBuffer() + stride * prevMarked,
-					obj.cpuData.data() + stride * prevMarked,
-					(i - prevMarked) * stride
-				);
+		bool inPlace = HasFlags(flags, Flags::IN_PLACE);
+		usz used = usz(std::min(capacity, materialCapacity)) * sizeof(u32);
 
-				obj.buffer->flush(stride * prevMarked, (i - prevMarked) * stride);
-			}
+		if (!inPlace) {
+			materialCpu.resize(capacity);
+			materialByObject = materialCpu.data();
 		}
 
-		//It's just a few bytes, can be flushed, the check isn't really needed
+		MultiBuffer buffer(
+			factory.getGraphics(), "Scene material indices",
+			GPUBuffer::Info(
+				usz(capacity) * sizeof(u32), GPUBufferUsage::STORAGE,
+				GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
+			),
+			descriptors.size()
+		);
+
+		buffer.copyFrom((const u8*) materialByObject, used);
+		retire(std::move(materialIndices));
+		materialIndices = std::move(buffer);
+
+		if (inPlace) {
+			materialByObject = (u32*) materialIndices.getBuffer(0);
+			hostBytesSaved += usz(capacity - materialCapacity) * sizeof(u32);
+		}
 
-		sceneData->flush(0, sizeof(*info));
+		materialCapacity = capacity;
 	}
 
-	void SceneGraph::del(const List<u64> &ids) {
-	
-		for (u64 i : ids) {
+	void SceneGraph::resizeMaterialRemap() {
 
-			auto it = find(i);
+		//Always allocate one, so the descriptor can be bound
 
-			if (it == entries.end())
-				continue;
+		u32 capacity = std::max(limits.materialCount, 1u);
+		u32 old = u32(materialRemap.size());
 
-			u8 type = u8(it->second.type);
+		if (capacity <= old)
+			return;
 
-			objects[type].toIndex[it->second.index] = 0;
-			objects[type].markedForUpdate[it->second.index] = false;
-			entries.erase(it);
-		}
+		materialRemap.resize(capacity);
+
+		for (u32 i = old; i < capacity; ++i)
+			materialRemap[i] = i;
+
+		materialRemapDirty.resize(capacity);
+		materialHashes.resize(capacity);
+		materialReferences.resize(capacity);
+
+		MultiBuffer buffer(
+			factory.getGraphics(), "Scene material remap",
+			GPUBuffer::Info(
+				usz(capacity) * sizeof(u32), GPUBufferUsage::STORAGE,
+				GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
+			),
+			descriptors.size()
+		);
 
+		buffer.copyFrom((const u8*) materialRemap.data(), usz(capacity) * sizeof(u32));
+		retire(std::move(materialRemapBuffer));
+		materialRemapBuffer = std::move(buffer);
 	}
 
-	u64 SceneGraph::addInternal(SceneObjectType t, const void *v, usz siz, u32 mat) {
+	u32 SceneGraph::addMaterialHandle(u32 index) {
 
-		do {
-			++counter;
+		u32 handle;
+
+		if (freeMaterialHandles.size()) {
+			handle = freeMaterialHandles.back();
+			freeMaterialHandles.pop_back();
 		}
-		while(!counter || entries.find(counter) != entries.end());
 
-		isModified = true;
+		else handle = materialHandles++;
 
-		u32 &ind = info->objectCount[u8(t)];
-		Object &obj = objects[u8(t)];
+		materialRemap[handle] = index;
+		materialRemapDirty.set(handle);
+		return handle;
+	}
 
-		u32 i = 0;
+	//FNV-1a; materials don't have implicit padding, so equal materials have equal bytes
 
-		for (; i < ind; ++i)
-			if (!obj.toIndex[i])
-				break;
+	static inline u64 hashMaterial(const Material &material) {
 
-		if (i == ind) {
+		const u8 *bytes = (const u8*) &material;
+		u64 hash = 0xCBF29CE484222325;
 
-			if (info->objectCount[u8(t)] == limits.objectCount[u8(t)])
-				return 0;
+		for (usz i = 0; i < sizeof(Material); ++i)
+			hash = (hash ^ bytes[i]) * 0x100000001B3;
 
-			++ind;
-		}
+		return hash;
+	}
 
-		entries[counter] = { i, mat, t };
-		obj.markedForUpdate[i] = true;
-		obj.toIndex[i] = counter;
+	u64 SceneGraph::findMaterial(u64 hash, const Material &material) const {
 
-		std::memcpy(obj.cpuData.data() + siz * i, v, siz);
+		auto it = materialsByHash.find(hash);
 
-		return counter;
+		if (it == materialsByHash.end())
+			return 0;
+
+		const Entry *entry = find(it->second);
+
+		if (!entry)
+			return 0;
+
+		const Material *existing = (const Material*) objects[u8(SceneObjectType::MATERIAL)].data + entry->index;
+		return std::memcmp(existing, &material, sizeof(Material)) == 0 ? it->second : 0;
 	}
 
-	void SceneGraph::compact(SceneObjectType type) {
+	void SceneGraph::internMaterial(u64 id) {
 
-		u32 j{};
+		const Entry *entry = find(id);
 
-		auto &obj = objects[u8(type)];
-		usz stride = sceneObjectStrides[u8(type)];
-		u32 &count = info->objectCount[u8(type)];
+		if (!entry || entry->type != SceneObjectType::MATERIAL)
+			return;
 
-		u8 *cpuPtr = obj.cpuData.data();
-		u8 *gpuPtr = obj.buffer->getBuffer();
+		u64 hash = hashMaterial(((const Material*) objects[u8(SceneObjectType::MATERIAL)].data)[entry->index]);
 
-		bool needsRemap{};
+		materialHashes[entry->material] = hash;
+		materialsByHash.try_emplace(hash, id);
+	}
 
-		switch (type) {
-			
-			//Light has to sort by type as well as eliminate dead space
+	void SceneGraph::forgetMaterial(u64 id) {
 
-			case SceneObjectType::LIGHT: {
+		const Entry *entry = find(id);
 
-				u32 counters[LightType::count]{}, counters0[LightType::count]{};
-				Light *lc = (Light*) cpuPtr;
+		if (!entry || entry->type != SceneObjectType::MATERIAL)
+			return;
 
-				//Detect if dead space exists or indices changed (e.g. light type changed)
-				//otherwise don't mark dirty
-				//Also count light types
+		auto it = materialsByHash.find(materialHashes[entry->material]);
 
-				for (u32 i = 0; i < count; ++i) {
+		if (it != materialsByHash.end() && it->second == id)
+			materialsByHash.erase(it);
+	}
 
-					if (!obj.toIndex[i]) {
-						needsRemap = true;
-						continue;
-					}
+	u32 SceneGraph::getMaterialHandle(u64 material) const {
+		const Entry *entry = find(material);
+		return entry && entry->type == SceneObjectType::MATERIAL ? entry->material : u32_MAX;
+	}
 
-					++j;
-					++counters[lc[i].type.value];
-				}
+	usz SceneGraph::setMaterial(std::span<const u64> geometry, u32 material) {
 
-				for (usz i = 0; i < LightType::count; ++i)
-					if (info->lightsCount[i] != counters[i]) {
-						info->lightsCount[i] = counters[i];
-						needsRemap = true;
-					}
+		usz valid{};
+
+		for (u64 id : geometry) {
 
-				if (!needsRemap)
-					return;
+			Entry *entry = lookup(id);
 
-				//Remap to ensure our dead space doesn't exist on the gpu
-				//And to make sure the point lights are after spot and after directional lights
+			if (!entry || !sceneObjectIsGeometry[u8(entry->type)])
+				continue;
+
+			++valid;
 
-				for (u32 i = 0; i < count; ++i) {
+			if (entry->material == material)
+				continue;
 
-					u64 id = obj.toIndex[i];
+			entry->material = material;
+			objects[u8(entry->type)].materialsChanged.set(entry->index);
+			isModified = true;
+		}
 
-					if (!id)
-						continue;
+		return valid;
+	}
 
-					usz lightTypeId = usz(lc[i].type.value);
-					u32 &localId = counters0[lightTypeId];
+	void SceneGraph::createDescriptors() {
 
-					u32 globalId = localId;
+		usz frames = descriptors.size();
+		Retired &old = getRetired();
 
-					for (usz k = 0; k < lightTypeId; ++k)
-						globalId += counters[k];
+		for (usz i = 0; i < frames; ++i) {
 
-					++localId;
+			if (descriptors[i].exists())
+				old.descriptors.push_back(descriptors[i]);
 
-					obj.toIndex[globalId] = id;
+			auto buffer = [this, i](SceneObjectType type) -> GPUBufferRef {
+				auto &buf = objects[u8(type)].buffer;
+				return buf.frames() ? buf[i] : GPUBufferRef{};
+			};
 
-					if (entries[id].index != globalId) {
-						obj.markedForUpdate[i] = false;
-						obj.markedForUpdate[globalId] = true;
-						entries[id].index = globalId;
+			descriptors[i] = {
+				factory.getGraphics(), 
+				NAME(sceneName + " descriptors" + (frames == 1 ? "" : " #" + std::to_string(i))),
+				Descriptors::Info(
+					layout, 1, Descriptors::Subresources{
+						{ 1, GPUSubresource(sceneData[i], GPUBufferType::UNIFORM) },
+						{ 2, GPUSubresource(buffer(SceneObjectType::TRIANGLE), GPUBufferType::STORAGE) },
+						{ 3, GPUSubresource(buffer(SceneObjectType::SPHERE), GPUBufferType::STORAGE) },
+						{ 4, GPUSubresource(buffer(SceneObjectType::CUBE), GPUBufferType::STORAGE) },
+						{ 5, GPUSubresource(buffer(SceneObjectType::PLANE), GPUBufferType::STORAGE) },
+						{ 6, GPUSubresource(buffer(SceneObjectType::LIGHT), GPUBufferType::STORAGE) },
+						{ 7, GPUSubresource(buffer(SceneObjectType::MATERIAL), GPUBufferType::STORAGE) },
+						{ 8, GPUSubresource(materialIndices[i], GPUBufferType::STORAGE) },
+						{ 9, GPUSubresource(linear, skybox, TextureType::TEXTURE_2D) },
+						{ 10, GPUSubresource(bvhNodes[i], GPUBufferType::STORAGE) },
+						{ 11, GPUSubresource(bvhPrimitives[i], GPUBufferType::STORAGE) },
+						{ 12, GPUSubresource(buffer(SceneObjectType::INSTANCE), GPUBufferType::STORAGE) },
+						{ 13, GPUSubresource(meshBuffer[i], GPUBufferType::STORAGE) },
+						{ 14, GPUSubresource(meshTriangleBuffer[i], GPUBufferType::STORAGE) },
+						{ 15, GPUSubresource(meshNodeBuffer[i], GPUBufferType::STORAGE) },
+						{ 16, GPUSubresource(lightTreeNodes[i], GPUBufferType::STORAGE) },
+						{ 17, GPUSubresource(lightTreeEmitters[i], GPUBufferType::STORAGE) },
+						{ 18, GPUSubresource(materialRemapBuffer[i], GPUBufferType::STORAGE) },
+						{ 19, GPUSubresource(meshVertexBuffer[i], GPUBufferType::STORAGE) },
+						{ 20, GPUSubresource(meshIndexBuffer[i], GPUBufferType::STORAGE) }
 					}
+				)
+			};
+		}
 
-					std::memcpy(gpuPtr + globalId * stride, cpuPtr + i * stride, stride);
-				}
+		descriptorsOutdated = false;
+	}
 
-				break;
-			}
+	SceneGraph::Retired &SceneGraph::getRetired() {
 
-			//Normal types just need to eliminate dead space
+		if (retired.empty() || retired.back().update != updates)
+			retired.push_back({ updates });
 
-			default:
+		return retired.back();
+	}
+
+	void SceneGraph::retire(MultiBuffer &&buffer) {
+		if (buffer.frames())
+			getRetired().buffers.push_back(std::move(buffer));
+	}
+
+	const List<RegisterLayout> &SceneGraph::getLayout() {
+		
+		static const List<RegisterLayout> layout = {
+
+			//Uniforms
+
+			RegisterLayout(
+				NAME("CameraData"), 0, GPUBufferType::UNIFORM, 0, 0,
+				ShaderAccess::COMPUTE, sizeof(Camera)
+			),
+
+			RegisterLayout(
+				NAME("SceneData"), 1, GPUBufferType::UNIFORM, 1, 1,
+				ShaderAccess::COMPUTE, sizeof(SceneGraphInfo)
+			),
 
-				//Detect if dead space exists, otherwise don't mark dirty
+			//SSBOs
+
+			RegisterLayout(
+				NAME("Triangles"), 2, GPUBufferType::STRUCTURED, 0, 1,
+				ShaderAccess::COMPUTE, sizeof(Triangle)
+			),
 
-				for (u32 i = 0; i < count; ++i) {
+			RegisterLayout(
+				NAME("Spheres"), 3, GPUBufferType::STRUCTURED, 1, 1,
+				ShaderAccess::COMPUTE, sizeof(Sphere)
+			),
 
-					u64 id = obj.toIndex[i];
+			RegisterLayout(
+				NAME("Cubes"), 4, GPUBufferType::STRUCTURED, 2, 1,
+				ShaderAccess::COMPUTE, sizeof(Cube)
+			),
 
-					//TODO: Update all geometry if the material ids change
+			RegisterLayout(
+				NAME("Planes"), 5, GPUBufferType::STRUCTURED, 3, 1,
+				ShaderAccess::COMPUTE, sizeof(Plane)
+			),
 
-					if (!id) {
+			RegisterLayout(
+				NAME("Lights"), 6, GPUBufferType::STRUCTURED, 4, 1,
+				ShaderAccess::COMPUTE, sizeof(Light)
+			),
 
-						//TODO: Change material of geometries to 0
+			RegisterLayout(
+				NAME("Materials"), 7, GPUBufferType::STRUCTURED, 5, 1,
+				ShaderAccess::COMPUTE, sizeof(Material)
+			),
 
-						needsRemap = true;
-						continue;
-					}
+			RegisterLayout(
+				NAME("Material indices"), 8, GPUBufferType::STRUCTURED, 6, 1,
+				ShaderAccess::COMPUTE, sizeof(u32)
+			),
 
-					if (type != SceneObjectType::MATERIAL) {
+			//Skybox
 
-						u32 &dst = materialByObject[geometryId];
-						u32 src = entries[id].material;
+			RegisterLayout(
+				NAME("Skybox"), 9, SamplerType::SAMPLER_2D, 0, 1,
+				ShaderAccess::COMPUTE
+			),
 
-						if (dst != src) {
-							dst = src;
-							materialIndices->flush(geometryId * sizeof(u32), sizeof(u32));
-						}
+			//Acceleration structure
 
-						++geometryId;
-					}
-				}
+			RegisterLayout(
+				NAME("BVH nodes"), 10, GPUBufferType::STRUCTURED, 7, 1,
+				ShaderAccess::COMPUTE, sizeof(BVH::Node)
+			),
 
-				if (!needsRemap)
-					return;
+			RegisterLayout(
+				NAME("BVH primitives"), 11, GPUBufferType::STRUCTURED, 8, 1,
+				ShaderAccess::COMPUTE, sizeof(u32)
+			),
 
-				//Remap to ensure our dead space doesn't exist on the gpu
+			//Instanced meshes
 
-				for (u32 i = 0; i < count; ++i) {
+			RegisterLayout(
+				NAME("Instances"), 12, GPUBufferType::STRUCTURED, 9, 1,
+				ShaderAccess::COMPUTE, sizeof(Instance)
+			),
 
-					u64 id = obj.toIndex[i];
+			RegisterLayout(
+				NAME("Meshes"), 13, GPUBufferType::STRUCTURED, 10, 1,
+				ShaderAccess::COMPUTE, sizeof(MeshInfo)
+			),
 
-					if (!id)
-						continue;
+			RegisterLayout(
+				NAME("Mesh triangles"), 14, GPUBufferType::STRUCTURED, 11, 1,
+				ShaderAccess::COMPUTE, sizeof(Triangle)
+			),
 
-					obj.toIndex[j] = id;
+			RegisterLayout(
+				NAME("Mesh BVH nodes"), 15, GPUBufferType::STRUCTURED, 12, 1,
+				ShaderAccess::COMPUTE, sizeof(BVH::Node)
+			),
 
-					if (entries[id].index != j) {
-						obj.markedForUpdate[i] = false;
-						obj.markedForUpdate[j] = true;
-						entries[id].index = j;
-					}
+			//Light selection
 
-					std::memcpy(gpuPtr + j * stride, cpuPtr + i * stride, stride);
-					++j;
-				}
-		}
+			RegisterLayout(
+				NAME("Light tree nodes"), 16, GPUBufferType::STRUCTURED, 13, 1,
+				ShaderAccess::COMPUTE, sizeof(LightTree::Node)
+			),
 
+			RegisterLayout(
+				NAME("Light tree emitters"), 17, GPUBufferType::STRUCTURED, 14, 1,
+				ShaderAccess::COMPUTE, sizeof(LightTree::Emitter)
+			),
 
-		//Keep the same order on the CPU as well
+			//Material indices are handles, so they go through the remap
 
-		count = j;
-		std::memcpy(cpuPtr, gpuPtr, j * stride);
+			RegisterLayout(
+				NAME("Material remap"), 18, GPUBufferType::STRUCTURED, 15, 1,
+				ShaderAccess::COMPUTE, sizeof(u32)
+			),
+
+			//Indexed meshes
+
+			RegisterLayout(
+				NAME("Mesh vertices"), 19, GPUBufferType::STRUCTURED, 16, 1,
+				ShaderAccess::COMPUTE, sizeof(QuantizedVertex)
+			),
+
+			RegisterLayout(
+				NAME("Mesh indices"), 20, GPUBufferType::STRUCTURED, 17, 1,
+				ShaderAccess::COMPUTE, sizeof(u32)
+			)
+		};
+
+		return layout;
+	}
+
+	void SceneGraph::fillCommandList(CommandList *cl, usz frameId) {
+
+		cl->add(
+			FlushImage(skybox, factory.getDefaultUploadBuffer()),
+			FlushBuffer(sceneData[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(materialIndices[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(bvhNodes[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(bvhPrimitives[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(meshBuffer[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(meshTriangleBuffer[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(meshNodeBuffer[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(meshVertexBuffer[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(meshIndexBuffer[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(lightTreeNodes[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(lightTreeEmitters[frameId], factory.getDefaultUploadBuffer()),
+			FlushBuffer(materialRemapBuffer[frameId], factory.getDefaultUploadBuffer())
+		);
+
+		for (auto &obj : objects)
+			if (obj.buffer.frames())
+				cl->add(
+					FlushBuffer(obj.buffer[frameId], factory.getDefaultUploadBuffer())
+				);
+	}
+
+	void SceneGraph::update(f64) {
+
+		WorkerPool &workers = factory.getWorkers();
+
+		//Write to the frame that was used the longest ago
+
+		frame = (frame + 1) % descriptors.size();
+
+		//Every frame that could use what was replaced before the last frames in flight is done now
+
+		++updates;
+
+		while (retired.size() && retired.front().update + descriptors.size() <= updates)
+			retired.erase(retired.begin());
+
+		//Ensure it's all one array
+		//Lights are kept sorted on every edit, so they never have holes
+		//Types don't share any objects, so they can be compacted in parallel
+
+		//Compaction moves geometry, which changes the ids the BVH refers to
+
+		for (usz i = 0; i < usz(SceneObjectType::COUNT); ++i)
+			if (objects[i].needsCompaction && sceneObjectInBVH[i])
+				bvhOutdated = true;
+
+		workers.parallelFor(usz(SceneObjectType::COUNT), [this](usz i) {
+
+			SceneObjectType type = SceneObjectType(i);
+
+			if (!objects[i].needsCompaction)
+				return;
+
+			if (type == SceneObjectType::LIGHT)
+				compact(type);
+
+			else if (type != SceneObjectType::MATERIAL)
+				compactIncremental(type);
+		});
+
+		//Geometry types are laid out one after the other in the material indices
+		//Split the types into chunks, so big types are spread over the workers too
+
+		geometryId = 0;
+		usz chunks{};
+
+		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+
+			Object &obj = objects[u8(type)];
+			u32 count = info.objectCount[u8(type)];
+
+			if (sceneObjectIsGeometry[u8(type)]) {
+
+				obj.remapMaterials = obj.materialOffset != geometryId;
+
+				//Leaves refer to geometry by where it is in the material indices
+
+				if (obj.remapMaterials)
+					bvhOutdated = true;
+
+				obj.materialOffset = geometryId;
+				geometryId += count;
+			}
+
+			obj.updatedCount = count;
+
+			for (u32 begin = 0; begin < count; begin += updateChunkSize) {
+
+				if (chunks == updateChunks.size())
+					updateChunks.emplace_back();
+
+				UpdateChunk &chunk = updateChunks[chunks++];
+				chunk.type = type;
+				chunk.begin = begin;
+				chunk.end = std::min(count, begin + updateChunkSize);
+				chunk.objectFlushes.clear();
+				chunk.materialFlushes.clear();
+				chunk.stats = {};
+			}
+		}
+
+		workers.parallelFor(chunks, [this](usz i) {
+
+			UpdateChunk &chunk = updateChunks[i];
+
+			if (sceneObjectIsGeometry[u8(chunk.type)])
+				updateMaterialIndices(chunk);
+
+			updateObjects(chunk);
+		});
+
+		//Flush regions that are modified to gpu
+
+		for (auto &stats : flushStats)
+			stats = {};
+
+		u8 *materialTarget = materialIndices.getBuffer(frame);
+		const u8 *materialSource = (const u8*) materialByObject;
+
+		//Types are consecutive in the material indices, so runs can continue into the next chunk
+
+		Pair<usz, usz> materialRun{};
+
+		auto flushMaterialRun = [&]() {
+
+			if (!materialRun.second)
+				return;
+
+			if (materialTarget != materialSource)
+				std::memcpy(materialTarget + materialRun.first, materialSource + materialRun.first, materialRun.second);
+
+			materialIndices.flush(frame, materialRun.first, materialRun.second);
+			materialRun = {};
+		};
+
+		for (usz i = 0; i < chunks; ++i) {
+
+			UpdateChunk &chunk = updateChunks[i];
+			Object &obj = objects[u8(chunk.type)];
+
+			for (auto &range : chunk.objectFlushes)
+				obj.buffer.flush(frame, range.first, range.second);
+
+			for (auto &range : chunk.materialFlushes) {
+
+				if (materialRun.second && materialRun.first + materialRun.second == range.first) {
+					materialRun.second += range.second;
+					continue;
+				}
+
+				flushMaterialRun();
+				materialRun = range;
+			}
+
+			FlushStats &stats = flushStats[u8(chunk.type)];
+			stats.dirtyRanges += chunk.stats.dirtyRanges;
+			stats.flushedRanges += chunk.stats.flushedRanges;
+			stats.flushedBytes += chunk.stats.flushedBytes;
+		}
+
+		flushMaterialRun();
+
+		//Handles of materials that were added or moved
+
+		u8 *remapTarget = materialRemapBuffer.getBuffer(frame);
+		const u8 *remapSource = (const u8*) materialRemap.data();
+
+		materialRemapDirty.forEachMergedRange(
+			0, materialRemap.size(), flushRegionCost / sizeof(u32), [&](usz begin, usz end) {
+
+				usz offset = begin * sizeof(u32), size = (end - begin) * sizeof(u32);
+
+				std::memcpy(remapTarget + offset, remapSource + offset, size);
+				materialRemapBuffer.flush(frame, offset, size);
+			}
+		);
+
+		materialRemapDirty.clearAll();
+
+		//Needs the dirty objects, so has to happen before they're cleared
+		//Instances are bounded by their mesh, so meshes go first
+
+		uploadMeshes();
+		updateBVH();
+		updateLightTree();
+
+		//Copy what changed while this frame was in flight
+
+		for (auto &obj : objects) {
+
+			if (obj.buffer.frames())
+				obj.buffer.catchUp(frame, obj.data);
+
+			obj.markedForUpdate.clearAll();
+			obj.materialsChanged.clearAll();
+		}
+
+		materialIndices.catchUp(frame, materialSource);
+		materialRemapBuffer.catchUp(frame, remapSource);
+		bvhNodes.catchUp(frame, (const u8*) bvh.getNodes().data());
+		bvhPrimitives.catchUp(frame, (const u8*) bvh.getPrimitives().data());
+		meshBuffer.catchUp(frame, (const u8*) meshes.data());
+		meshTriangleBuffer.catchUp(frame, (const u8*) meshTriangles.data());
+		meshNodeBuffer.catchUp(frame, (const u8*) meshNodes.data());
+		meshVertexBuffer.catchUp(frame, (const u8*) meshVertices.data());
+		meshIndexBuffer.catchUp(frame, (const u8*) meshIndices.data());
+		lightTreeNodes.catchUp(frame, (const u8*) lightTree.getNodes().data());
+		lightTreeEmitters.catchUp(frame, (const u8*) lightTree.getEmitters().data());
+
+		//It's just a few bytes, can be flushed, the check isn't really needed
+		//It's also written every update, so it doesn't need to be carried to other frames
+
+		std::memcpy(sceneData.getBuffer(frame), &info, sizeof(info));
+		sceneData[frame]->flush(0, sizeof(info));
+
+		//Buffers were reallocated, so the old descriptors point to stale buffers
+
+		if (descriptorsOutdated)
+			createDescriptors();
+	}
+
+	u32 SceneGraph::addMesh(std::span<const Triangle> triangles) {
+
+		if (triangles.empty())
+			return u32_MAX;
+
+		List<BVH::Primitive> input(triangles.size());
+
+		for (usz i = 0; i < triangles.size(); ++i) {
+
+			const Triangle &tri = triangles[i];
+			BVH::Primitive &prim = input[i];
+
+			prim.id = u32(i);
+			prim.min[0] = std::min({ tri.p0.x, tri.p1.x, tri.p2.x });
+			prim.min[1] = std::min({ tri.p0.y, tri.p1.y, tri.p2.y });
+			prim.min[2] = std::min({ tri.p0.z, tri.p1.z, tri.p2.z });
+			prim.max[0] = std::max({ tri.p0.x, tri.p1.x, tri.p2.x });
+			prim.max[1] = std::max({ tri.p0.y, tri.p1.y, tri.p2.y });
+			prim.max[2] = std::max({ tri.p0.z, tri.p1.z, tri.p2.z });
+		}
+
+		BVH meshBVH;
+		meshBVH.build(std::move(input), &factory.getWorkers());
+
+		//Triangles are stored in the order of the leaves, so the leaves can point to them directly
+
+		auto &order = meshBVH.getPrimitives();
+		auto &nodes = meshBVH.getNodes();
+
+		MeshInfo mesh {
+			u32(meshTriangles.size()), u32(triangles.size()),
+			u32(meshNodes.size()), u32(nodes.size())
+		};
+
+		meshTriangles.reserve(meshTriangles.size() + triangles.size());
+
+		for (u32 i : order)
+			meshTriangles.push_back(triangles[i]);
+
+		meshNodes.insert(meshNodes.end(), nodes.begin(), nodes.end());
+		meshes.push_back(mesh);
+
+		//Instances of this mesh could've been added before it existed
+
+		isModified = true;
+		bvhOutdated = true;
+		return u32(meshes.size() - 1);
+	}
+
+	//Indices of an indexed mesh have to be triples of its vertices
+
+	static inline bool checkMeshIndices(usz vertexCount, std::span<const u32> indices) {
+
+		if (indices.empty() || indices.size() % 3)
+			return false;
+
+		if (vertexCount > u32_MAX || indices.size() > u32_MAX) {
+			oic::System::log()->error("SceneGraph::addMesh only supports up to 4B vertices and indices");
+			return false;
+		}
+
+		for (u32 i : indices)
+			if (i >= vertexCount) {
+				oic::System::log()->error("SceneGraph::addMesh was passed an index that's out of bounds");
+				return false;
+			}
+
+		return true;
+	}
+
+	u32 SceneGraph::addMesh(std::span<const Vec3f32> positions, std::span<const Vec3f32> normals, std::span<const u32> indices) {
+
+		if ((normals.size() && normals.size() != positions.size()) || !checkMeshIndices(positions.size(), indices))
+			return u32_MAX;
+
+		u32 triangleCount = u32(indices.size() / 3);
+		u32 vertexCount = u32(positions.size());
+
+		MeshInfo mesh{};
+		mesh.firstVertex = u32(meshVertices.size());
+		mesh.vertexCount = vertexCount;
+
+		//Quantize within the bounds, so every axis uses the full 16 bits
+
+		f32 mi[3] = { positions[0].x, positions[0].y, positions[0].z }, ma[3] = { mi[0], mi[1], mi[2] };
+
+		for (const Vec3f32 &p : positions) {
+
+			const f32 c[3] = { p.x, p.y, p.z };
+
+			for (usz a = 0; a < 3; ++a) {
+				mi[a] = std::min(mi[a], c[a]);
+				ma[a] = std::max(ma[a], c[a]);
+			}
+		}
+
+		for (usz a = 0; a < 3; ++a) {
+			mesh.origin[a] = mi[a];
+			mesh.scale[a] = (ma[a] - mi[a]) / 65535;
+		}
+
+		//Without normals, every vertex gets the sum of the normals of its triangles (which are weighted by area)
+
+		//Normals can cancel out (or every triangle is degenerate), so the first face normal of the vertex is kept as well
+
+		List<Vec3f32> generated, faceNormals;
+
+		auto hasLength = [](const Vec3f32 &n) { return n.x * n.x + n.y * n.y + n.z * n.z > 0; };
+
+		if (normals.empty()) {
+
+			generated.resize(vertexCount);
+			faceNormals.resize(vertexCount);
+
+			for (u32 i = 0; i < triangleCount; ++i) {
+
+				const Vec3f32 &p0 = positions[indices[i * 3]];
+				Vec3f32 n = (positions[indices[i * 3 + 1]] - p0).cross(positions[indices[i * 3 + 2]] - p0);
+
+				for (u32 k = 0; k < 3; ++k) {
+
+					u32 v = indices[i * 3 + k];
+					generated[v] += n;
+
+					if (!hasLength(faceNormals[v]))
+						faceNormals[v] = n;
+				}
+			}
+
+			normals = generated;
+		}
+
+		meshVertices.reserve(meshVertices.size() + vertexCount);
+
+		//A zero length normal would turn into NaN, so it falls back to the face normal or +z
+
+		for (u32 i = 0; i < vertexCount; ++i) {
+
+			Vec3f32 n = normals[i];
+
+			if (!hasLength(n) && faceNormals.size())
+				n = faceNormals[i];
+
+			if (!hasLength(n))
+				n = Vec3f32(0, 0, 1);
+
+			meshVertices.push_back(mesh.quantize(positions[i], Vec3f32(n.normalize())));
+		}
+
+		return addIndexedMesh(mesh, indices);
+	}
+
+	u32 SceneGraph::addMesh(const MeshInfo &bounds, std::span<const QuantizedVertex> vertices, std::span<const u32> indices) {
+
+		if (!checkMeshIndices(vertices.size(), indices))
+			return u32_MAX;
+
+		MeshInfo mesh{};
+		mesh.firstVertex = u32(meshVertices.size());
+		mesh.vertexCount = u32(vertices.size());
+
+		std::memcpy(mesh.origin, bounds.origin, sizeof(mesh.origin));
+		std::memcpy(mesh.scale, bounds.scale, sizeof(mesh.scale));
+
+		meshVertices.insert(meshVertices.end(), vertices.begin(), vertices.end());
+		return addIndexedMesh(mesh, indices);
+	}
+
+	u32 SceneGraph::addIndexedMesh(MeshInfo &mesh, std::span<const u32> indices) {
+
+		u32 triangleCount = u32(indices.size() / 3);
+
+		mesh.triangleCount = triangleCount;
+		mesh.firstIndex = u32(meshIndices.size());
+		mesh.indexFormat = mesh.vertexCount <= 65536 ? MeshIndexFormat::U16 : MeshIndexFormat::U32;
+
+		//The BVH bounds the quantized positions, since those are what's intersected
+
+		const QuantizedVertex *vertices = meshVertices.data() + mesh.firstVertex;
+		List<BVH::Primitive> input(triangleCount);
+
+		for (u32 i = 0; i < triangleCount; ++i) {
+
+			Vec3f32 p0 = mesh.dequantize(vertices[indices[i * 3]]);
+			Vec3f32 p1 = mesh.dequantize(vertices[indices[i * 3 + 1]]);
+			Vec3f32 p2 = mesh.dequantize(vertices[indices[i * 3 + 2]]);
+
+			BVH::Primitive &prim = input[i];
+
+			prim.id = i;
+			prim.min[0] = std::min({ p0.x, p1.x, p2.x });
+			prim.min[1] = std::min({ p0.y, p1.y, p2.y });
+			prim.min[2] = std::min({ p0.z, p1.z, p2.z });
+			prim.max[0] = std::max({ p0.x, p1.x, p2.x });
+			prim.max[1] = std::max({ p0.y, p1.y, p2.y });
+			prim.max[2] = std::max({ p0.z, p1.z, p2.z });
+		}
+
+		BVH meshBVH;
+		meshBVH.build(std::move(input), &factory.getWorkers());
+
+		auto &order = meshBVH.getPrimitives();
+		auto &nodes = meshBVH.getNodes();
+
+		mesh.firstNode = u32(meshNodes.size());
+		mesh.nodeCount = u32(nodes.size());
+
+		//Triangles are stored in the order of the leaves, so the leaves can point to them directly
+
+		if (mesh.indexFormat == MeshIndexFormat::U16) {
+
+			meshIndices.resize(meshIndices.size() + (usz(triangleCount) * 3 + 1) / 2);
+			u32 *target = meshIndices.data() + mesh.firstIndex;
+
+			for (u32 i = 0; i < triangleCount; ++i)
+				for (u32 k = 0; k < 3; ++k) {
+					u32 j = i * 3 + k;
+					target[j / 2] |= indices[order[i] * 3 + k] << (j & 1) * 16;
+				}
+		}
+
+		else {
+
+			meshIndices.reserve(meshIndices.size() + usz(triangleCount) * 3);
+
+			for (u32 i : order)
+				for (u32 k = 0; k < 3; ++k)
+					meshIndices.push_back(indices[i * 3 + k]);
+		}
+
+		meshNodes.insert(meshNodes.end(), nodes.begin(), nodes.end());
+		meshes.push_back(mesh);
+
+		isModified = true;
+		bvhOutdated = true;
+		return u32(meshes.size() - 1);
+	}
+
+	void SceneGraph::uploadAppended(
+		MultiBuffer &buffer, usz &capacity, const String &name, const u8 *data, usz &uploaded, usz size
+	) {
+
+		//Reallocated buffers aren't used by any frame yet, so all of them can be written
+
+		if (!buffer.frames() || size > capacity) {
+
+			capacity = std::max(std::max(size, capacity * 2), usz(4096));
+
+			retire(std::move(buffer));
+
+			buffer = MultiBuffer(
+				factory.getGraphics(), name,
+				GPUBuffer::Info(
+					capacity, GPUBufferUsage::STORAGE,
+					GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
+				),
+				descriptors.size()
+			);
+
+			buffer.copyFrom(data, size);
+			uploaded = size;
+
+			descriptorsOutdated = true;
+			return;
+		}
+
+		if (uploaded == size)
+			return;
+
+		std::memcpy(buffer.getBuffer(frame) + uploaded, data + uploaded, size - uploaded);
+		buffer.flush(frame, uploaded, size - uploaded);
+
+		uploaded = size;
+	}
+
+	void SceneGraph::uploadMeshes() {
+
+		uploadAppended(
+			meshBuffer, meshCapacity, "Scene meshes", 
+			(const u8*) meshes.data(), uploadedMeshes, meshes.size() * sizeof(MeshInfo)
+		);
+
+		uploadAppended(
+			meshTriangleBuffer, meshTriangleCapacity, "Scene mesh triangles", 
+			(const u8*) meshTriangles.data(), uploadedMeshTriangles, meshTriangles.size() * sizeof(Triangle)
+		);
+
+		uploadAppended(
+			meshNodeBuffer, meshNodeCapacity, "Scene mesh BVH nodes", 
+			(const u8*) meshNodes.data(), uploadedMeshNodes, meshNodes.size() * sizeof(BVH::Node)
+		);
+
+		uploadAppended(
+			meshVertexBuffer, meshVertexCapacity, "Scene mesh vertices", 
+			(const u8*) meshVertices.data(), uploadedMeshVertices, meshVertices.size() * sizeof(QuantizedVertex)
+		);
+
+		uploadAppended(
+			meshIndexBuffer, meshIndexCapacity, "Scene mesh indices", 
+			(const u8*) meshIndices.data(), uploadedMeshIndices, meshIndices.size() * sizeof(u32)
+		);
+	}
+
+	bool SceneGraph::intersectInstance(const Ray &ray, const Instance &instance, f32 &t, bool bruteForce) const {
+
+		if (instance.mesh >= meshes.size())
+			return false;
+
+		//The transform is affine, so t is the same in the space of the mesh
+
+		Ray local{ instance.toObject(ray.origin), instance.toObjectDir(ray.dir) };
+
+		const MeshInfo &mesh = meshes[instance.mesh];
+
+		bool hit{};
+
+		if (bruteForce) {
+
+			for (u32 i = 0; i < mesh.triangleCount; ++i)
+				hit |= intersect(local, getMeshTriangle(mesh, i), t);
+
+			return hit;
+		}
+
+		BVH::traverse(
+			std::span<const BVH::Node>(meshNodes.data() + mesh.firstNode, mesh.nodeCount),
+			local.origin, local.dir, t,
+			[&](u32 position, f32 &tmax) -> bool {
+				bool h = intersect(local, getMeshTriangle(mesh, position), tmax);
+				hit |= h;
+				return h;
+			}
+		);
+
+		return hit;
+	}
+
+	bool SceneGraph::getBounds(SceneObjectType type, u32 i, BVH::Primitive &prim) const {
+
+		const Object &obj = objects[u8(type)];
+
+		if (!obj.toIndex[i])
+			return false;
+
+		prim.id = obj.materialOffset + i;
+
+		switch (type) {
+
+			case SceneObjectType::TRIANGLE: {
+
+				const Triangle &tri = ((const Triangle*) obj.data)[i];
+
+				prim.min[0] = std::min({ tri.p0.x, tri.p1.x, tri.p2.x });
+				prim.min[1] = std::min({ tri.p0.y, tri.p1.y, tri.p2.y });
+				prim.min[2] = std::min({ tri.p0.z, tri.p1.z, tri.p2.z });
+				prim.max[0] = std::max({ tri.p0.x, tri.p1.x, tri.p2.x });
+				prim.max[1] = std::max({ tri.p0.y, tri.p1.y, tri.p2.y });
+				prim.max[2] = std::max({ tri.p0.z, tri.p1.z, tri.p2.z });
+				return true;
+			}
+
+			case SceneObjectType::SPHERE: {
+
+				const Sphere &sphere = ((const Sphere*) obj.data)[i];
+				f32 r = sphere.Radius;
+
+				prim.min[0] = sphere.Position.x - r;
+				prim.min[1] = sphere.Position.y - r;
+				prim.min[2] = sphere.Position.z - r;
+				prim.max[0] = sphere.Position.x + r;
+				prim.max[1] = sphere.Position.y + r;
+				prim.max[2] = sphere.Position.z + r;
+				return true;
+			}
+
+			case SceneObjectType::CUBE: {
+
+				const Cube &cube = ((const Cube*) obj.data)[i];
+
+				prim.min[0] = cube.min.x;
+				prim.min[1] = cube.min.y;
+				prim.min[2] = cube.min.z;
+				prim.max[0] = cube.max.x;
+				prim.max[1] = cube.max.y;
+				prim.max[2] = cube.max.z;
+				return true;
+			}
+
+			//Transform the corners of the mesh bounds; instances of meshes that don't exist are skipped
+
+			case SceneObjectType::INSTANCE: {
+
+				const Instance &instance = ((const Instance*) obj.data)[i];
+
+				if (instance.mesh >= meshes.size())
+					return false;
+
+				const MeshInfo &mesh = meshes[instance.mesh];
+				const BVH::Node &root = meshNodes[mesh.firstNode];
+
+				for (usz a = 0; a < 3; ++a) {
+					prim.min[a] = std::numeric_limits<f32>::max();
+					prim.max[a] = -std::numeric_limits<f32>::max();
+				}
+
+				for (usz corner = 0; corner < 8; ++corner) {
+
+					Vec3f32 p = instance.toWorld(Vec3f32(
+						corner & 1 ? root.max[0] : root.min[0],
+						corner & 2 ? root.max[1] : root.min[1],
+						corner & 4 ? root.max[2] : root.min[2]
+					));
+
+					const f32 c[3] = { p.x, p.y, p.z };
+
+					for (usz a = 0; a < 3; ++a) {
+						prim.min[a] = std::min(prim.min[a], c[a]);
+						prim.max[a] = std::max(prim.max[a], c[a]);
+					}
+				}
+
+				return true;
+			}
+
+			default:
+				return false;
+		}
+	}
+
+	void SceneGraph::updateBVH() {
+
+		//Swap in the background build once it's done
+
+		if (bvhRebuild.running && bvhRebuild.done) {
+
+			bvhRebuild.thread.join();
+			bvhRebuild.running = false;
+
+			if (!bvhRebuild.stale && !bvhOutdated) {
+
+				bvh = std::move(bvhRebuild.result);
+				bvhBuiltCost = bvh.getCost();
+
+				//Geometry that moved while it was building
+
+				bvhRefits.clear();
+
+				for (u32 id : bvhRebuild.refit) {
+
+					u32 i{};
+					SceneObjectType type = fromGeometryId(id, i);
+					BVH::Primitive prim;
+
+					if (type != SceneObjectType::COUNT && getBounds(type, i, prim))
+						bvhRefits.push_back(prim);
+				}
+
+				if (bvh.refit(bvhRefits)) {
+					bvh.clearModified();
+					uploadBVH();
+				}
+
+				else bvhOutdated = true;
+			}
+
+			bvhRebuild.result.clear();
+			bvhRebuild.refit.clear();
+		}
+
+		if (bvhOutdated)
+			buildBVH();
+
+		else refitBVH();
+	}
+
+	void SceneGraph::buildBVH() {
+
+		//A background build started from the old tree, so it can't replace this one
+		//buildBVH clears bvhOutdated, so that alone wouldn't stop it from being swapped in
+
+		if (bvhRebuild.running)
+			bvhRebuild.stale = true;
+
+		List<BVH::Primitive> input;
+
+		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+
+			if (!sceneObjectInBVH[u8(type)])
+				continue;
+
+			BVH::Primitive prim;
+
+			for (u32 i = 0, count = info.objectCount[u8(type)]; i < count; ++i)
+				if (getBounds(type, i, prim))
+					input.push_back(prim);
+		}
+
+		bvh.build(std::move(input), &factory.getWorkers());
+		bvh.clearModified();
+
+		bvhBuiltCost = bvh.getCost();
+		bvhOutdated = false;
+
+		uploadBVH();
+	}
+
+	void SceneGraph::refitBVH() {
+
+		//Only objects that were updated are dirty, anything else would've required a rebuild
+
+		bvhRefits.clear();
+
+		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+
+			if (!sceneObjectInBVH[u8(type)])
+				continue;
+
+			objects[u8(type)].markedForUpdate.forEachRange(0, info.objectCount[u8(type)], [&](usz begin, usz end) {
+
+				BVH::Primitive prim;
+
+				for (usz i = begin; i < end; ++i)
+					if (getBounds(type, u32(i), prim))
+						bvhRefits.push_back(prim);
+			});
+		}
+
+		if (bvhRefits.empty())
+			return;
+
+		if (!bvh.refit(bvhRefits)) {
+			buildBVH();
+			return;
+		}
+
+		if (bvhRebuild.running)
+			for (auto &prim : bvhRefits)
+				bvhRebuild.refit.push_back(prim.id);
+
+		//Only the refit nodes have to go to the gpu
+
+		auto &nodes = bvh.getNodes();
+		const u8 *nodeData = (const u8*) nodes.data();
+		u8 *target = bvhNodes.getBuffer(frame);
+
+		bvh.getModified().forEachMergedRange(
+			0, nodes.size(), flushRegionCost / sizeof(BVH::Node),
+			[&](usz begin, usz end) {
+
+				usz offset = begin * sizeof(BVH::Node), size = (end - begin) * sizeof(BVH::Node);
+
+				std::memcpy(target + offset, nodeData + offset, size);
+				bvhNodes.flush(frame, offset, size);
+			}
+		);
+
+		bvh.clearModified();
+
+		//Refits make the tree worse, so build a new one without holding up the update
+
+		if (bvhRebuild.running || bvh.getCost() <= bvhBuiltCost * bvhRebuildThreshold)
+			return;
+
+		bvhRebuild.input = bvh.getLeafPrimitives();
+		bvhRebuild.done = false;
+		bvhRebuild.stale = false;
+		bvhRebuild.running = true;
+
+		bvhRebuild.thread = std::thread([this]() {
+			bvhRebuild.result.build(std::move(bvhRebuild.input));
+			bvhRebuild.done = true;
+		});
+	}
+
+	void SceneGraph::uploadBVH() {
+
+		auto &nodes = bvh.getNodes();
+		auto &prims = bvh.getPrimitives();
+
+		uploadBVH(bvhNodes, bvhNodeCapacity, "Scene BVH nodes", (const u8*) nodes.data(), nodes.size() * sizeof(BVH::Node));
+		uploadBVH(bvhPrimitives, bvhPrimitiveCapacity, "Scene BVH primitives", (const u8*) prims.data(), prims.size() * sizeof(u32));
+	}
+
+	void SceneGraph::updateLightTree() {
+
+		Object &obj = objects[u8(SceneObjectType::LIGHT)];
+		std::span<const Light> lights((const Light*) obj.data, info.lightCount);
+
+		//Lights that were only updated keep their place in the tree
+
+		if (!lightTreeOutdated) {
+
+			lightRefits.clear();
+
+			obj.markedForUpdate.forEachRange(0, info.lightCount, [this](usz begin, usz end) {
+				for (usz i = begin; i < end; ++i)
+					lightRefits.push_back(u32(i));
+			});
+
+			if (lightRefits.empty())
+				return;
+
+			if (lightTree.refit(lights, lightRefits)) {
+
+				auto flushModified = [this](const DirtyBitset &modified, MultiBuffer &buffer, const u8 *data, usz stride, usz count) {
+
+					u8 *target = buffer.getBuffer(frame);
+
+					modified.forEachMergedRange(0, count, flushRegionCost / stride, [&](usz begin, usz end) {
+						usz offset = begin * stride, size = (end - begin) * stride;
+						std::memcpy(target + offset, data + offset, size);
+						buffer.flush(frame, offset, size);
+					});
+				};
+
+				auto &nodes = lightTree.getNodes();
+				auto &emitters = lightTree.getEmitters();
+
+				flushModified(
+					lightTree.getModified(), lightTreeNodes, 
+					(const u8*) nodes.data(), sizeof(LightTree::Node), nodes.size()
+				);
+
+				flushModified(
+					lightTree.getModifiedEmitters(), lightTreeEmitters, 
+					(const u8*) emitters.data(), sizeof(LightTree::Emitter), emitters.size()
+				);
+
+				lightTree.clearModified();
+				return;
+			}
+		}
+
+		lightTree.build(lights, &factory.getWorkers());
+		lightTree.clearModified();
+		lightTreeOutdated = false;
+
+		auto &nodes = lightTree.getNodes();
+		auto &emitters = lightTree.getEmitters();
+
+		uploadBVH(
+			lightTreeNodes, lightTreeNodeCapacity, "Scene light tree nodes", 
+			(const u8*) nodes.data(), nodes.size() * sizeof(LightTree::Node)
+		);
+
+		uploadBVH(
+			lightTreeEmitters, lightTreeEmitterCapacity, "Scene light tree emitters", 
+			(const u8*) emitters.data(), emitters.size() * sizeof(LightTree::Emitter)
+		);
+	}
+
+	void SceneGraph::uploadBVH(MultiBuffer &buffer, usz &capacity, const String &name, const u8 *data, usz size) {
+
+		//Other frames can still be behind, but they can't copy more than the new size
+
+		buffer.truncate(size);
+
+		if (!buffer.frames() || size > capacity) {
+
+			capacity = std::max(std::max(size, capacity * 2), usz(4096));
+
+			retire(std::move(buffer));
+
+			buffer = MultiBuffer(
+				factory.getGraphics(), name,
+				GPUBuffer::Info(
+					capacity, GPUBufferUsage::STORAGE,
+					GPUMemoryUsage::CPU_WRITE | GPUMemoryUsage::GPU_WRITE
+				),
+				descriptors.size()
+			);
+
+			descriptorsOutdated = true;
+		}
+
+		if (!size)
+			return;
+
+		std::memcpy(buffer.getBuffer(frame), data, size);
+		buffer.flush(frame, 0, size);
+	}
+
+	SceneObjectType SceneGraph::fromGeometryId(u32 id, u32 &index) const {
+
+		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+
+			const Object &obj = objects[u8(type)];
+
+			if (!sceneObjectIsGeometry[u8(type)] || id < obj.materialOffset || id - obj.materialOffset >= info.objectCount[u8(type)])
+				continue;
+
+			index = id - obj.materialOffset;
+			return type;
+		}
+
+		return SceneObjectType::COUNT;
+	}
+
+	usz SceneGraph::verifyBVH(usz rays, u32 seed) {
+
+		auto &nodes = bvh.getNodes();
+
+		if (nodes.empty())
+			return 0;
+
+		auto hit = [this](const Ray &ray, SceneObjectType type, u32 i, f32 &t, bool bruteForce) -> bool {
+
+			const u8 *data = objects[u8(type)].data;
+
+			switch (type) {
+				case SceneObjectType::TRIANGLE:		return intersect(ray, ((const Triangle*) data)[i], t);
+				case SceneObjectType::SPHERE:		return intersect(ray, ((const Sphere*) data)[i], t);
+				case SceneObjectType::CUBE:			return intersect(ray, ((const Cube*) data)[i], t);
+				case SceneObjectType::INSTANCE:		return intersectInstance(ray, ((const Instance*) data)[i], t, bruteForce);
+				default:							return false;
+			}
+		};
+
+		//Start the rays inside of the scene bounds
+
+		const BVH::Node &root = nodes[0];
+
+		std::mt19937 gen(seed);
+		std::uniform_real_distribution<f32> x(root.min[0], root.max[0]), y(root.min[1], root.max[1]), z(root.min[2], root.max[2]);
+		std::uniform_real_distribution<f32> dir(-1, 1);
+
+		usz mismatches{};
+
+		for (usz r = 0; r < rays; ++r) {
+
+			Ray ray{ Vec3f32(x(gen), y(gen), z(gen)), Vec3f32(dir(gen), dir(gen), dir(gen)) };
+
+			f32 expected = rayMiss;
+
+			for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1)) {
+
+				const Object &obj = objects[u8(type)];
+
+				if (sceneObjectInBVH[u8(type)])
+					for (u32 i = 0, count = info.objectCount[u8(type)]; i < count; ++i)
+						if (obj.toIndex[i])
+							hit(ray, type, i, expected, true);
+			}
+
+			f32 t = rayMiss;
+
+			bvh.traverse(ray.origin, ray.dir, t, [&](u32 id, f32 &tmax) -> bool {
+				u32 i{};
+				SceneObjectType type = fromGeometryId(id, i);
+				return type != SceneObjectType::COUNT && hit(ray, type, i, tmax, false);
+			});
+
+			if (t != expected)
+				++mismatches;
+		}
+
+		if (mismatches)
+			oic::System::log()->error(
+				"SceneGraph::verifyBVH " + std::to_string(mismatches) + " of " + 
+				std::to_string(rays) + " rays didn't match brute force"
+			);
+
+		return mismatches;
+	}
+
+	void SceneGraph::updateObjects(UpdateChunk &chunk) {
+
+		Object &obj = objects[u8(chunk.type)];
+		usz stride = sceneObjectStrides[u8(chunk.type)];
+
+		//Nearby regions are merged; the clean objects in between are identical on the cpu and gpu
+
+		chunk.stats.dirtyRanges = u32(obj.markedForUpdate.forEachMergedRange(
+			chunk.begin, chunk.end, flushRegionCost / stride, 
+			[&](usz begin, usz end) {
+
+				//Ensure data is in our other cpu copy
+				//Not our intermediate (unless it's edited in place)
+
+				u8 *target = obj.buffer.getBuffer(frame);
+
+				if (target != obj.data)
+					std::memcpy(
+						target + stride * begin,
+						obj.data + stride * begin,
+						(end - begin) * stride
+					);
+
+				chunk.objectFlushes.push_back({ stride * begin, (end - begin) * stride });
+
+				++chunk.stats.flushedRanges;
+				chunk.stats.flushedBytes += (end - begin) * stride;
+			}
+		));
+	}
+
+	void SceneGraph::del(std::span<const u64> ids) {
+
+		List<u32> deletedMaterials;
+	
+		for (u64 i : ids) {
+
+			Entry *entry = lookup(i);
+
+			if (!entry)
+				continue;
+
+			u8 type = u8(entry->type);
+
+			//Shared materials stay until the last reference is gone
+
+			if (type == u8(SceneObjectType::MATERIAL) && HasFlags(flags, Flags::DEDUPLICATE_MATERIALS)) {
+
+				if (--materialReferences[entry->material])
+					continue;
+
+				forgetMaterial(i);
+			}
+
+			Object &obj = objects[type];
+			usz stride = sceneObjectStrides[type];
+
+			if (sceneObjectInBVH[type])
+				bvhOutdated = true;
+
+			//Lights stay sorted by type, so their slot is closed right away
+
+			if (type == u8(SceneObjectType::LIGHT))
+				removeLight(entry->index, ((const Light*) obj.data)[entry->index].type.value);
+
+			//Keep geometry dense by moving the last object into the freed slot
+			//Geometry only, because materials are referenced by index
+
+			else if (HasFlags(flags, Flags::SWAP_ON_DELETE) && sceneObjectIsGeometry[type])
+				swapRemove(SceneObjectType(type), entry->index);
+
+			//Zero the object, so the GPU ignores it until it's compacted
+
+			else {
+
+				std::memset(obj.data + entry->index * stride, 0, stride);
+
+				obj.toIndex[entry->index] = 0;
+				obj.markedForUpdate.set(entry->index);
+				obj.holes.push_back(entry->index);
+				obj.needsCompaction = true;
+			}
+
+			if (type == u8(SceneObjectType::MATERIAL))
+				deletedMaterials.push_back(entry->material);
+
+			//Free the slot and invalidate the id
+
+			entry->type = SceneObjectType::COUNT;
+
+			if (!++entry->generation)
+				entry->generation = 1;
+
+			freeEntries.push_back(u32(i));
+		}
+
+		if (deletedMaterials.empty())
+			return;
+
+		//Geometry that used a deleted material falls back to material 0
+		//Otherwise it would silently switch to whichever material reuses the handle
+
+		List<bool> deleted(materialHandles);
+
+		for (u32 handle : deletedMaterials)
+			deleted[handle] = true;
+
+		for (Entry &entry : entries)
+			if (
+				entry.type != SceneObjectType::COUNT && sceneObjectIsGeometry[u8(entry.type)] &&
+				entry.material && entry.material < materialHandles && deleted[entry.material]
+			) {
+				entry.material = 0;
+				objects[u8(entry.type)].materialsChanged.set(entry.index);
+				isModified = true;
+			}
+
+		//Handle 0 is that fallback, so it's never reused; it keeps pointing at the first material
+
+		for (u32 handle : deletedMaterials)
+			if (handle)
+				freeMaterialHandles.push_back(handle);
+
+			else {
+				materialRemap[0] = 0;
+				materialRemapDirty.set(0);
+			}
+
+	}
+
+	u64 SceneGraph::addInternal(SceneObjectType t, const void *v, usz siz, u32 mat) {
+
+		u32 &ind = info.objectCount[u8(t)];
+		Object &obj = objects[u8(t)];
+
+		//Identical materials are shared, so only a reference is added
+
+		bool intern = t == SceneObjectType::MATERIAL && HasFlags(flags, Flags::DEDUPLICATE_MATERIALS);
+
+		if (intern)
+			if (u64 existing = findMaterial(hashMaterial(*(const Material*) v), *(const Material*) v)) {
+				++materialReferences[entries[u32(existing)].material];
+				return existing;
+			}
+
+		//Reuse the last deleted slot, otherwise append
+		//Holes are always below the count, since compaction removes the ones it trims
+
+		u32 i;
+
+		if (obj.holes.size()) {
+			i = obj.holes.back();
+			obj.holes.pop_back();
+		}
+
+		else {
+
+			if (!grow(t, usz(ind) + 1))
+				return 0;
+
+			i = ind++;
+		}
+
+		u64 id = addEntry(t, i, t == SceneObjectType::MATERIAL ? addMaterialHandle(i) : mat);
+
+		isModified = true;
+
+		if (sceneObjectInBVH[u8(t)])
+			bvhOutdated = true;
+
+		obj.markedForUpdate.set(i);
+		obj.toIndex[i] = id;
+
+		std::memcpy(obj.data + siz * i, v, siz);
+
+		if (intern) {
+			materialReferences[entries[u32(id)].material] = 1;
+			internMaterial(id);
+		}
+
+		//Lights don't have holes, so it was appended and only has to be moved into its range
+
+		if (t == SceneObjectType::LIGHT)
+			insertLight(i);
+
+		return id;
+	}
+
+	u64 SceneGraph::addEntry(SceneObjectType t, u32 i, u32 mat) {
+
+		//Reuse a free entry slot; generation starts at 1 so 0 is never a valid id
+
+		u32 slot;
+
+		if (freeEntries.size()) {
+			slot = freeEntries.back();
+			freeEntries.pop_back();
+		}
+
+		else {
+			slot = u32(entries.size());
+			entries.push_back({ 0, 0, 1, SceneObjectType::COUNT });
+		}
+
+		Entry &entry = entries[slot];
+		entry.index = i;
+		entry.material = mat;
+		entry.type = t;
+
+		return u64(entry.generation) << 32 | slot;
+	}
+
+	bool SceneGraph::addBatchInternal(
+		SceneObjectType t, const void *v, usz siz, usz count, 
+		std::span<const u32> mats, u64 *ids
+	) {
+
+		u32 &ind = info.objectCount[u8(t)];
+		Object &obj = objects[u8(t)];
+
+		if (!grow(t, usz(ind) + count))
+			return false;
+
+		//Materials that are shared can't be one run, so they're added one by one
+		//It already fits, so none of them can fail
+
+		if (t == SceneObjectType::MATERIAL && HasFlags(flags, Flags::DEDUPLICATE_MATERIALS)) {
+
+			for (usz k = 0; k < count; ++k)
+				ids[k] = addInternal(t, (const u8*) v + siz * k, siz, 0);
+
+			isModified = true;
+			return true;
+		}
+
+		if (!count)
+			return true;
+
+		//Always append, so the batch stays one contiguous run
+		//Holes are still reused by add or removed by compaction
+
+		u32 start = ind;
+		ind += u32(count);
+
+		std::memcpy(obj.data + siz * start, v, siz * count);
+		obj.markedForUpdate.setRange(start, start + count);
+
+		if (sceneObjectInBVH[u8(t)])
+			bvhOutdated = true;
+
+		//Entries come from the free list like addEntry, the rest are appended at once
+
+		usz reused = std::min(count, freeEntries.size());
+		usz appended = entries.size();
+
+		entries.resize(appended + count - reused, { 0, 0, 1, SceneObjectType::COUNT });
+
+		for (usz k = 0; k < count; ++k) {
+
+			u32 slot = k < reused ? freeEntries[freeEntries.size() - 1 - k] : u32(appended + k - reused);
+
+			Entry &entry = entries[slot];
+			entry.index = u32(start + k);
+			entry.type = t;
+
+			entry.material =
+				t == SceneObjectType::MATERIAL ? addMaterialHandle(u32(start + k)) :
+				mats.empty() ? 0 : mats[mats.size() == 1 ? 0 : k];
+
+			ids[k] = obj.toIndex[start + k] = u64(entry.generation) << 32 | slot;
+		}
+
+		freeEntries.resize(freeEntries.size() - reused);
+
+		//Insert the lights one by one; the ones after it are still at the end, so they aren't touched
+
+		if (t == SceneObjectType::LIGHT)
+			for (usz k = 0; k < count; ++k)
+				insertLight(u32(start + k));
+
+		isModified = true;
+		return true;
+	}
+
+	usz SceneGraph::updateBatchInternal(SceneObjectType t, std::span<const u64> ids, const void *v, usz siz) {
+
+		Object &obj = objects[u8(t)];
+		const u8 *src = (const u8*) v;
+
+		usz valid{}, runSrc{}, runLength{};
+		u32 runStart{};
+
+		List<u64> retyped;
+
+		//Shared materials are found again by their new contents once they're written
+
+		bool intern = t == SceneObjectType::MATERIAL && HasFlags(flags, Flags::DEDUPLICATE_MATERIALS);
+
+		if (intern)
+			for (u64 id : ids)
+				forgetMaterial(id);
+
+		auto writeRun = [&]() {
+
+			if (!runLength)
+				return;
+
+			std::memcpy(obj.data + siz * runStart, src + siz * runSrc, siz * runLength);
+			obj.markedForUpdate.setRange(runStart, runStart + runLength);
+
+			runLength = 0;
+		};
+
+		for (usz k = 0; k < ids.size(); ++k) {
+
+			const Entry *entry = find(ids[k]);
+
+			if (!entry)
+				continue;
+
+			if (entry->type != t) {
+				oic::System::log()->error("SceneGraph::updateBatch<T> called with incompatible types");
+				continue;
+			}
+
+			++valid;
+
+			//Lights are sorted by type, so they're moved once everything is written
+			//The index can change while moving, so remember the id
+
+			if (
+				t == SceneObjectType::LIGHT && 
+				((const Light*) src)[k].type.value != ((const Light*) obj.data)[entry->index].type.value
+			)
+				retyped.push_back(ids[k]);
+
+			//Extend the current run if both the source and destination are consecutive
+
+			if (runLength && entry->index == runStart + runLength && k == runSrc + runLength) {
+				++runLength;
+				continue;
+			}
+
+			writeRun();
+
+			runStart = entry->index;
+			runSrc = k;
+			runLength = 1;
+		}
+
+		writeRun();
+
+		for (u64 id : retyped)
+			changeLightType(entries[u32(id)].index);
+
+		if (intern)
+			for (u64 id : ids)
+				internMaterial(id);
+
+		return valid;
+	}
+
+	void SceneGraph::swapRemove(SceneObjectType type, u32 index) {
+
+		auto &obj = objects[u8(type)];
+		usz stride = sceneObjectStrides[u8(type)];
+		u32 &count = info.objectCount[u8(type)];
+
+		u32 last = count - 1;
+
+		if (index != last) {
+
+			u64 id = obj.toIndex[last];
+			u8 *cpuPtr = obj.data;
+
+			std::memcpy(cpuPtr + index * stride, cpuPtr + last * stride, stride);
+
+			//Marking it dirty also rewrites its material index on update
+
+			obj.toIndex[index] = id;
+			obj.markedForUpdate.set(index);
+
+			entries[u32(id)].index = index;
+		}
+
+		obj.toIndex[last] = 0;
+		obj.markedForUpdate.clear(last);
+		--count;
+	}
+
+	void SceneGraph::moveLight(u32 from, u32 to) {
+
+		if (from == to)
+			return;
+
+		Object &obj = objects[u8(SceneObjectType::LIGHT)];
+		Light *lights = (Light*) obj.data;
+
+		u64 id = obj.toIndex[from];
+
+		lights[to] = lights[from];
+		obj.toIndex[to] = id;
+		obj.markedForUpdate.set(to);
+
+		entries[u32(id)].index = to;
+	}
+
+	void SceneGraph::insertLight(u32 index) {
+
+		Object &obj = objects[u8(SceneObjectType::LIGHT)];
+		Light *lights = (Light*) obj.data;
+
+		Light light = lights[index];
+		u64 id = obj.toIndex[index];
+		u16 type = light.type.value;
+
+		//The index is right after the last range, so rotate the first light of every range after its type
+		//to the end of that range; which frees the slot right after the range of its type
+
+		u32 free = index;
+
+		for (u16 k = LightType::count - 1; k > type; --k) {
+			u32 start = free - info.lightsCount[k];
+			moveLight(start, free);
+			free = start;
+		}
+
+		lights[free] = light;
+		obj.toIndex[free] = id;
+		obj.markedForUpdate.set(free);
+
+		entries[u32(id)].index = free;
+
+		++info.lightsCount[type];
+		lightTreeOutdated = true;
+	}
+
+	void SceneGraph::removeLight(u32 index, u16 type) {
+
+		Object &obj = objects[u8(SceneObjectType::LIGHT)];
+		u32 &count = info.objectCount[u8(SceneObjectType::LIGHT)];
+
+		u32 end{};
+
+		for (u16 k = 0; k <= type; ++k)
+			end += info.lightsCount[k];
+
+		//Fill the slot with the last light of its range
+		//Then every range after it moves back by moving its last light to the slot that opened before it
+
+		u32 free = end - 1;
+		moveLight(free, index);
+
+		for (u16 k = type + 1; k < LightType::count; ++k) {
+			end += info.lightsCount[k];
+			moveLight(end - 1, free);
+			free = end - 1;
+		}
+
+		//The last slot is now unused
+
+		std::memset(obj.data + usz(free) * sizeof(Light), 0, sizeof(Light));
+		obj.toIndex[free] = 0;
+
+		--info.lightsCount[type];
+		--count;
+
+		lightTreeOutdated = true;
+	}
+
+	void SceneGraph::changeLightType(u32 index) {
+
+		Object &obj = objects[u8(SceneObjectType::LIGHT)];
+		Light *lights = (Light*) obj.data;
+
+		//The range it's in is the type it had
+
+		u16 type{};
+
+		for (u32 end = info.lightsCount[0]; index >= end; end += info.lightsCount[type])
+			++type;
+
+		if (lights[index].type.value == type)
+			return;
+
+		Light light = lights[index];
+		u64 id = obj.toIndex[index];
+
+		//Take it out of the old range and append it to the range of the new type
+
+		removeLight(index, type);
+
+		u32 i = info.objectCount[u8(SceneObjectType::LIGHT)]++;
+
+		lights[i] = light;
+		obj.toIndex[i] = id;
+
+		insertLight(i);
+	}
+
+	void SceneGraph::applyInspection(SceneObjectType type, const u8 *before) {
+
+		Object &obj = objects[u8(type)];
+		usz stride = sceneObjectStrides[u8(type)];
+		u32 count = info.objectCount[u8(type)];
+
+		List<u64> retyped;
+
+		for (u32 i = 0; i < count; ++i) {
+
+			if (std::memcmp(obj.data + i * stride, before + i * stride, stride) == 0)
+				continue;
+
+			obj.markedForUpdate.set(i);
+
+			if (type == SceneObjectType::LIGHT && ((const Light*) obj.data)[i].type.value != ((const Light*) before)[i].type.value)
+				retyped.push_back(obj.toIndex[i]);
+		}
+
+		//Moving a light to another range moves others too, so they're found by id
+
+		for (u64 id : retyped)
+			changeLightType(entries[u32(id)].index);
+	}
+
+	void SceneGraph::compact() {
+		for (SceneObjectType type = SceneObjectType::FIRST; type != SceneObjectType::COUNT; type = SceneObjectType(u8(type) + 1))
+			compact(type);
+	}
+
+	void SceneGraph::compactIncremental(SceneObjectType type) {
+
+		auto &obj = objects[u8(type)];
+		usz stride = sceneObjectStrides[u8(type)];
+		u32 &count = info.objectCount[u8(type)];
+
+		u8 *cpuPtr = obj.data;
+
+		for (u32 moved = 0; moved < compactionBudget; ) {
+
+			//Dead objects at the end don't have to be moved
+
+			while (count && !obj.toIndex[count - 1])
+				--count;
+
+			if (obj.holes.empty())
+				break;
+
+			u32 hole = obj.holes.back();
+			obj.holes.pop_back();
+
+			if (hole >= count)
+				continue;
+
+			//Move the last object into the hole; its old slot is then trimmed
+
+			u32 last = count - 1;
+			u64 id = obj.toIndex[last];
+
+			std::memcpy(cpuPtr + hole * stride, cpuPtr + last * stride, stride);
+
+			obj.toIndex[hole] = id;
+			obj.toIndex[last] = 0;
+			obj.markedForUpdate.set(hole);
+
+			entries[u32(id)].index = hole;
+
+			--count;
+			++moved;
+		}
+
+		//Holes past the new end would otherwise be reused once something is appended over them
+
+		while (count && !obj.toIndex[count - 1])
+			--count;
+
+		std::erase_if(obj.holes, [count](u32 hole) { return hole >= count; });
+
+		obj.needsCompaction = !obj.holes.empty();
+	}
+
+	void SceneGraph::compact(SceneObjectType type) {
+
+		auto &obj = objects[u8(type)];
+		usz stride = sceneObjectStrides[u8(type)];
+		u32 &count = info.objectCount[u8(type)];
+
+		u8 *cpuPtr = obj.data;
+
+		obj.needsCompaction = false;
+
+		//Sorting moves lights, so the light tree would refer to the wrong ones
+
+		if (type == SceneObjectType::LIGHT)
+			lightTreeOutdated = true;
+
+		//Lights are kept sorted by add, update and del, so this only does something
+		//if the light data was edited directly (in place)
+		//Light has to sort by type as well as eliminate dead space
+		//So find where every type starts
+
+		u32 lightOffsets[LightType::count]{};
+		Light *lc = (Light*) cpuPtr;
+
+		if (type == SceneObjectType::LIGHT) {
+
+			u32 counters[LightType::count]{};
+
+			for (u32 i = 0; i < count; ++i)
+				if (obj.toIndex[i])
+					++counters[lc[i].type.value];
+
+			for (usz i = 0; i < LightType::count; ++i) {
+
+				info.lightsCount[i] = counters[i];
+
+				if (i)
+					lightOffsets[i] = lightOffsets[i - 1] + counters[i - 1];
+			}
+		}
+
+		//Normal types just need to eliminate dead space
+		//Only remap if it exists, otherwise don't mark dirty
+
+		else if (obj.holes.empty())
+			return;
+
+		//Remap to ensure our dead space doesn't exist on the gpu
+		//And to make sure the point lights are after spot and after directional lights
+		//Other objects only move back, so they're compacted in place
+		//Lights can move forward, so they're remapped into a temporary copy
+
+		bool isLight = type == SceneObjectType::LIGHT;
+
+		Buffer remapped(isLight ? usz(count) * stride : 0);
+		List<u64> remappedIds(isLight ? count : 0);
+
+		u8 *dst = isLight ? remapped.data() : cpuPtr;
+		u64 *dstIds = isLight ? remappedIds.data() : obj.toIndex.data();
+
+		u32 j{};
+
+		for (u32 i = 0; i < count; ++i) {
+
+			u64 id = obj.toIndex[i];
+
+			if (!id)
+				continue;
+
+			u32 target = isLight ? lightOffsets[lc[i].type.value]++ : j;
+			++j;
+
+			if (dst + usz(target) * stride != cpuPtr + usz(i) * stride)
+				std::memcpy(dst + usz(target) * stride, cpuPtr + usz(i) * stride, stride);
+
+			dstIds[target] = id;
+
+			Entry &entry = entries[u32(id)];
+
+			if (entry.index != target) {
+
+				obj.markedForUpdate.set(target);
+				entry.index = target;
+
+				//Geometry refers to the handle, so only the remap changes
+
+				if (type == SceneObjectType::MATERIAL) {
+					materialRemap[entry.material] = target;
+					materialRemapDirty.set(entry.material);
+				}
+			}
+		}
+
+		//All dead space is gone, so there's nothing left to reuse
+
+		if (isLight) {
+			std::memcpy(cpuPtr, remapped.data(), usz(j) * stride);
+			std::copy(remappedIds.begin(), remappedIds.begin() + j, obj.toIndex.begin());
+		}
+
+		std::fill(obj.toIndex.begin() + j, obj.toIndex.begin() + count, 0);
+
+		count = j;
+		obj.holes.clear();
+	}
+
+	void SceneGraph::updateMaterialIndices(UpdateChunk &chunk) {
+
+		Object &obj = objects[u8(chunk.type)];
+		u32 offset = obj.materialOffset;
+
+		auto &flushes = chunk.materialFlushes;
+
+		//Only indices that differ are written; consecutive ones extend the last flush
+		//So reassigning the material of a big mesh is one flush rather than one per triangle
+
+		auto write = [&](usz i) {
+
+			u64 id = obj.toIndex[i];
+
+			u32 &dst = materialByObject[offset + i];
+			u32 src = id ? entries[u32(id)].material : 0;
+
+			if (dst == src)
+				return;
+
+			dst = src;
+
+			usz at = (offset + i) * sizeof(u32);
+
+			if (flushes.size() && flushes.back().first + flushes.back().second == at)
+				flushes.back().second += sizeof(u32);
+
+			else flushes.push_back({ at, sizeof(u32) });
+		};
+
+		//If the geometry before this type grew or shrunk, all of its indices moved
+
+		if (obj.remapMaterials) {
+
+			for (u32 i = chunk.begin; i < chunk.end; ++i)
+				write(i);
+
+			return;
+		}
+
+		//Otherwise only new, moved or reassigned geometry can point to a different material
+
+		auto writeRange = [&](usz begin, usz end) {
+			for (usz i = begin; i < end; ++i)
+				write(i);
+		};
+
+		obj.markedForUpdate.forEachRange(chunk.begin, chunk.end, writeRange);
+		obj.materialsChanged.forEachRange(chunk.begin, chunk.end, writeRange);
 	}
 
 }
\ No newline at end of file
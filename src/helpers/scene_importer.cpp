@@ -0,0 +1,1502 @@
+#include "helpers/scene_importer.hpp"
+#include "helpers/scene_graph.hpp"
+#include "helpers/bulk_encode.hpp"
+#include "helpers/worker_pool.hpp"
+#include "helpers/mapped_file.hpp"
+#include "types/ray.hpp"
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace igx {
+
+	using ImportClock = std::chrono::high_resolution_clock;
+
+	//Seconds since start; start is moved to now, so the next stage is timed from there
+
+	static inline f64 lap(ImportClock::time_point &start) {
+		ImportClock::time_point now = ImportClock::now();
+		f64 seconds = std::chrono::duration<f64>(now - start).count();
+		start = now;
+		return seconds;
+	}
+
+	static inline void forEach(usz count, WorkerPool *workers, const std::function<void(usz)> &f) {
+
+		if (workers)
+			workers->parallelFor(count, f);
+
+		else for (usz i = 0; i < count; ++i)
+			f(i);
+	}
+
+	//Triangles per job
+	static constexpr usz importBlock = 65536;
+
+	//What every format is parsed into
+	//Corners are stored as structure of arrays for the bulk encoders; corner 3i + k is corner k of triangle i
+
+	struct ImportedMaterial {
+		Vec3f32 albedo = Vec3f32(0.8f, 0.8f, 0.8f), ambient = Vec3f32(), emission = Vec3f32();
+		f32 metallic{}, roughness = 1, transparency{};
+	};
+
+	struct ImportedScene {
+
+		List<f32> positions[3], normals[3];		//Normals are empty if no triangle has them
+		List<u32> materialOf;		//Per triangle, into materials
+		List<ImportedMaterial> materials;
+
+		void resize(usz triangles, bool hasNormals) {
+
+			for (usz a = 0; a < 3; ++a) {
+				positions[a].resize(triangles * 3);
+				normals[a].resize(hasNormals ? triangles * 3 : 0);
+			}
+
+			materialOf.resize(triangles);
+		}
+
+		inline usz size() const { return materialOf.size(); }
+		inline bool hasNormals() const { return !normals[0].empty(); }
+
+		inline void setPosition(usz corner, const Vec3f32 &p) {
+			positions[0][corner] = p.x;
+			positions[1][corner] = p.y;
+			positions[2][corner] = p.z;
+		}
+
+		inline void setNormal(usz corner, const Vec3f32 &n) {
+			normals[0][corner] = n.x;
+			normals[1][corner] = n.y;
+			normals[2][corner] = n.z;
+		}
+	};
+
+	static inline String directoryOf(const String &path) {
+		usz slash = path.find_last_of("/\\");
+		return slash == String::npos ? String() : path.substr(0, slash + 1);
+	}
+
+	//Convert and insert what was parsed; shared by all formats
+
+	static bool addToScene(
+		SceneGraph &scene, const String &path, const ImportedScene &imported, SceneImport &result,
+		WorkerPool *workers, bool upload, ImportClock::time_point &start
+	) {
+
+		usz triangleCount = imported.size(), materialCount = imported.materials.size();
+
+		if (!triangleCount) {
+			oic::System::log()->error(String("Import of ") + path + " failed; it contains no triangles");
+			return false;
+		}
+
+		//Convert; albedo, ambient and emission as xyz, then metallic, roughness and transparency
+
+		List<f32> channels[12];
+
+		for (List<f32> &channel : channels)
+			channel.resize(materialCount);
+
+		for (usz i = 0; i < materialCount; ++i) {
+
+			const ImportedMaterial &mat = imported.materials[i];
+			const Vec3f32 *colors[] = { &mat.albedo, &mat.ambient, &mat.emission };
+
+			for (usz c = 0; c < 3; ++c) {
+				channels[c * 3][i] = colors[c]->x;
+				channels[c * 3 + 1][i] = colors[c]->y;
+				channels[c * 3 + 2][i] = colors[c]->z;
+			}
+
+			channels[9][i] = mat.metallic;
+			channels[10][i] = mat.roughness;
+			channels[11][i] = mat.transparency;
+		}
+
+		auto color = [&](usz c) {
+			return Vec3Arrays{ channels[c].data(), channels[c + 1].data(), channels[c + 2].data() };
+		};
+
+		List<Material> materials = encodeMaterials(
+			color(0), color(3), color(6), channels[9].data(), channels[10].data(), channels[11].data(),
+			materialCount, workers
+		);
+
+		Vec3Arrays positions{ imported.positions[0].data(), imported.positions[1].data(), imported.positions[2].data() }, normals;
+
+		if (imported.hasNormals())
+			normals = { imported.normals[0].data(), imported.normals[1].data(), imported.normals[2].data() };
+
+		List<Triangle> triangles(triangleCount);
+		encodeTriangles(positions, normals, triangles, workers);
+
+		result.convertTime = lap(start);
+
+		//Insert; geometry refers to materials by handle
+
+		result.materials = scene.addBatch(std::span<const Material>(materials));
+
+		if (result.materials.size() != materialCount) {
+			result.materials.clear();
+			oic::System::log()->error(String("Import of ") + path + " failed; the materials don't fit in the scene graph");
+			return false;
+		}
+
+		List<u32> handles(materialCount), materialOf(triangleCount);
+
+		for (usz i = 0; i < materialCount; ++i)
+			handles[i] = scene.getMaterialHandle(result.materials[i]);
+
+		forEach((triangleCount + importBlock - 1) / importBlock, workers, [&](usz block) {
+			for (usz i = block * importBlock, end = std::min(triangleCount, i + importBlock); i < end; ++i)
+				materialOf[i] = handles[imported.materialOf[i]];
+		});
+
+		result.triangles = scene.addBatch(std::span<const Triangle>(triangles), materialOf);
+
+		if (result.triangles.size() != triangleCount) {
+			scene.del(result.materials);
+			result.materials.clear();
+			result.triangles.clear();
+			oic::System::log()->error(String("Import of ") + path + " failed; the triangles don't fit in the scene graph");
+			return false;
+		}
+
+		result.insertTime = lap(start);
+
+		if (upload) {
+			scene.update(0);
+			result.uploadTime = lap(start);
+		}
+
+		return true;
+	}
+
+	//Text parsing
+
+	static inline const char *skipSpaces(const char *c, const char *end) {
+
+		while (c < end && (*c == ' ' || *c == '\t'))
+			++c;
+
+		return c;
+	}
+
+	static inline bool isLineEnd(const char *c, const char *end) {
+		return c >= end || *c == '\r' || *c == '\n' || *c == '#';
+	}
+
+	static inline const char *nextLine(const char *c, const char *end) {
+		const void *newline = std::memchr(c, '\n', usz(end - c));
+		return newline ? (const char*) newline + 1 : end;
+	}
+
+	static inline bool parseFloat(const char *&c, const char *end, f32 &v) {
+
+		c = skipSpaces(c, end);
+
+		if (c < end && *c == '+')
+			++c;
+
+		//As f64, so values that don't fit in a f32 become 0 or inf rather than an error
+
+		f64 d{};
+		std::from_chars_result res = std::from_chars(c, end, d);
+
+		if (res.ec != std::errc())
+			return false;
+
+		v = f32(d);
+		c = res.ptr;
+		return true;
+	}
+
+	//Rest of the line without the surrounding spaces
+
+	static inline String parseName(const char *c, const char *end) {
+
+		c = skipSpaces(c, end);
+
+		const char *last = c;
+
+		for (const char *i = c; i < end && *i != '\n' && *i != '\r'; ++i)
+			if (*i != ' ' && *i != '\t')
+				last = i + 1;
+
+		return String(c, last);
+	}
+
+	//OBJ
+	//The file is split into chunks at line breaks, which are parsed in parallel
+	//Corners are stored as a position and normal index; indices that are known are 0 based,
+	//indices relative to the end of the chunk are stored as -1 - index and missing normals as objNone
+	//Relative indices into earlier chunks are fixed up once those are counted
+
+	static constexpr i32 objNone = i32_MIN;
+
+	struct ObjChunk {
+
+		const char *begin{}, *end{};
+
+		List<f32> positions, normals;		//xyz
+		List<i32> corners;		//Position and normal per corner
+		List<i32> materials;		//Per triangle; into names, or -1 for the material the chunk starts with
+		List<String> names, libraries;		//Of usemtl and mtllib
+
+		List<Pair<usz, i64>> earlier;		//Corner value and index relative to the start of the chunk
+
+		usz positionBase{}, normalBase{}, triangleBase{};
+		List<u32> nameMaterials;		//Imported material per name
+		u32 firstMaterial{};
+
+		bool hasNormals{}, usesDefault{};
+		String error;
+	};
+
+	static void parseObjChunk(ObjChunk &chunk) {
+
+		List<Pair<i64, i64>> face;
+		i32 material = -1;
+
+		//0 based index, or relative to the end of the chunk if it's negative
+
+		auto index = [&chunk](i64 i, usz count) -> i32 {
+
+			if (i > 0)
+				return i - 1 <= std::numeric_limits<i32>::max() ? i32(i - 1) : objNone;
+
+			i64 relative = i64(count) + i;
+
+			if (relative >= 0)
+				return i32(-1 - relative);
+
+			chunk.earlier.push_back({ chunk.corners.size(), relative });
+			return 0;
+		};
+
+		for (const char *line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+
+			const char *end = nextLine(line, chunk.end);
+			const char *c = skipSpaces(line, end);
+
+			if (isLineEnd(c, end))
+				continue;
+
+			const char *keyword = c;
+
+			while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+				++c;
+
+			usz length = usz(c - keyword);
+			bool valid = true;
+
+			//Position and normal; w and vertex colors are ignored
+
+			if (keyword[0] == 'v' && (length == 1 || (length == 2 && keyword[1] == 'n'))) {
+
+				List<f32> &target = length == 1 ? chunk.positions : chunk.normals;
+				f32 xyz[3];
+
+				for (usz a = 0; a < 3 && valid; ++a)
+					valid = parseFloat(c, end, xyz[a]);
+
+				if (valid)
+					target.insert(target.end(), xyz, xyz + 3);
+			}
+
+			//Face; v, v/t, v//n or v/t/n per corner
+
+			else if (length == 1 && keyword[0] == 'f') {
+
+				face.clear();
+
+				while (valid) {
+
+					c = skipSpaces(c, end);
+
+					if (isLineEnd(c, end))
+						break;
+
+					i64 v{}, t{}, n{};
+					std::from_chars_result res = std::from_chars(c, end, v);
+					valid = res.ec == std::errc() && v;
+					c = res.ptr;
+
+					if (valid && c < end && *c == '/') {
+
+						++c;
+
+						if (c < end && *c != '/') {
+							res = std::from_chars(c, end, t);
+							valid = res.ec == std::errc();
+							c = res.ptr;
+						}
+
+						if (valid && c < end && *c == '/') {
+							res = std::from_chars(c + 1, end, n);
+							valid = res.ec == std::errc() && n;
+							c = res.ptr;
+						}
+					}
+
+					valid &= c >= end || *c == ' ' || *c == '\t' || *c == '\r' || *c == '\n';
+					face.push_back({ v, n });
+				}
+
+				valid &= face.size() >= 3;
+
+				for (usz k = 1; valid && k + 1 < face.size(); ++k) {
+
+					for (const Pair<i64, i64> &corner : { face[0], face[k], face[k + 1] }) {
+
+						chunk.corners.push_back(index(corner.first, chunk.positions.size() / 3));
+						chunk.corners.push_back(corner.second ? index(corner.second, chunk.normals.size() / 3) : objNone);
+
+						chunk.hasNormals |= corner.second != 0;
+					}
+
+					chunk.materials.push_back(material);
+				}
+			}
+
+			else if (length == 6 && !std::memcmp(keyword, "usemtl", 6)) {
+				chunk.names.push_back(parseName(c, end));
+				material = i32(chunk.names.size() - 1);
+			}
+
+			//Multiple libraries are separated by spaces
+
+			else if (length == 6 && !std::memcmp(keyword, "mtllib", 6))
+				while (!isLineEnd(c = skipSpaces(c, end), end)) {
+
+					const char *name = c;
+
+					while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+						++c;
+
+					chunk.libraries.push_back(String(name, c));
+				}
+
+			if (!valid) {
+				chunk.error = "invalid line \"" + parseName(line, std::min(end, line + 64)) + "\"";
+				return;
+			}
+		}
+	}
+
+	//Materials of a .mtl file; roughness comes from Pr or otherwise the specular exponent, metallic from Pm
+
+	static void parseMtl(const String &path, List<ImportedMaterial> &materials, HashMap<String, u32> &byName) {
+
+		MappedFile file(path);
+
+		if (!file.isOpen())
+			return;
+
+		const char *begin = (const char*) file.data(), *fileEnd = begin + file.size();
+
+		ImportedMaterial *mat{};
+		f32 exponent = -1;
+		bool hasRoughness{};
+
+		auto finish = [&]() {
+			if (mat && !hasRoughness && exponent >= 0)
+				mat->roughness = std::clamp(std::sqrt(2 / (exponent + 2)), 0.f, 1.f);
+		};
+
+		for (const char *line = begin; line < fileEnd; line = nextLine(line, fileEnd)) {
+
+			const char *end = nextLine(line, fileEnd);
+			const char *c = skipSpaces(line, end);
+
+			if (isLineEnd(c, end))
+				continue;
+
+			const char *keyword = c;
+
+			while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+				++c;
+
+			String key(keyword, c);
+
+			if (key == "newmtl") {
+
+				finish();
+
+				String name = parseName(c, end);
+
+				//The first definition of a name is used
+
+				if (byName.find(name) != byName.end()) {
+					mat = nullptr;
+					continue;
+				}
+
+				byName[name] = u32(materials.size());
+				materials.push_back({});
+
+				mat = &materials.back();
+				exponent = -1;
+				hasRoughness = false;
+				continue;
+			}
+
+			if (!mat)
+				continue;
+
+			//Colors with one value are gray
+
+			auto parseColor = [&](Vec3f32 &target) {
+
+				f32 rgb[3]{};
+
+				if (!parseFloat(c, end, rgb[0]))
+					return;
+
+				if (!parseFloat(c, end, rgb[1]) || !parseFloat(c, end, rgb[2]))
+					rgb[1] = rgb[2] = rgb[0];
+
+				target = Vec3f32(rgb[0], rgb[1], rgb[2]);
+			};
+
+			f32 v{};
+
+			if (key == "Kd") parseColor(mat->albedo);
+			else if (key == "Ka") parseColor(mat->ambient);
+			else if (key == "Ke") parseColor(mat->emission);
+			else if (key == "Ns" && parseFloat(c, end, v)) exponent = std::max(v, 0.f);
+			else if (key == "Pm" && parseFloat(c, end, v)) mat->metallic = std::clamp(v, 0.f, 1.f);
+			else if (key == "d" && parseFloat(c, end, v)) mat->transparency = std::clamp(1 - v, 0.f, 1.f);
+			else if (key == "Tr" && parseFloat(c, end, v)) mat->transparency = std::clamp(v, 0.f, 1.f);
+
+			else if (key == "Pr" && parseFloat(c, end, v)) {
+				mat->roughness = std::clamp(v, 0.f, 1.f);
+				hasRoughness = true;
+			}
+		}
+
+		finish();
+	}
+
+	static bool parseObj(const String &path, const MappedFile &file, ImportedScene &imported, WorkerPool *workers, String &error) {
+
+		const char *begin = (const char*) file.data(), *end = begin + file.size();
+
+		//Chunks of at least 1 MiB; a few per thread, since some parts of a file are slower than others
+
+		usz chunkCount = workers ? std::clamp(file.size() >> 20, usz(1), workers->size() * 4) : 1;
+		List<ObjChunk> chunks(chunkCount);
+
+		const char *chunkBegin = begin;
+
+		for (usz i = 0; i < chunkCount; ++i) {
+
+			const char *chunkEnd = i + 1 == chunkCount ? end : begin + file.size() * (i + 1) / chunkCount;
+			chunkEnd = chunkEnd <= chunkBegin ? chunkBegin : nextLine(chunkEnd - 1, end);
+
+			chunks[i].begin = chunkBegin;
+			chunks[i].end = chunkEnd;
+			chunkBegin = chunkEnd;
+		}
+
+		forEach(chunkCount, workers, [&](usz i) { parseObjChunk(chunks[i]); });
+
+		for (ObjChunk &chunk : chunks)
+			if (!chunk.error.empty()) {
+				error = chunk.error;
+				return false;
+			}
+
+		//Materials of all libraries, with the default material after them for faces without one
+
+		HashMap<String, u32> byName;
+		String directory = directoryOf(path);
+
+		for (ObjChunk &chunk : chunks)
+			for (const String &library : chunk.libraries)
+				parseMtl(directory + library, imported.materials, byName);
+
+		u32 defaultMaterial = u32(imported.materials.size());
+		imported.materials.push_back({});
+
+		//Where every chunk starts; the material of a chunk is the last one used before it
+
+		usz positionCount{}, normalCount{}, triangleCount{};
+		u32 material = defaultMaterial;
+		bool hasNormals{};
+
+		for (ObjChunk &chunk : chunks) {
+
+			chunk.positionBase = positionCount;
+			chunk.normalBase = normalCount;
+			chunk.triangleBase = triangleCount;
+			chunk.firstMaterial = material;
+
+			positionCount += chunk.positions.size() / 3;
+			normalCount += chunk.normals.size() / 3;
+			triangleCount += chunk.materials.size();
+			hasNormals |= chunk.hasNormals;
+
+			for (const String &name : chunk.names) {
+				auto it = byName.find(name);
+				chunk.nameMaterials.push_back(it == byName.end() ? defaultMaterial : it->second);
+			}
+
+			if (!chunk.nameMaterials.empty())
+				material = chunk.nameMaterials.back();
+		}
+
+		//Positions and normals of all chunks, so indices can point anywhere
+
+		List<f32> positions(positionCount * 3), normals(normalCount * 3);
+
+		forEach(chunkCount, workers, [&](usz i) {
+
+			const ObjChunk &chunk = chunks[i];
+
+			if (!chunk.positions.empty())
+				std::memcpy(positions.data() + chunk.positionBase * 3, chunk.positions.data(), chunk.positions.size() * sizeof(f32));
+
+			if (!chunk.normals.empty())
+				std::memcpy(normals.data() + chunk.normalBase * 3, chunk.normals.data(), chunk.normals.size() * sizeof(f32));
+		});
+
+		imported.resize(triangleCount, hasNormals);
+
+		forEach(chunkCount, workers, [&](usz i) {
+
+			ObjChunk &chunk = chunks[i];
+
+			for (const Pair<usz, i64> &earlier : chunk.earlier) {
+
+				i64 absolute = i64(earlier.first & 1 ? chunk.normalBase : chunk.positionBase) + earlier.second;
+
+				if (absolute < 0 || absolute > std::numeric_limits<i32>::max()) {
+					chunk.error = "relative index before the first vertex";
+					return;
+				}
+
+				chunk.corners[earlier.first] = i32(absolute);
+			}
+
+			auto resolve = [](i32 value, usz base) -> usz {
+				return value < 0 ? base + usz(-1 - i64(value)) : usz(value);
+			};
+
+			for (usz t = 0; t < chunk.materials.size(); ++t) {
+
+				usz triangle = chunk.triangleBase + t;
+				Vec3f32 p[3];
+
+				for (usz k = 0; k < 3; ++k) {
+
+					i32 value = chunk.corners[(t * 3 + k) * 2];
+					usz j = resolve(value, chunk.positionBase);
+
+					if (value == objNone || j >= positionCount) {
+						chunk.error = "index of a position out of bounds";
+						return;
+					}
+
+					p[k] = Vec3f32(positions[j * 3], positions[j * 3 + 1], positions[j * 3 + 2]);
+					imported.setPosition(triangle * 3 + k, p[k]);
+				}
+
+				if (hasNormals) {
+
+					bool missing{};
+
+					for (usz k = 0; k < 3; ++k) {
+
+						i32 value = chunk.corners[(t * 3 + k) * 2 + 1];
+
+						if (value == objNone) {
+							missing = true;
+							continue;
+						}
+
+						usz j = resolve(value, chunk.normalBase);
+
+						if (j >= normalCount) {
+							chunk.error = "index of a normal out of bounds";
+							return;
+						}
+
+						imported.setNormal(triangle * 3 + k, Vec3f32(normals[j * 3], normals[j * 3 + 1], normals[j * 3 + 2]));
+					}
+
+					if (missing) {
+
+						Vec3f32 n = faceNormal(p[0], p[1], p[2]);
+
+						for (usz k = 0; k < 3; ++k)
+							if (chunk.corners[(t * 3 + k) * 2 + 1] == objNone)
+								imported.setNormal(triangle * 3 + k, n);
+					}
+				}
+
+				i32 name = chunk.materials[t];
+				u32 mat = name < 0 ? chunk.firstMaterial : chunk.nameMaterials[name];
+
+				imported.materialOf[triangle] = mat;
+				chunk.usesDefault |= mat == defaultMaterial;
+			}
+		});
+
+		bool usesDefault{};
+
+		for (ObjChunk &chunk : chunks) {
+
+			if (!chunk.error.empty()) {
+				error = chunk.error;
+				return false;
+			}
+
+			usesDefault |= chunk.usesDefault;
+		}
+
+		//It's the last material, so removing it doesn't move the others
+
+		if (!usesDefault)
+			imported.materials.pop_back();
+
+		return true;
+	}
+
+	bool importObj(SceneGraph &scene, const String &path, SceneImport &result, WorkerPool *workers, bool upload) {
+
+		result = {};
+
+		ImportClock::time_point start = ImportClock::now();
+
+		MappedFile file(path);
+
+		if (!file.isOpen()) {
+			oic::System::log()->error(String("Import of ") + path + " failed; it couldn't be opened");
+			return false;
+		}
+
+		ImportedScene imported;
+		String error;
+
+		if (!parseObj(path, file, imported, workers, error)) {
+			oic::System::log()->error(String("Import of ") + path + " failed; " + error);
+			return false;
+		}
+
+		result.parseTime = lap(start);
+		return addToScene(scene, path, imported, result, workers, upload, start);
+	}
+
+	//JSON for glTF; numbers are f64 and objects keep their keys in order
+
+	struct Json {
+
+		enum class Type : u8 {
+			NUL,
+			BOOLEAN,
+			NUMBER,
+			STRING,
+			ARRAY,
+			OBJECT
+		};
+
+		Type type = Type::NUL;
+		bool boolean{};
+		f64 number{};
+		String string;
+
+		List<Json> values;		//Of an array or object
+		List<String> keys;		//Of an object
+
+		inline const Json *find(const String &key) const {
+
+			for (usz i = 0; i < keys.size(); ++i)
+				if (keys[i] == key)
+					return &values[i];
+
+			return nullptr;
+		}
+
+		inline const Json *at(usz i) const { return type == Type::ARRAY && i < values.size() ? &values[i] : nullptr; }
+		inline usz size() const { return type == Type::ARRAY ? values.size() : 0; }
+
+		inline f64 getNumber(const String &key, f64 def) const {
+			const Json *value = find(key);
+			return value && value->type == Type::NUMBER ? value->number : def;
+		}
+
+		inline String getString(const String &key) const {
+			const Json *value = find(key);
+			return value && value->type == Type::STRING ? value->string : String();
+		}
+
+		//Doubles are exact integers up to 2^53, so anything bigger isn't a valid size or index
+		static constexpr f64 maxInteger = 9007199254740992.0;
+
+		//Index into an array of the document; -1 if it's missing or not a valid index
+		inline i64 getIndex(const String &key) const {
+			const Json *value = find(key);
+			return value && value->type == Type::NUMBER && value->number >= 0 && value->number <= maxInteger ? i64(value->number) : -1;
+		}
+
+		//Non negative integer such as a count or byte offset; def if it's missing
+		//Returns false if it's negative, fractional, NaN or too big to be converted
+		inline bool getSize(const String &key, usz &out, usz def = 0) const {
+
+			const Json *value = find(key);
+
+			if (!value || value->type != Type::NUMBER) {
+				out = def;
+				return true;
+			}
+
+			f64 v = value->number;
+
+			if (!(v >= 0 && v <= maxInteger) || v != std::floor(v))
+				return false;
+
+			out = usz(v);
+			return true;
+		}
+	};
+
+	class JsonParser {
+
+		const char *c, *end;
+
+		static constexpr u32 maxDepth = 64;
+
+		inline void skip() {
+			while (c < end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n'))
+				++c;
+		}
+
+		inline bool expect(char v) {
+
+			skip();
+
+			if (c >= end || *c != v)
+				return false;
+
+			++c;
+			return true;
+		}
+
+		inline bool literal(const char *word, usz length) {
+
+			if (usz(end - c) < length || std::memcmp(c, word, length))
+				return false;
+
+			c += length;
+			return true;
+		}
+
+		static inline void appendUtf8(String &s, u32 code) {
+
+			if (code < 0x80)
+				s += char(code);
+
+			else if (code < 0x800) {
+				s += char(0xC0 | code >> 6);
+				s += char(0x80 | (code & 0x3F));
+			}
+
+			else if (code < 0x10000) {
+				s += char(0xE0 | code >> 12);
+				s += char(0x80 | (code >> 6 & 0x3F));
+				s += char(0x80 | (code & 0x3F));
+			}
+
+			else {
+				s += char(0xF0 | code >> 18);
+				s += char(0x80 | (code >> 12 & 0x3F));
+				s += char(0x80 | (code >> 6 & 0x3F));
+				s += char(0x80 | (code & 0x3F));
+			}
+		}
+
+		bool parseHex(u32 &code) {
+
+			if (end - c < 4)
+				return false;
+
+			std::from_chars_result res = std::from_chars(c, c + 4, code, 16);
+
+			if (res.ec != std::errc() || res.ptr != c + 4)
+				return false;
+
+			c += 4;
+			return true;
+		}
+
+		bool parseString(String &s) {
+
+			if (!expect('"'))
+				return false;
+
+			while (c < end && *c != '"') {
+
+				if (*c != '\\') {
+					s += *c++;
+					continue;
+				}
+
+				if (++c >= end)
+					return false;
+
+				switch (*c++) {
+
+					case '"':	s += '"'; break;
+					case '\\':	s += '\\'; break;
+					case '/':	s += '/'; break;
+					case 'b':	s += '\b'; break;
+					case 'f':	s += '\f'; break;
+					case 'n':	s += '\n'; break;
+					case 'r':	s += '\r'; break;
+					case 't':	s += '\t'; break;
+
+					//Surrogate pairs are combined
+
+					case 'u': {
+
+						u32 code{};
+
+						if (!parseHex(code))
+							return false;
+
+						if (code >= 0xD800 && code < 0xDC00 && end - c >= 6 && c[0] == '\\' && c[1] == 'u') {
+
+							c += 2;
+							u32 low{};
+
+							if (!parseHex(low) || low < 0xDC00 || low >= 0xE000)
+								return false;
+
+							code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+						}
+
+						appendUtf8(s, code);
+						break;
+					}
+
+					default:
+						return false;
+				}
+			}
+
+			return expect('"');
+		}
+
+		bool parseValue(Json &value, u32 depth) {
+
+			skip();
+
+			if (c >= end || depth > maxDepth)
+				return false;
+
+			switch (*c) {
+
+				case '{': {
+
+					++c;
+					value.type = Json::Type::OBJECT;
+
+					skip();
+
+					if (c < end && *c == '}') {
+						++c;
+						return true;
+					}
+
+					do {
+
+						value.keys.push_back({});
+						value.values.push_back({});
+
+						if (!parseString(value.keys.back()) || !expect(':') || !parseValue(value.values.back(), depth + 1))
+							return false;
+
+					} while (expect(','));
+
+					return expect('}');
+				}
+
+				case '[': {
+
+					++c;
+					value.type = Json::Type::ARRAY;
+
+					skip();
+
+					if (c < end && *c == ']') {
+						++c;
+						return true;
+					}
+
+					do {
+
+						value.values.push_back({});
+
+						if (!parseValue(value.values.back(), depth + 1))
+							return false;
+
+					} while (expect(','));
+
+					return expect(']');
+				}
+
+				case '"':
+					value.type = Json::Type::STRING;
+					return parseString(value.string);
+
+				case 't':
+					value.type = Json::Type::BOOLEAN;
+					value.boolean = true;
+					return literal("true", 4);
+
+				case 'f':
+					value.type = Json::Type::BOOLEAN;
+					return literal("false", 5);
+
+				case 'n':
+					return literal("null", 4);
+
+				default: {
+
+					value.type = Json::Type::NUMBER;
+
+					std::from_chars_result res = std::from_chars(c, end, value.number);
+
+					if (res.ec != std::errc())
+						return false;
+
+					c = res.ptr;
+					return true;
+				}
+			}
+		}
+
+	public:
+
+		JsonParser(const char *begin, const char *end): c(begin), end(end) {}
+
+		bool parse(Json &root) {
+
+			if (!parseValue(root, 0))
+				return false;
+
+			skip();
+			return c == end;
+		}
+	};
+
+	//glTF
+
+	struct GltfAccessor {
+
+		const u8 *data{};
+		usz count{}, stride{};
+		u32 componentType{}, components{};
+
+		inline Vec3f32 getVec3(usz i) const {
+			f32 v[3];
+			std::memcpy(v, data + i * stride, sizeof(v));
+			return Vec3f32(v[0], v[1], v[2]);
+		}
+
+		inline u32 getIndex(usz i) const {
+
+			const u8 *ptr = data + i * stride;
+
+			switch (componentType) {
+
+				case 5121:
+					return *ptr;
+
+				case 5123: {
+					u16 v;
+					std::memcpy(&v, ptr, sizeof(v));
+					return v;
+				}
+
+				default: {
+					u32 v;
+					std::memcpy(&v, ptr, sizeof(v));
+					return v;
+				}
+			}
+		}
+	};
+
+	//An accessor into the binary chunk; only the embedded buffer is supported
+
+	static bool getAccessor(
+		const Json &gltf, std::span<const u8> bin, i64 index, bool isIndices, GltfAccessor &accessor, String &error
+	) {
+
+		const Json *accessors = gltf.find("accessors"), *views = gltf.find("bufferViews");
+		const Json *info = accessors ? accessors->at(usz(index)) : nullptr;
+
+		if (index < 0 || !info) {
+			error = "accessor out of bounds";
+			return false;
+		}
+
+		const Json *view = views ? views->at(usz(info->getIndex("bufferView"))) : nullptr;
+
+		if (!view || info->find("sparse")) {
+			error = "accessors need a buffer view and can't be sparse";
+			return false;
+		}
+
+		if (view->getIndex("buffer") != 0 || bin.empty()) {
+			error = "only the buffer in the .glb is supported";
+			return false;
+		}
+
+		//Numbers are checked before they're converted, since they can be anything in the file
+
+		usz componentType{}, viewOffset{}, viewLength{}, offset{};
+
+		if (
+			!info->getSize("componentType", componentType) || !info->getSize("count", accessor.count) ||
+			!info->getSize("byteOffset", offset) || !view->getSize("byteOffset", viewOffset) ||
+			!view->getSize("byteLength", viewLength) || !view->getSize("byteStride", accessor.stride)
+		) {
+			error = "accessor has a count, offset, length or stride that isn't a valid size";
+			return false;
+		}
+
+		if (!accessor.count) {
+			error = "accessors can't be empty";
+			return false;
+		}
+
+		String type = info->getString("type");
+		accessor.components = type == "SCALAR" ? 1 : (type == "VEC3" ? 3 : 0);
+
+		bool valid = isIndices ?
+			accessor.components == 1 && (componentType == 5121 || componentType == 5123 || componentType == 5125) :
+			accessor.components == 3 && componentType == 5126;
+
+		if (!valid) {
+			error = isIndices ? "indices have to be u8, u16 or u32" : "positions and normals have to be f32 vec3";
+			return false;
+		}
+
+		accessor.componentType = u32(componentType);
+
+		usz componentSize = componentType == 5121 ? 1 : (componentType == 5123 ? 2 : 4);
+		usz elementSize = componentSize * accessor.components;
+
+		if (!accessor.stride)
+			accessor.stride = elementSize;
+
+		//The last element has to end inside the view; written so nothing can overflow
+
+		if (
+			viewOffset > bin.size() || viewLength > bin.size() - viewOffset || accessor.stride < elementSize ||
+			offset > viewLength || elementSize > viewLength - offset ||
+			accessor.count - 1 > (viewLength - offset - elementSize) / accessor.stride
+		) {
+			error = "accessor out of the bounds of its buffer";
+			return false;
+		}
+
+		accessor.data = bin.data() + viewOffset + offset;
+		return true;
+	}
+
+	//Affine transforms as 3x4, row major
+
+	using Transform = f32[3][4];
+
+	static void multiply(const Transform &a, const Transform &b, Transform &out) {
+		for (usz i = 0; i < 3; ++i)
+			for (usz j = 0; j < 4; ++j)
+				out[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j] + (j == 3 ? a[i][3] : 0);
+	}
+
+	//Matrix (column major) or translation, rotation (quaternion) and scale
+
+	static void getLocalTransform(const Json &node, Transform &out) {
+
+		const Json *matrix = node.find("matrix");
+
+		if (matrix && matrix->size() == 16) {
+
+			for (usz i = 0; i < 3; ++i)
+				for (usz j = 0; j < 4; ++j)
+					out[i][j] = f32(matrix->values[j * 4 + i].number);
+
+			return;
+		}
+
+		auto component = [&](const char *key, usz i, f32 def) {
+			const Json *values = node.find(key);
+			const Json *value = values ? values->at(i) : nullptr;
+			return value ? f32(value->number) : def;
+		};
+
+		f32 x = component("rotation", 0, 0), y = component("rotation", 1, 0);
+		f32 z = component("rotation", 2, 0), w = component("rotation", 3, 1);
+
+		const f32 rotation[3][3] = {
+			{ 1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w) },
+			{ 2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w) },
+			{ 2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y) }
+		};
+
+		for (usz i = 0; i < 3; ++i) {
+
+			for (usz j = 0; j < 3; ++j)
+				out[i][j] = rotation[i][j] * component("scale", j, 1);
+
+			out[i][3] = component("translation", i, 0);
+		}
+	}
+
+	struct GltfDraw {
+		u32 mesh;
+		Instance transform;		//Used for its transform and inverse
+	};
+
+	static void collectNodes(const Json &nodes, usz index, const Transform &parent, List<GltfDraw> &draws, u32 depth) {
+
+		const Json *node = nodes.at(index);
+
+		//Depth is limited, since a node could be its own ancestor
+
+		if (!node || depth > 64)
+			return;
+
+		Transform local, world;
+		getLocalTransform(*node, local);
+		multiply(parent, local, world);
+
+		i64 mesh = node->getIndex("mesh");
+
+		if (mesh >= 0)
+			draws.push_back({ u32(mesh), Instance(u32(mesh), world) });
+
+		if (const Json *children = node->find("children"))
+			for (const Json &child : children->values)
+				collectNodes(nodes, usz(child.number), world, draws, depth + 1);
+	}
+
+	//A range of triangles of a primitive that's drawn by a node
+
+	struct GltfJob {
+		const GltfDraw *draw;
+		GltfAccessor positions, normals, indices;
+		bool hasNormals, hasIndices;
+		u32 material;
+		usz begin, end, target;		//Triangles and where they go
+	};
+
+	static bool parseGlb(const MappedFile &file, ImportedScene &imported, WorkerPool *workers, String &error) {
+
+		//Header and chunks; JSON first, then the optional binary chunk
+
+		const u8 *data = file.data();
+		usz size = file.size();
+
+		u32 header[3]{};
+
+		if (size >= sizeof(header))
+			std::memcpy(header, data, sizeof(header));
+
+		if (size < sizeof(header) || header[0] != 0x46546C67 || header[1] != 2 || header[2] > size) {
+			error = "it's not a glTF 2.0 binary";
+			return false;
+		}
+
+		size = header[2];
+
+		std::span<const u8> json, bin;
+
+		for (usz offset = sizeof(header); offset + 8 <= size; ) {
+
+			u32 chunk[2];
+			std::memcpy(chunk, data + offset, sizeof(chunk));
+			offset += sizeof(chunk);
+
+			if (chunk[0] > size - offset) {
+				error = "chunk out of bounds";
+				return false;
+			}
+
+			if (chunk[1] == 0x4E4F534A && json.empty())
+				json = { data + offset, chunk[0] };
+
+			else if (chunk[1] == 0x004E4942 && bin.empty())
+				bin = { data + offset, chunk[0] };
+
+			offset += (usz(chunk[0]) + 3) & ~usz(3);
+		}
+
+		Json gltf;
+
+		if (json.empty() || !JsonParser((const char*) json.data(), (const char*) json.data() + json.size()).parse(gltf)) {
+			error = "invalid JSON chunk";
+			return false;
+		}
+
+		//Meshes placed by the nodes of the default scene; without scenes every root node is used
+
+		List<GltfDraw> draws;
+
+		const Json *nodes = gltf.find("nodes"), *scenes = gltf.find("scenes");
+		const Transform identity = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+
+		if (nodes) {
+
+			i64 sceneId = gltf.getIndex("scene");
+			const Json *scene = scenes ? scenes->at(usz(sceneId < 0 ? 0 : sceneId)) : nullptr;
+
+			if (scene) {
+				if (const Json *roots = scene->find("nodes"))
+					for (const Json &root : roots->values)
+						collectNodes(*nodes, usz(root.number), identity, draws, 0);
+			}
+
+			else {
+
+				List<bool> isChild(nodes->size());
+
+				for (const Json &node : nodes->values)
+					if (const Json *children = node.find("children"))
+						for (const Json &child : children->values)
+							if (usz(child.number) < isChild.size())
+								isChild[usz(child.number)] = true;
+
+				for (usz i = 0; i < isChild.size(); ++i)
+					if (!isChild[i])
+						collectNodes(*nodes, i, identity, draws, 0);
+			}
+		}
+
+		//Materials by their metallic roughness factors
+
+		const Json *materials = gltf.find("materials");
+		usz materialCount = materials ? materials->size() : 0;
+
+		for (usz i = 0; i < materialCount; ++i) {
+
+			const Json &info = materials->values[i];
+			ImportedMaterial mat;
+
+			f32 base[4] = { 1, 1, 1, 1 };
+			mat.metallic = mat.roughness = 1;
+
+			if (const Json *pbr = info.find("pbrMetallicRoughness")) {
+
+				if (const Json *factor = pbr->find("baseColorFactor"))
+					for (usz c = 0; c < 4 && c < factor->size(); ++c)
+						base[c] = f32(factor->values[c].number);
+
+				mat.metallic = f32(pbr->getNumber("metallicFactor", 1));
+				mat.roughness = f32(pbr->getNumber("roughnessFactor", 1));
+			}
+
+			if (const Json *emissive = info.find("emissiveFactor"); emissive && emissive->size() == 3)
+				mat.emission = Vec3f32(f32(emissive->values[0].number), f32(emissive->values[1].number), f32(emissive->values[2].number));
+
+			mat.albedo = Vec3f32(base[0], base[1], base[2]);
+			mat.transparency = info.getString("alphaMode") == "BLEND" ? std::clamp(1 - base[3], 0.f, 1.f) : 0;
+
+			imported.materials.push_back(mat);
+		}
+
+		//Split the triangle lists of every drawn primitive into jobs
+
+		const Json *meshes = gltf.find("meshes");
+
+		List<GltfJob> jobs;
+		usz triangleCount{};
+		bool hasNormals{}, usesDefault{};
+
+		for (const GltfDraw &draw : draws) {
+
+			const Json *mesh = meshes ? meshes->at(draw.mesh) : nullptr;
+			const Json *primitives = mesh ? mesh->find("primitives") : nullptr;
+
+			if (!primitives) {
+				error = "node refers to a mesh that doesn't exist";
+				return false;
+			}
+
+			for (const Json &primitive : primitives->values) {
+
+				if (primitive.getNumber("mode", 4) != 4)
+					continue;
+
+				GltfJob job{ &draw };
+
+				const Json *attributes = primitive.find("attributes");
+				i64 normals = attributes ? attributes->getIndex("NORMAL") : -1;
+
+				if (!attributes || !getAccessor(gltf, bin, attributes->getIndex("POSITION"), false, job.positions, error))
+					return false;
+
+				if ((job.hasNormals = normals >= 0)) {
+
+					if (!getAccessor(gltf, bin, normals, false, job.normals, error))
+						return false;
+
+					if (job.normals.count != job.positions.count) {
+						error = "there have to be as many normals as positions";
+						return false;
+					}
+				}
+
+				i64 indices = primitive.getIndex("indices");
+
+				if ((job.hasIndices = indices >= 0) && !getAccessor(gltf, bin, indices, true, job.indices, error))
+					return false;
+
+				i64 material = primitive.getIndex("material");
+
+				if (material >= i64(materialCount)) {
+					error = "material out of bounds";
+					return false;
+				}
+
+				job.material = material < 0 ? u32(materialCount) : u32(material);
+				usesDefault |= material < 0;
+				hasNormals |= job.hasNormals;
+
+				usz triangles = (job.hasIndices ? job.indices.count : job.positions.count) / 3;
+
+				for (usz begin = 0; begin < triangles; begin += importBlock) {
+					job.begin = begin;
+					job.end = std::min(triangles, begin + importBlock);
+					job.target = triangleCount + begin;
+					jobs.push_back(job);
+				}
+
+				triangleCount += triangles;
+			}
+		}
+
+		if (usesDefault)
+			imported.materials.push_back({});
+
+		imported.resize(triangleCount, hasNormals);
+
+		//Triangles in world space; normals go through the inverse transpose
+
+		List<u8> outOfBounds(jobs.size());
+
+		forEach(jobs.size(), workers, [&](usz i) {
+
+			const GltfJob &job = jobs[i];
+			const Instance &transform = job.draw->transform;
+			const f32 (&m)[3][4] = transform.worldToObject;
+
+			for (usz t = job.begin; t < job.end; ++t) {
+
+				usz triangle = job.target + t - job.begin;
+				Vec3f32 p[3];
+				u32 vertex[3];
+
+				for (usz k = 0; k < 3; ++k) {
+
+					vertex[k] = job.hasIndices ? job.indices.getIndex(t * 3 + k) : u32(t * 3 + k);
+
+					if (vertex[k] >= job.positions.count) {
+						outOfBounds[i] = true;
+						return;
+					}
+
+					p[k] = transform.toWorld(job.positions.getVec3(vertex[k]));
+					imported.setPosition(triangle * 3 + k, p[k]);
+				}
+
+				if (hasNormals) {
+
+					Vec3f32 face = faceNormal(p[0], p[1], p[2]);
+
+					for (usz k = 0; k < 3; ++k) {
+
+						if (!job.hasNormals) {
+							imported.setNormal(triangle * 3 + k, face);
+							continue;
+						}
+
+						Vec3f32 ln = job.normals.getVec3(vertex[k]);
+
+						Vec3f32 n(
+							m[0][0] * ln.x + m[1][0] * ln.y + m[2][0] * ln.z,
+							m[0][1] * ln.x + m[1][1] * ln.y + m[2][1] * ln.z,
+							m[0][2] * ln.x + m[1][2] * ln.y + m[2][2] * ln.z
+						);
+
+						f32 len = std::sqrt(dot3(n, n));
+						imported.setNormal(triangle * 3 + k, len > 0 ? n * (1 / len) : face);
+					}
+				}
+
+				imported.materialOf[triangle] = job.material;
+			}
+		});
+
+		for (u8 invalid : outOfBounds)
+			if (invalid) {
+				error = "index of a vertex out of bounds";
+				return false;
+			}
+
+		return true;
+	}
+
+	bool importGlb(SceneGraph &scene, const String &path, SceneImport &result, WorkerPool *workers, bool upload) {
+
+		result = {};
+
+		ImportClock::time_point start = ImportClock::now();
+
+		MappedFile file(path);
+
+		if (!file.isOpen()) {
+			oic::System::log()->error(String("Import of ") + path + " failed; it couldn't be opened");
+			return false;
+		}
+
+		ImportedScene imported;
+		String error;
+
+		if (!parseGlb(file, imported, workers, error)) {
+			oic::System::log()->error(String("Import of ") + path + " failed; " + error);
+			return false;
+		}
+
+		result.parseTime = lap(start);
+		return addToScene(scene, path, imported, result, workers, upload, start);
+	}
+
+	bool importScene(SceneGraph &scene, const String &path, SceneImport &result, WorkerPool *workers, bool upload) {
+
+		usz dot = path.find_last_of('.');
+		String extension = dot == String::npos ? String() : path.substr(dot + 1);
+
+		for (char &c : extension)
+			c = char(std::tolower(c));
+
+		if (extension == "obj")
+			return importObj(scene, path, result, workers, upload);
+
+		if (extension == "glb")
+			return importGlb(scene, path, result, workers, upload);
+
+		result = {};
+		oic::System::log()->error(String("Import of ") + path + " failed; only .obj and .glb are supported");
+		return false;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "helpers/worker_pool.hpp"
+
+namespace igx {
+
+	static thread_local bool isInsideJob{};
+
+	WorkerPool::WorkerPool(usz threads) {
+
+		for (usz i = 1; i < threads; ++i)
+			workers.emplace_back([this]() { work(); });
+	}
+
+	WorkerPool::~WorkerPool() {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+
+		wake.notify_all();
+
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+
+	void WorkerPool::runJobs() {
+		for (usz i; (i = next++) < jobCount; )
+			(*job)(i);
+	}
+
+	void WorkerPool::work() {
+
+		isInsideJob = true;
+
+		u64 seen{};
+
+		while (true) {
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&]() { return stop || generation != seen; });
+
+				if (stop)
+					return;
+
+				seen = generation;
+			}
+
+			runJobs();
+
+			//Every worker checks in for every generation,
+			//so none of them can still be reading the job once parallelFor returns
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (!--busy)
+				finished.notify_all();
+		}
+	}
+
+	void WorkerPool::parallelFor(usz count, const std::function<void(usz)> &f) {
+
+		if (isInsideJob || workers.empty() || count <= 1) {
+
+			for (usz i = 0; i < count; ++i)
+				f(i);
+
+			return;
+		}
+
+		std::lock_guard<std::mutex> call(callMutex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			job = &f;
+			jobCount = count;
+			next = 0;
+			busy = workers.size();
+			++generation;
+		}
+
+		wake.notify_all();
+
+		isInsideJob = true;
+		runJobs();
+		isInsideJob = false;
+
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [&]() { return !busy; });
+
+		job = nullptr;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,234 @@
+#include "graphics/graphics.hpp"
+#include "gui/gui.hpp"
+#include "helpers/factory.hpp"
+#include "helpers/scene_graph.hpp"
+#include "helpers/dirty_bitset.hpp"
+#include "helpers/scene_importer.hpp"
+#include "helpers/scene_file.hpp"
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+
+using namespace igx::ui;
+using namespace igx;
+using namespace oic;
+
+//Microbenchmarks of the scene graph
+//Build it in release; the timings of a debug build don't say anything
+
+using BenchClock = std::chrono::high_resolution_clock;
+
+static inline f64 secondsSince(BenchClock::time_point start) {
+	return std::chrono::duration<f64>(BenchClock::now() - start).count();
+}
+
+static void report(const String &name, f64 seconds, usz count) {
+	oic::System::log()->debug(
+		name + ": " + std::to_string(seconds * 1e3) + " ms, " +
+		std::to_string(count ? seconds * 1e9 / count : 0) + " ns per object"
+	);
+}
+
+//Random triangles in a 100^3 box; the same every run
+
+static List<Triangle> makeTriangles(usz count, u32 seed = 1) {
+
+	List<Triangle> triangles(count);
+
+	auto next = [&seed]() {
+		seed = seed * 1664525 + 1013904223;
+		return f32(seed >> 8) / f32(1 << 24);
+	};
+
+	for (Triangle &tri : triangles) {
+		Vec3f32 p(next() * 100, next() * 100, next() * 100);
+		tri = Triangle(p, p + Vec3f32(next(), 0, 0), p + Vec3f32(0, next(), 1));
+	}
+
+	return triangles;
+}
+
+//Adding one object at a time is O(1), so the time per add should stay the same as the scene grows
+//Deleted slots are reused through the free list, so adding into holes should be as fast as appending
+
+static void benchAdd(GUI &gui, FactoryContainer &factory) {
+
+	for (usz count : { usz(1) << 16, usz(1) << 18, usz(1) << 20 }) {
+
+		//Reserved up front, so only the adds are timed
+
+		SceneGraph scene(gui, factory, "Bench add", "", u32(count));
+
+		u32 material = scene.getMaterialHandle(
+			scene.addNonGeometry(Material(Vec3f32(1, 1, 1), Vec3f32(), Vec3f32(), 0, 1, 0))
+		);
+
+		List<Triangle> triangles = makeTriangles(count);
+		List<u64> ids(count);
+
+		BenchClock::time_point start = BenchClock::now();
+
+		for (usz i = 0; i < count; ++i)
+			ids[i] = scene.addGeometry(triangles[i], material);
+
+		report("add " + std::to_string(count) + " triangles", secondsSince(start), count);
+
+		List<u64> every2nd;
+
+		for (usz i = 0; i < count; i += 2)
+			every2nd.push_back(ids[i]);
+
+		start = BenchClock::now();
+		scene.del(every2nd);
+		report("delete " + std::to_string(every2nd.size()) + " triangles", secondsSince(start), every2nd.size());
+
+		start = BenchClock::now();
+
+		for (usz i = 0; i < count; i += 2)
+			scene.addGeometry(triangles[i], material);
+
+		report("add " + std::to_string(every2nd.size()) + " triangles into holes", secondsSince(start), every2nd.size());
+	}
+
+	List<Triangle> triangles = makeTriangles(usz(1) << 20);
+
+	SceneGraph scene(gui, factory, "Bench add batch", "", u32(triangles.size()));
+
+	u32 material = scene.getMaterialHandle(
+		scene.addNonGeometry(Material(Vec3f32(1, 1, 1), Vec3f32(), Vec3f32(), 0, 1, 0))
+	);
+
+	BenchClock::time_point start = BenchClock::now();
+	scene.addBatch(std::span<const Triangle>(triangles), std::span<const u32>(&material, 1));
+	report("addBatch " + std::to_string(triangles.size()) + " triangles", secondsSince(start), triangles.size());
+}
+
+//Finding the dirty ranges of 1M objects; with a bitset that's scanned per word and with a bool per object,
+//which is how SceneGraph::update used to walk them
+//Few dirty objects are where the bitset should win, since it skips clean words at once
+
+static void benchDirtyRanges() {
+
+	static constexpr usz count = usz(1) << 20, repeats = 100;
+
+	for (usz dirty : { usz(10), count / 64, count / 2 }) {
+
+		List<bool> flags(count);
+		DirtyBitset bits(count);
+
+		u32 seed = 1;
+
+		for (usz i = 0; i < dirty; ++i) {
+			seed = seed * 1664525 + 1013904223;
+			flags[seed % count] = true;
+			bits.set(seed % count);
+		}
+
+		usz boolObjects{}, bitsetObjects{};
+		BenchClock::time_point start = BenchClock::now();
+
+		for (usz r = 0; r < repeats; ++r)
+			for (usz i = 0; i < count; ) {
+
+				if (!flags[i]) {
+					++i;
+					continue;
+				}
+
+				usz end = i + 1;
+
+				while (end < count && flags[end])
+					++end;
+
+				boolObjects += end - i;
+				i = end;
+			}
+
+		f64 boolTime = secondsSince(start) / repeats;
+		start = BenchClock::now();
+
+		for (usz r = 0; r < repeats; ++r)
+			bits.forEachRange(0, count, [&bitsetObjects](usz begin, usz end) { bitsetObjects += end - begin; });
+
+		f64 bitsetTime = secondsSince(start) / repeats;
+
+		oicAssert("DirtyBitset and List<bool> should find the same objects", boolObjects == bitsetObjects);
+
+		oic::System::log()->debug(
+			"dirty ranges of " + std::to_string(count) + " objects with " + std::to_string(bitsetObjects / repeats) + " dirty: " +
+			std::to_string(boolTime * 1e6) + " us with List<bool>, " +
+			std::to_string(bitsetTime * 1e6) + " us with DirtyBitset (" +
+			std::to_string(boolTime / bitsetTime) + "x)"
+		);
+	}
+}
+
+//Importing parses and encodes every triangle, while loading an .igxs copies them as they're stored
+//Both get the same 1M triangles, since the .igxs is saved from the imported scene
+
+static void benchImportLoad(GUI &gui, FactoryContainer &factory) {
+
+	static constexpr usz count = usz(1) << 20;
+
+	std::filesystem::path dir = std::filesystem::temp_directory_path();
+	String objPath = (dir / "igx_bench.obj").string(), scenePath = (dir / "igx_bench.igxs").string();
+
+	{
+		List<Triangle> triangles = makeTriangles(count);
+		std::ofstream obj(objPath);
+
+		for (const Triangle &tri : triangles)
+			for (const Vec3f32 &p : { tri.p0, tri.p1, tri.p2 })
+				obj << "v " << p.x << ' ' << p.y << ' ' << p.z << '\n';
+
+		for (usz i = 0; i < count; ++i)
+			obj << "f " << i * 3 + 1 << ' ' << i * 3 + 2 << ' ' << i * 3 + 3 << '\n';
+	}
+
+	SceneImport imported;
+	SceneLoad loaded, trusted;
+
+	{
+		SceneGraph scene(gui, factory, "Bench import", "");
+
+		if (!importScene(scene, objPath, imported, &factory.getWorkers()) || !saveScene(scene, scenePath)) {
+			oic::System::log()->error("Couldn't import and save the benchmark scene");
+			return;
+		}
+	}
+
+	{
+		SceneGraph scene(gui, factory, "Bench load", "");
+		loadScene(scene, scenePath, loaded, &factory.getWorkers());
+	}
+
+	{
+		SceneGraph scene(gui, factory, "Bench load trusted", "");
+		loadScene(scene, scenePath, trusted, &factory.getWorkers(), false);
+	}
+
+	std::filesystem::remove(objPath);
+	std::filesystem::remove(scenePath);
+
+	report("import " + std::to_string(count) + " triangles from .obj", imported.getTime(), count);
+	report("load them from .igxs", loaded.getTime(), count);
+	report("load them from .igxs without verifying", trusted.getTime(), count);
+
+	if (loaded.getTime() > 0)
+		oic::System::log()->debug("loading is " + std::to_string(imported.getTime() / loaded.getTime()) + "x as fast as importing");
+}
+
+int main() {
+
+	benchDirtyRanges();
+
+	Graphics g("Igx bench", 1, "Igx", 1);
+
+	GUI gui(g);
+	FactoryContainer factory(g);
+
+	benchAdd(gui, factory);
+	benchImportLoad(gui, factory);
+
+	return 0;
+}
\ No newline at end of file
@@ -12,6 +12,12 @@
 #include "input/keyboard.hpp"
 #include "input/mouse.hpp"
 #include "utils/math.hpp"
+#include "helpers/scene_graph.hpp"
+#include "helpers/factory.hpp"
+#include "helpers/bulk_encode.hpp"
+#include <random>
+#include <cstring>
+#include <limits>
 
 using namespace igx::ui;
 using namespace igx;
@@ -529,6 +535,349 @@ struct TestViewportInterface : public ViewportInterface {
 	}
 };
 
+//The bulk encoders have to give the same bytes as the constructors, including for input they leave to the constructors
+//Input is random, with zero, straight up and down, degenerate, NaN, infinite and out of range values in between
+
+static void verifyBulkEncode() {
+
+	static constexpr usz count = 4099;		//Not a multiple of 4, so the scalar tail is used too
+
+	List<f32> data[12];
+	u32 state = 0x9E3779B9;
+
+	for (List<f32> &arr : data) {
+
+		arr.resize(count * 3);
+
+		for (f32 &v : arr) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			v = f32(state >> 8) / f32(1 << 24) * 4 - 2;
+		}
+	}
+
+	//Halfway between two halves (rounded to even, either way), the smallest normal half and subnormal halves
+
+	const f32 specials[] = {
+		0.f, -0.f, 1.f, -1.f, 65504.f, 65519.f, 65520.f, 1e-5f, 1e-8f, 2049.f, 1e30f,
+		1.00048828125f, -1.00146484375f, 0x1p-14f, 0x1.ffcp-15f, 6e-8f,
+		std::numeric_limits<f32>::infinity(), std::numeric_limits<f32>::quiet_NaN()
+	};
+
+	for (usz i = 0; i < count * 3; i += 7)
+		data[i % 12][i] = specials[i / 7 % std::size(specials)];
+
+	//Straight up and down, zero normals and degenerate triangles
+
+	for (usz i = 0; i < 64; ++i) {
+
+		usz v = i * 37 % count * 3;
+
+		data[3][v] = data[4][v] = 0;
+		data[5][v] = i & 1 ? 1.f : -1.f;
+
+		if (i & 2)
+			data[5][v] = 0;
+
+		data[0][v + 1] = data[0][v];
+		data[1][v + 1] = data[1][v];
+		data[2][v + 1] = data[2][v];
+	}
+
+	Vec3Arrays p{ data[0].data(), data[1].data(), data[2].data() };
+	Vec3Arrays n{ data[3].data(), data[4].data(), data[5].data() };
+	Vec3Arrays c{ data[6].data(), data[7].data(), data[8].data() };
+
+	auto check = [](const char *what, const void *a, const void *b, usz size) {
+		if (std::memcmp(a, b, size))
+			oic::System::log()->fatal(String("Bulk encoded ") + what + " don't match their constructors");
+	};
+
+	for (bool smooth : { false, true }) {
+
+		List<Triangle> encoded(count), expected(count);
+		encodeTriangles(p, smooth ? n : Vec3Arrays{}, encoded);
+
+		for (usz i = 0; i < count; ++i)
+			expected[i] = smooth ?
+				Triangle(p[i * 3], p[i * 3 + 1], p[i * 3 + 2], n[i * 3], n[i * 3 + 1], n[i * 3 + 2]) :
+				Triangle(p[i * 3], p[i * 3 + 1], p[i * 3 + 2]);
+
+		//A 2 byte normal codec pads every vertex, so only the members are compared
+
+		const char *what = smooth ? "triangles with normals" : "triangles";
+
+		for (usz i = 0; i < count; ++i) {
+
+			const Triangle &a = encoded[i], &b = expected[i];
+
+			check(what, &a.p0, &b.p0, sizeof(a.p0));
+			check(what, &a.p1, &b.p1, sizeof(a.p1));
+			check(what, &a.p2, &b.p2, sizeof(a.p2));
+			check(what, &a.n0, &b.n0, sizeof(a.n0));
+			check(what, &a.n1, &b.n1, sizeof(a.n1));
+			check(what, &a.n2, &b.n2, sizeof(a.n2));
+		}
+	}
+
+	List<Light> directional = encodeDirectionalLights(n, c, count);
+	List<Light> point = encodePointLights(p, c, data[9].data(), data[10].data(), count, 2);
+
+	for (usz i = 0; i < count; ++i) {
+
+		Light expectedDirectional(n[i], c[i]), expectedPoint(p[i], c[i], data[9][i], data[10][i], 2);
+
+		check("directional lights", &directional[i], &expectedDirectional, sizeof(Light));
+		check("point lights", &point[i], &expectedPoint, sizeof(Light));
+	}
+
+	//Unorms are only defined in [0, 1]
+
+	for (f32 &v : data[11])
+		v = v == v ? std::min(std::abs(v) * 0.5f, 1.f) : 0;
+
+	List<Material> materials = encodeMaterials(p, n, c, data[11].data(), data[11].data() + count, data[9].data(), count);
+
+	for (usz i = 0; i < count; ++i) {
+		Material expected(p[i], n[i], c[i], data[11][i], data[11][count + i], data[9][i]);
+		check("materials", &materials[i], &expected, sizeof(Material));
+	}
+}
+
+//Every object has to stay where its id says it is while compaction is spread over updates
+//Deleting the last object and more than the budget of others used to leave holes past the end,
+//which the next add then treated as free and wrote over live objects
+
+static void verifyCompaction(Graphics &g) {
+
+	GUI gui(g);
+	FactoryContainer factory(g);
+	SceneGraph scene(gui, factory, "Compaction test", "");
+
+	scene.setCompactionBudget(64);
+
+	u32 material = scene.getMaterialHandle(
+		scene.addNonGeometry(Material(Vec3f32(1, 1, 1), Vec3f32(), Vec3f32(), 0, 1, 0))
+	);
+
+	std::mt19937 gen(2);
+	std::uniform_real_distribution<f32> pos(-50, 50);
+
+	HashMap<u64, Triangle> expected;
+
+	auto add = [&](usz count) {
+
+		List<Triangle> triangles(count);
+
+		for (Triangle &tri : triangles) {
+			Vec3f32 p(pos(gen), pos(gen), pos(gen));
+			tri = Triangle(p, p + Vec3f32(1, 0, 0), p + Vec3f32(0, 1, 0));
+		}
+
+		List<u64> ids = scene.addBatch(std::span<const Triangle>(triangles), std::span<const u32>(&material, 1));
+
+		for (usz i = 0; i < count; ++i)
+			expected[ids[i]] = triangles[i];
+
+		return ids;
+	};
+
+	auto del = [&](const List<u64> &ids) {
+
+		scene.del(ids);
+
+		for (u64 id : ids)
+			expected.erase(id);
+	};
+
+	auto verify = [&](const char *when) {
+
+		std::span<const Triangle> triangles = scene.getObjects<Triangle>();
+
+		for (auto &[id, tri] : expected) {
+
+			const SceneGraph::Entry *entry = scene.find(id);
+
+			if (
+				!entry || entry->index >= triangles.size() ||
+				std::memcmp(&triangles[entry->index].p0, &tri.p0, sizeof(tri.p0)) ||
+				std::memcmp(&triangles[entry->index].p1, &tri.p1, sizeof(tri.p1)) ||
+				std::memcmp(&triangles[entry->index].p2, &tri.p2, sizeof(tri.p2))
+			)
+				oic::System::log()->fatal(String("Scene graph object was moved or overwritten ") + when);
+		}
+	};
+
+	List<u64> ids = add(1024);
+
+	List<u64> deleted = { ids.back() };
+
+	for (usz i = 0; i < 800; i += 4)
+		deleted.push_back(ids[i]);
+
+	del(deleted);
+	scene.update(0);
+
+	add(256);
+	scene.update(0);
+	verify("after adding while compaction was still busy");
+
+	for (usz i = 0; i < 8; ++i)
+		scene.update(0);
+
+	verify("after compaction finished");
+}
+
+//Geometry of a deleted material has to fall back to material 0,
+//rather than switching to the next material that reuses the handle
+
+static void verifyMaterialDelete(Graphics &g) {
+
+	GUI gui(g);
+	FactoryContainer factory(g);
+	SceneGraph scene(gui, factory, "Material delete test", "");
+
+	u64 first = scene.addNonGeometry(Material(Vec3f32(1, 1, 1), Vec3f32(), Vec3f32(), 0, 1, 0));
+	u64 second = scene.addNonGeometry(Material(Vec3f32(1, 0, 0), Vec3f32(), Vec3f32(), 0, 1, 0));
+
+	u32 handle = scene.getMaterialHandle(second);
+	u64 triangle = scene.addGeometry(Triangle(Vec3f32(), Vec3f32(1, 0, 0), Vec3f32(0, 1, 0)), handle);
+	scene.update(0);
+
+	scene.del(std::span<const u64>(&second, 1));
+
+	u32 added = scene.getMaterialHandle(
+		scene.addNonGeometry(Material(Vec3f32(0, 1, 0), Vec3f32(), Vec3f32(), 0, 1, 0))
+	);
+
+	scene.update(0);
+
+	const SceneGraph::Entry *entry = scene.find(triangle);
+
+	if (!entry || entry->material != 0)
+		oic::System::log()->fatal("Geometry of a deleted material didn't fall back to material 0");
+
+	if (added == handle && entry->material == added)
+		oic::System::log()->fatal("Geometry of a deleted material switched to the material that reused its handle");
+
+	//Material 0 itself is never reused, since it's the fallback
+
+	scene.del(std::span<const u64>(&first, 1));
+
+	u32 replacement = scene.getMaterialHandle(
+		scene.addNonGeometry(Material(Vec3f32(0, 0, 1), Vec3f32(), Vec3f32(), 0, 1, 0))
+	);
+
+	scene.update(0);
+
+	if (!replacement || replacement == u32_MAX)
+		oic::System::log()->fatal("Material handle 0 was reused after its material was deleted");
+}
+
+//Check the BVH of the scene graph against brute force after it's built, refit and rebuilt in the background
+
+static void verifySceneBVH(Graphics &g) {
+
+	GUI gui(g);
+	FactoryContainer factory(g);
+	SceneGraph scene(gui, factory, "BVH test", "");
+
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<f32> pos(-50, 50), offset(-1, 1);
+
+	auto randomTriangle = [&](f32 size) {
+		Vec3f32 p(pos(gen), pos(gen), pos(gen));
+		return Triangle(p, p + Vec3f32(offset(gen), offset(gen), offset(gen)) * size, p + Vec3f32(offset(gen), offset(gen), offset(gen)) * size);
+	};
+
+	auto verify = [&scene](const char *when) {
+		if (usz mismatches = scene.verifyBVH(4096))
+			oic::System::log()->fatal(String("BVH didn't match brute force ") + when + ": " + std::to_string(mismatches) + " rays");
+	};
+
+	u32 material = scene.getMaterialHandle(
+		scene.addNonGeometry(Material(Vec3f32(1, 1, 1), Vec3f32(), Vec3f32(), 0, 1, 0))
+	);
+
+	List<Triangle> triangles(4096), meshTriangles(256);
+	List<Cube> cubes(256);
+	List<Instance> instances(16);
+
+	for (Triangle &tri : triangles)
+		tri = randomTriangle(2);
+
+	for (Triangle &tri : meshTriangles)
+		tri = randomTriangle(0.1f);
+
+	for (Cube &cube : cubes) {
+		Vec3f32 p(pos(gen), pos(gen), pos(gen));
+		cube = { p, p + Vec3f32(1 + offset(gen), 1 + offset(gen), 1 + offset(gen)) };
+	}
+
+	u32 mesh = scene.addMesh(meshTriangles);
+
+	for (Instance &instance : instances) {
+
+		const f32 transform[3][4] = {
+			{ 0.1f, 0, 0, pos(gen) },
+			{ 0, 0.1f, 0, pos(gen) },
+			{ 0, 0, 0.1f, pos(gen) }
+		};
+
+		instance = Instance(mesh, transform);
+	}
+
+	List<u64> triangleIds = scene.addBatch(std::span<const Triangle>(triangles), std::span<const u32>(&material, 1));
+	scene.addBatch(std::span<const Cube>(cubes), std::span<const u32>(&material, 1));
+	scene.addBatch(std::span<const Instance>(instances), std::span<const u32>(&material, 1));
+
+	scene.update(0);
+	verify("after it was built");
+
+	//Move a few triangles a bit, which only refits
+
+	auto move = [&](usz count, f32 size) {
+
+		List<u64> ids(count);
+		List<Triangle> moved(count);
+
+		for (usz i = 0; i < count; ++i) {
+			usz j = gen() % triangles.size();
+			ids[i] = triangleIds[j];
+			moved[i] = triangles[j] = randomTriangle(size);
+		}
+
+		scene.updateBatch(std::span<const u64>(ids), std::span<const Triangle>(moved));
+	};
+
+	move(64, 2);
+	scene.update(0);
+	verify("after a refit");
+
+	//Any refit that makes the tree worse starts a background rebuild now
+	//Geometry keeps moving while it builds, so it's refit again once it's swapped in
+
+	f32 threshold = scene.getBVHRebuildThreshold();
+	scene.setBVHRebuildThreshold(0);
+
+	move(1024, 20);
+	scene.update(0);
+
+	if (!scene.isRebuildingBVH())
+		oic::System::log()->fatal("BVH wasn't rebuilt in the background after refits made it worse");
+
+	scene.setBVHRebuildThreshold(threshold);
+
+	while (scene.isRebuildingBVH()) {
+		move(16, 2);
+		std::this_thread::yield();
+		scene.update(0);
+	}
+
+	verify("after the background build was swapped in");
+}
+
 //Create window and wait for exit
 
 int main() {
@@ -543,6 +892,11 @@ int main() {
 		1
 	);
 
+	verifyBulkEncode();
+	verifyCompaction(g);
+	verifyMaterialDelete(g);
+	verifySceneBVH(g);
+
 	TestViewportInterface viewportInterface(g);
 
 	g.pause();